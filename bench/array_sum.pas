@@ -0,0 +1,20 @@
+PROGRAM ASUM;
+{ Fills and sums an array; the FOR counters index it, so bounds are
+  checked once per loop }
+LET N = 100000;
+VAR
+    A: ARRAY[1..N] OF REAL;
+    I: INTEGER;
+    J: INTEGER;
+    S: REAL;
+BEGIN
+    S := 0;
+    FOR J := 1 TO 10 DO
+    BEGIN
+        FOR I := 1 TO N DO
+            A[I] := A[I] + I;
+        FOR I := 1 TO N DO
+            S := S + A[I]
+    END;
+    WRITE(S)
+END
@@ -0,0 +1,32 @@
+PROGRAM COSUM;
+{ Two independent summing loops, run at the same time by COBEGIN }
+LET N = 1000000;
+VAR
+    I: INTEGER;
+    J: INTEGER;
+    S: REAL;
+    T: REAL;
+BEGIN
+    COBEGIN
+        BEGIN
+            S := 0;
+            I := 0;
+            WHILE (I < N)
+            BEGIN
+                S := S + I;
+                I := I + 1
+            END
+        END;
+        BEGIN
+            T := 0;
+            J := 0;
+            WHILE (J < N)
+            BEGIN
+                T := T + 2 * J;
+                J := J + 1
+            END
+        END
+    COEND;
+    WRITE(S);
+    WRITE(T)
+END
@@ -0,0 +1,11 @@
+PROGRAM FCOUNT;
+{ The same loop as while_count.pas written with FOR }
+VAR
+    I: INTEGER;
+    S: REAL;
+BEGIN
+    S := 0;
+    FOR I := 3000000 DOWNTO 1 DO
+        S := S + 1;
+    WRITE(S)
+END
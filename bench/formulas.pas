@@ -0,0 +1,26 @@
+PROGRAM FORMULAS;
+{ Straight-line formulas that repeat their subexpressions, evaluated for
+  300000 points; compare with --no-optimize }
+VAR
+    I: INTEGER;
+    X: REAL;
+    Y: REAL;
+    D: REAL;
+    E: REAL;
+    F: REAL;
+    S: REAL;
+BEGIN
+    S := 0;
+    I := 0;
+    WHILE I < 300000
+    BEGIN
+        X := I / 1000;
+        Y := I / 3000 + 1;
+        D := X * X + Y * Y + 1;
+        E := (X * X + Y * Y + 1) / (X * Y + 1) - X * Y;
+        F := (X * X + Y * Y + 1) * (X * Y + 1) + (X - Y) * (X - Y);
+        S := S + D + E / F;
+        I := I + 1
+    END;
+    WRITE(S)
+END
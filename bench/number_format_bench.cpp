@@ -0,0 +1,75 @@
+// Times format_number against std::ostream << float over the same values
+// and checks that both give the same text. Built by "make bench-format".
+#include "../number_format.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+static const size_t valueCount = 4000000;
+
+// Integers, fractions and values across the float range, as WRITE sees them.
+static std::vector<float> make_values() {
+  std::vector<float> values;
+  uint32_t state = 12345;
+  for (size_t i = 0; i < valueCount; i++) {
+    state = state * 1664525u + 1013904223u;
+    switch (i % 4) {
+    case 0:
+      values.push_back((float)(i / 4));
+      break;
+    case 1:
+      values.push_back((float)(i / 4) / 1000.0f);
+      break;
+    case 2:
+      values.push_back((float)state / 65536.0f - 32768.0f);
+      break;
+    default: {
+      uint32_t bits = (state & 0x7fffffffu) | ((state & 1u) << 31);
+      float value;
+      memcpy(&value, &bits, sizeof value);
+      values.push_back(value);
+    }
+    }
+  }
+  return values;
+}
+
+int main() {
+  std::vector<float> values = make_values();
+
+  auto start = std::chrono::steady_clock::now();
+  std::ostringstream stream;
+  for (size_t i = 0; i < values.size(); i++)
+    stream << values[i] << "\n";
+  std::string expected = stream.str();
+  double stream_seconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+
+  start = std::chrono::steady_clock::now();
+  std::string text;
+  text.reserve(expected.size());
+  char buffer[numberTextSize];
+  for (size_t i = 0; i < values.size(); i++) {
+    size_t length = format_number(values[i], buffer);
+    buffer[length++] = '\n';
+    text.append(buffer, length);
+  }
+  double format_seconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+
+  printf("%zu values\n", values.size());
+  printf("ostream << float   %.3f s\n", stream_seconds);
+  printf("format_number      %.3f s\n", format_seconds);
+  if (text != expected) {
+    printf("ERROR: texts differ\n");
+    return 1;
+  }
+  printf("texts identical\n");
+  return 0;
+}
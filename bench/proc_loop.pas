@@ -0,0 +1,30 @@
+PROGRAM PLOOP;
+{ Procedure calls from a WHILE loop: each call runs a small loop over its
+  parameters and locals and adds the result to a global, 300000 times }
+VAR
+    I: INTEGER;
+    S: REAL;
+PROCEDURE STEP(N: INTEGER; X: REAL);
+VAR
+    K: INTEGER;
+    T: REAL;
+BEGIN
+    T := 0;
+    K := 0;
+    WHILE K < N
+    BEGIN
+        T := T + X * K + K / 2;
+        K := K + 1
+    END;
+    S := S + T
+END;
+BEGIN
+    S := 0;
+    I := 0;
+    WHILE I < 300000
+    BEGIN
+        STEP(8, I / 300000);
+        I := I + 1
+    END;
+    WRITE(S)
+END
@@ -0,0 +1,16 @@
+PROGRAM RSUM;
+{ Sums values read from the input; run.sh feeds it a million numbers }
+LET N = 1000000;
+VAR
+    I: INTEGER;
+    X: REAL;
+    S: REAL;
+BEGIN
+    S := 0;
+    FOR I := 1 TO N DO
+    BEGIN
+        READ(X);
+        S := S + X
+    END;
+    WRITE(S)
+END
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Times the benchmark programs. Usage: bench/run.sh [path to tips]
+
+TIPS=${1:-./tips}
+DIR=$(dirname "$0")
+TIMEFORMAT='%R s'
+
+run() {
+  printf '%-40s ' "$*"
+  { time "$TIPS" "$@" > /dev/null; } 2>&1
+}
+
+# The WHILE and FOR counting loops are compared as written; optimized, the
+# WHILE loop is computed in closed form, timed on its own below.
+run --no-optimize "$DIR/while_count.pas"
+run "$DIR/while_arith.pas"
+run --no-optimize "$DIR/for_count.pas"
+run "$DIR/while_count.pas"
+run "$DIR/array_sum.pas"
+run "$DIR/cobegin_sum.pas"
+run --threads 1 "$DIR/cobegin_sum.pas"
+run "$DIR/write_lines.pas"
+run "$DIR/formulas.pas"
+run --no-optimize "$DIR/formulas.pas"
+run "$DIR/proc_loop.pas"
+
+# The same loops compiled to native code
+run --jit "$DIR/while_count.pas"
+run --jit "$DIR/while_arith.pas"
+run --jit "$DIR/for_count.pas"
+run --jit "$DIR/array_sum.pas"
+
+# The same loops run as closures
+run --closures --no-optimize "$DIR/while_count.pas"
+run --closures "$DIR/while_arith.pas"
+run --closures --no-optimize "$DIR/for_count.pas"
+run --closures "$DIR/array_sum.pas"
+run --closures "$DIR/formulas.pas"
+run --closures "$DIR/proc_loop.pas"
+
+INPUT=$(mktemp)
+trap 'rm -f "$INPUT"' EXIT
+awk 'BEGIN { for (i = 1; i <= 1000000; i++) printf "%d.%d\n", i, i % 7 }' > "$INPUT"
+run --input "$INPUT" "$DIR/read_sum.pas"
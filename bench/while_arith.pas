@@ -0,0 +1,26 @@
+PROGRAM WARITH;
+{ Floating point arithmetic in nested WHILE loops: sums a polynomial in
+  X and Y over a 2000 by 1000 grid }
+VAR
+    I: INTEGER;
+    J: INTEGER;
+    X: REAL;
+    Y: REAL;
+    S: REAL;
+BEGIN
+    S := 0;
+    I := 0;
+    WHILE I < 2000
+    BEGIN
+        X := I / 2000;
+        J := 0;
+        WHILE J < 1000
+        BEGIN
+            Y := J / 1000;
+            S := S + X * X * Y - X * Y * Y / 3 + 1;
+            J := J + 1
+        END;
+        I := I + 1
+    END;
+    WRITE(S)
+END
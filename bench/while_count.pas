@@ -0,0 +1,15 @@
+PROGRAM WCOUNT;
+{ Counting loop written with WHILE, as in programs before FOR existed }
+VAR
+    I: INTEGER;
+    S: REAL;
+BEGIN
+    S := 0;
+    I := 3000000;
+    WHILE I > 0
+    BEGIN
+        S := S + 1;
+        I := I - 1
+    END;
+    WRITE(S)
+END
@@ -0,0 +1,9 @@
+PROGRAM WLINES;
+{ Writes a value per iteration, so the run is bound by output }
+LET N = 1000000;
+VAR
+    I: INTEGER;
+BEGIN
+    FOR I := 1 TO N DO
+        WRITE(I)
+END
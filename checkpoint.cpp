@@ -0,0 +1,245 @@
+#include "checkpoint.h"
+#include "input.h"
+#include "output.h"
+#include "parser.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <unistd.h>
+
+// Snapshot layout (native byte order):
+//   "TIPSCKP3", u64 source hash, u64 input values consumed,
+//   u32 variable count, { u16 name length, name, f32 value } ...,
+//   u32 array count, { u16 name length, name, u32 size, f32 element ... } ...,
+//   u32 call stack size, { f32 value } ...,
+//   u32 position depth, { i64 entry } ...
+static const char snapshotMagic[8] = {'T', 'I', 'P', 'S', 'C', 'K', 'P', '4'};
+
+std::vector<long> checkpointPosition;
+
+bool checkpointActive = false;
+bool checkpointResuming = false;
+unsigned long inputValuesConsumed = 0;
+
+static std::string snapshotFile;
+static unsigned long checkpointEvery = 0;
+static unsigned long sinceCheckpoint = 0;
+static unsigned long long sourceHash = 0;
+
+static std::vector<int> resumePosition;
+static size_t resumeDepth = 0;
+
+static volatile sig_atomic_t pendingSignal = 0;
+
+static void on_checkpoint_signal(int sig) { pendingSignal = sig; }
+
+static void write_snapshot();
+
+// Writes the snapshot a signal asked for, and stops unless it was SIGUSR1.
+static void take_signal() {
+  int sig = pendingSignal;
+  pendingSignal = 0;
+  sinceCheckpoint = 0;
+  write_snapshot();
+  if (sig != SIGUSR1) {
+    output_flush();
+    std::cerr << "INFO: checkpoint written to " << snapshotFile << std::endl;
+    exit(128 + sig);
+  }
+}
+
+// A READ waiting for input is at a statement boundary: nothing it reads has
+// been stored yet, so the snapshot resumes by running it again.
+static void on_input_interrupted() {
+  if (pendingSignal)
+    take_signal();
+}
+
+unsigned long long checkpoint_hash_file(const char *path) {
+  unsigned long long hash = 14695981039346656037ULL;
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return 0;
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    hash ^= (unsigned char)c;
+    hash *= 1099511628211ULL;
+  }
+  fclose(file);
+  return hash;
+}
+
+void checkpoint_init(const std::string &path, unsigned long every,
+                     unsigned long long source_hash) {
+  snapshotFile = path;
+  checkpointEvery = every;
+  sourceHash = source_hash;
+  checkpointActive = true;
+
+  // Without SA_RESTART, so that a READ blocked on a terminal or pipe wakes
+  // up to take the signal instead of waiting for more input.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_checkpoint_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  sigaction(SIGINT, &action, nullptr);
+  inputInterruptHook = on_input_interrupted;
+}
+
+static void write_snapshot() {
+  std::string buffer(snapshotMagic, sizeof(snapshotMagic));
+  uint64_t u64;
+  uint32_t u32;
+
+  u64 = sourceHash;
+  buffer.append((const char *)&u64, sizeof(u64));
+  u64 = inputValuesConsumed;
+  buffer.append((const char *)&u64, sizeof(u64));
+
+  u32 = symbolTable.size();
+  buffer.append((const char *)&u32, sizeof(u32));
+  for (auto it = symbolTable.begin(); it != symbolTable.end(); ++it) {
+    uint16_t length = it->first.size();
+    buffer.append((const char *)&length, sizeof(length));
+    buffer.append(it->first);
+    buffer.append((const char *)&it->second, sizeof(float));
+  }
+
+  u32 = arrayTable.size();
+  buffer.append((const char *)&u32, sizeof(u32));
+  for (auto it = arrayTable.begin(); it != arrayTable.end(); ++it) {
+    uint16_t length = it->first.size();
+    buffer.append((const char *)&length, sizeof(length));
+    buffer.append(it->first);
+    u32 = it->second->size;
+    buffer.append((const char *)&u32, sizeof(u32));
+    buffer.append((const char *)it->second->elements, u32 * sizeof(float));
+  }
+
+  u32 = stackTop;
+  buffer.append((const char *)&u32, sizeof(u32));
+  buffer.append((const char *)callStack.data(), stackTop * sizeof(float));
+
+  u32 = checkpointPosition.size();
+  buffer.append((const char *)&u32, sizeof(u32));
+  for (auto it = checkpointPosition.begin(); it != checkpointPosition.end();
+       ++it) {
+    int64_t entry = *it;
+    buffer.append((const char *)&entry, sizeof(entry));
+  }
+
+  // Write beside the old snapshot and rename, so a crash mid-write never
+  // leaves a truncated file behind.
+  std::string temp = snapshotFile + ".tmp";
+  FILE *file = fopen(temp.c_str(), "wb");
+  if (!file)
+    throw("Checkpoint failed: cannot open snapshot file");
+  bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  ok = fflush(file) == 0 && ok;
+  ok = fsync(fileno(file)) == 0 && ok;
+  fclose(file);
+  if (!ok || rename(temp.c_str(), snapshotFile.c_str()) != 0)
+    throw("Checkpoint failed: cannot write snapshot file");
+}
+
+void checkpoint_poll() {
+  if (checkpointEvery != 0 && ++sinceCheckpoint >= checkpointEvery) {
+    sinceCheckpoint = 0;
+    write_snapshot();
+  }
+  if (pendingSignal)
+    take_signal();
+}
+
+bool checkpoint_resume_next(long &entry) {
+  if (!checkpointResuming)
+    return false;
+  entry = resumePosition[resumeDepth++];
+  if (resumeDepth == resumePosition.size())
+    checkpointResuming = false;
+  return true;
+}
+
+template <typename T> static bool read_value(FILE *file, T &value) {
+  return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+bool checkpoint_resume(const std::string &path,
+                       unsigned long long source_hash) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    std::cout << "ERROR: checkpoint file not found\n";
+    return false;
+  }
+
+  char magic[sizeof(snapshotMagic)];
+  uint64_t hash = 0, consumed = 0;
+  uint32_t count = 0;
+  bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+            memcmp(magic, snapshotMagic, sizeof(magic)) == 0 &&
+            read_value(file, hash) && read_value(file, consumed) &&
+            read_value(file, count);
+
+  if (ok && hash != source_hash) {
+    fclose(file);
+    std::cout << "ERROR: checkpoint was taken from a different program\n";
+    return false;
+  }
+
+  for (uint32_t i = 0; ok && i < count; i++) {
+    uint16_t length = 0;
+    float value = 0.0;
+    ok = read_value(file, length);
+    std::string name(length, '\0');
+    ok = ok && fread(&name[0], 1, length, file) == length &&
+         read_value(file, value);
+    auto var = symbolTable.find(name);
+    ok = ok && var != symbolTable.end();
+    if (ok)
+      var->second = value;
+  }
+
+  ok = ok && read_value(file, count);
+  for (uint32_t i = 0; ok && i < count; i++) {
+    uint16_t length = 0;
+    uint32_t size = 0;
+    ok = read_value(file, length);
+    std::string name(length, '\0');
+    ok = ok && fread(&name[0], 1, length, file) == length &&
+         read_value(file, size);
+    auto array = arrayTable.find(name);
+    ok = ok && array != arrayTable.end() && array->second->size == size &&
+         fread(array->second->elements, sizeof(float), size, file) == size;
+  }
+
+  ok = ok && read_value(file, count) && count <= callStack.size() &&
+       fread(callStack.data(), sizeof(float), count, file) == count;
+
+  resumePosition.clear();
+  ok = ok && read_value(file, count);
+  for (uint32_t i = 0; ok && i < count; i++) {
+    int64_t entry = 0;
+    ok = read_value(file, entry);
+    resumePosition.push_back(entry);
+  }
+  fclose(file);
+
+  if (!ok || resumePosition.empty()) {
+    std::cout << "ERROR: checkpoint file is corrupt\n";
+    return false;
+  }
+
+  // Input is replayed from the start, so skip what was already read.
+  input_skip(consumed);
+  inputValuesConsumed = consumed;
+
+  resumeDepth = 0;
+  checkpointResuming = true;
+  checkpointActive = true;
+  return true;
+}
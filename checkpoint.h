@@ -0,0 +1,28 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+
+// Execution position while checkpointing: one entry per active compound
+// statement (index of the current child), WHILE loop (0 at the loop head,
+// 1 in the body) and IF statement (1 in THEN, 2 in ELSE). FOR loops take
+// three entries: the counter value, iterations left, and 0 or 1 as WHILE.
+// Procedure calls record where their frame starts in callStack.
+extern std::vector<long> checkpointPosition;
+
+extern bool checkpointActive;
+extern bool checkpointResuming;
+extern unsigned long inputValuesConsumed;
+
+void checkpoint_init(const std::string &path, unsigned long every,
+                     unsigned long long source_hash);
+bool checkpoint_resume(const std::string &path,
+                       unsigned long long source_hash);
+
+bool checkpoint_resume_next(long &entry);
+void checkpoint_poll();
+
+unsigned long long checkpoint_hash_file(const char *path);
+
+#endif /* CHECKPOINT_H */
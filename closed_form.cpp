@@ -0,0 +1,107 @@
+#include "closed_form.h"
+#include "parser.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Whole numbers up to this magnitude are exact in a float, as is the sum or
+// difference of two of them that stays in range.
+static const long long exactIntegers = 16777216;
+
+static bool exact(long long value) {
+  return value >= -exactIntegers && value <= exactIntegers;
+}
+
+// -0.0 is left out: -0.0 + -0.0 keeps the sign, which counting in long long
+// would lose.
+static bool whole(float value, long long &into) {
+  if (!(std::fabs(value) <= exactIntegers) || value != std::floor(value) ||
+      (value == 0.0f && std::signbit(value)))
+    return false;
+  into = (long long)value;
+  return true;
+}
+
+static float *storage(const Scalar &variable) {
+  if (variable.second >= 0)
+    return &callStack[framePointer + variable.second];
+  auto found = symbolTable.find(variable.first);
+  return found == symbolTable.end() ? nullptr : &found->second;
+}
+
+bool run_closed_form(ClosedFormLoop *plan, float &result) {
+  std::vector<float *> targets;
+  for (auto it = plan->updates.begin(); it != plan->updates.end(); ++it) {
+    float *target = storage(it->variable);
+    if (!target)
+      return false;
+    targets.push_back(target);
+  }
+
+  long long first = 0, bound = 0;
+  long long step = plan->updates[plan->counter].step;
+  if (!whole(*targets[plan->counter], first) ||
+      !whole(plan->bound->interpret(), bound))
+    return false;
+
+  // Whole numbers differ by at least 1 or not at all, so the EPSILON of the
+  // comparisons makes no difference.
+  long long trips = 0;
+  switch (plan->relational_operator) {
+  case TOK_LESSTHAN:
+    if (first < bound) {
+      if (step <= 0)
+        return false;
+      trips = (bound - first + step - 1) / step;
+    }
+    break;
+  case TOK_GREATERTHAN:
+    if (first > bound) {
+      if (step >= 0)
+        return false;
+      trips = (first - bound - step - 1) / -step;
+    }
+    break;
+  default:
+    if (first != bound) {
+      if ((bound - first) % step != 0 || (bound - first) / step < 0)
+        return false;
+      trips = (bound - first) / step;
+    }
+    break;
+  }
+  result = 0.0;
+  if (trips == 0)
+    return true;
+  if (!exact(first + trips * step))
+    return false;
+
+  std::vector<long long> finals(plan->updates.size());
+  for (size_t i = 0; i < plan->updates.size(); i++) {
+    const ClosedFormUpdate &update = plan->updates[i];
+    long long start = 0;
+    if (!whole(*targets[i], start))
+      return false;
+    if (update.counter_sign == 0) {
+      finals[i] = start + trips * update.step;
+      if (!exact(finals[i]))
+        return false;
+      continue;
+    }
+    // The counter as this update reads it in the first and last iteration;
+    // every partial sum is within start plus trips times the larger.
+    long long low = i < plan->counter ? first : first + step;
+    long long high = low + (trips - 1) * step;
+    long long largest = std::max(std::llabs(low), std::llabs(high));
+    if (std::llabs(start) + trips * largest > exactIntegers)
+      return false;
+    finals[i] = start + update.counter_sign *
+                            (trips * low + step * (trips * (trips - 1) / 2));
+  }
+
+  for (size_t i = 0; i < finals.size(); i++)
+    *targets[i] = (float)finals[i];
+  result = (float)finals.back();
+  statementsExecuted += trips * plan->statements;
+  return true;
+}
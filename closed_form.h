@@ -0,0 +1,36 @@
+#ifndef CLOSED_FORM_H
+#define CLOSED_FORM_H
+
+#include "parallel.h"
+#include <vector>
+
+// V := V + c, V := c + V or V := V - c in the body of a counting loop, with
+// c a whole-number constant or the loop counter.
+struct ClosedFormUpdate {
+  Scalar variable;
+  long step = 0;        // c, negated for V := V - c
+  int counter_sign = 0; // 1 or -1 when the counter is added or subtracted
+};
+
+// A WHILE loop whose condition compares a counter with a bound the loop does
+// not change (<, > or <>), and whose body is only updates, one of them
+// adding a constant to the counter.
+struct ClosedFormLoop {
+  std::vector<ClosedFormUpdate> updates; // in the order of the body
+  size_t counter = 0;                     // the counter's update
+  int relational_operator = TOK_LESSTHAN;
+  SimpleExpressionNode *bound = nullptr;
+  // Statements an iteration runs: the body, and the updates in it when it
+  // is a compound statement.
+  unsigned long statements = 0;
+};
+
+// Sets the variables of a planned loop to the values iterating it would
+// leave, and result to the value of its last statement, counting the
+// statements the iterations would have run. Returns false,
+// having done nothing, unless the variables and the bound hold whole numbers
+// that keep every value the loop would compute within 2^24, where float
+// arithmetic is exact and the result the same; the loop then iterates.
+bool run_closed_form(ClosedFormLoop *plan, float &result);
+
+#endif /* CLOSED_FORM_H */
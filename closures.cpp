@@ -0,0 +1,777 @@
+#define EPSILON 0.001
+
+#include "closures.h"
+#include "checkpoint.h"
+#include "closed_form.h"
+#include "input.h"
+#include "number_format.h"
+#include "output.h"
+#include "parallel.h"
+#include "parser.h"
+#include "quicken.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+
+// Operand reads, inlined into each closure even in an unoptimized build.
+#define OPERAND static inline __attribute__((always_inline))
+
+// A closure: run(self) evaluates it. Each kind below adds the closures of
+// its operands and the storage of its variables.
+struct Closure {
+  float (*run)(const Closure *self) = nullptr;
+  virtual ~Closure() {}
+};
+
+// Every closure of the program, freed by the next build.
+static std::vector<std::unique_ptr<Closure>> closures;
+
+template <typename Kind> static Kind *make() {
+  Kind *closure = new Kind();
+  closure->run = Kind::evaluate;
+  closures.emplace_back(closure);
+  return closure;
+}
+
+// callStack's storage; callStack never grows.
+static float *stack = nullptr;
+
+// BREAK or CONTINUE on its way out to the loop it leaves, as in the
+// interpreter.
+static int pendingExit = 0;
+
+// Procedure bodies, built once for all their calls. A recursive call refers
+// to its body before the body is finished.
+static std::map<ProcedureNode *, const Closure *> bodies;
+
+static const Closure *build(ExpressionNode *expression);
+static const Closure *build(StatementNode *statement);
+
+// Expressions
+
+struct Constant : Closure {
+  float value = 0.0;
+  static float evaluate(const Closure *self) {
+    return static_cast<const Constant *>(self)->value;
+  }
+};
+
+struct SlotRead : Closure {
+  int slot = 0;
+  static float evaluate(const Closure *self) {
+    return stack[framePointer + static_cast<const SlotRead *>(self)->slot];
+  }
+};
+
+struct GlobalRead : Closure {
+  float *storage = nullptr;
+  static float evaluate(const Closure *self) {
+    return *static_cast<const GlobalRead *>(self)->storage;
+  }
+};
+
+// A global that does not exist fails when read, as interpreted.
+struct MissingGlobal : Closure {
+  const char *message = nullptr;
+  static float evaluate(const Closure *self) {
+    throw(static_cast<const MissingGlobal *>(self)->message);
+  }
+};
+
+struct TreeFactor : Closure {
+  FactorNode *factor = nullptr;
+  static float evaluate(const Closure *self) {
+    return static_cast<const TreeFactor *>(self)->factor->interpret();
+  }
+};
+
+struct Negate : Closure {
+  const Closure *child = nullptr;
+  static float evaluate(const Closure *self) {
+    const Closure *child = static_cast<const Negate *>(self)->child;
+    return -child->run(child);
+  }
+};
+
+template <bool integer_operand> struct Not : Closure {
+  const Closure *child = nullptr;
+  static float evaluate(const Closure *self) {
+    const Closure *child = static_cast<const Not *>(self)->child;
+    float value = child->run(child);
+    if (integer_operand)
+      return value > 0.0f ? 0.0 : 1.0;
+    return value >= EPSILON ? 0.0 : 1.0;
+  }
+};
+
+struct ArrayRead : Closure {
+  const Closure *index = nullptr;
+  ArrayVariable *array = nullptr;
+  const bool *skip_check = nullptr;
+  static float evaluate(const Closure *self) {
+    const ArrayRead *read = static_cast<const ArrayRead *>(self);
+    float index = read->index->run(read->index);
+    return *read->array->element(index, !*read->skip_check);
+  }
+};
+
+static const Closure *constant(float value) {
+  Constant *closure = make<Constant>();
+  closure->value = value;
+  return closure;
+}
+
+static const Closure *variable(const std::string &name, int frame_slot,
+                               const char *missing) {
+  if (frame_slot >= 0) {
+    SlotRead *closure = make<SlotRead>();
+    closure->slot = frame_slot;
+    return closure;
+  }
+  auto var = symbolTable.find(name);
+  if (var == symbolTable.end()) {
+    MissingGlobal *closure = make<MissingGlobal>();
+    closure->message = missing;
+    return closure;
+  }
+  GlobalRead *closure = make<GlobalRead>();
+  closure->storage = &var->second;
+  return closure;
+}
+
+static const Closure *build(FactorNode *factor) {
+  if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor))
+    return variable(id->identifier, id->frame_slot,
+                    "Id Factor Node failed: var undefined");
+  if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(factor)) {
+    // Literals out of float range fail when evaluated, as interpreted.
+    try {
+      return constant(std::stof(literal->int_literal));
+    } catch (...) {
+    }
+  } else if (FloatFactorNode *literal =
+                 dynamic_cast<FloatFactorNode *>(factor)) {
+    return constant(literal->float_literal);
+  } else if (ConstantFactorNode *value =
+                 dynamic_cast<ConstantFactorNode *>(factor)) {
+    return constant(value->constant_value);
+  } else if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor)) {
+    Negate *closure = make<Negate>();
+    closure->child = build(minus->child_factor);
+    return closure;
+  } else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor)) {
+    const Closure *child = build(negation->child_factor);
+    if (negation->integer_operand) {
+      Not<true> *closure = make<Not<true>>();
+      closure->child = child;
+      return closure;
+    }
+    Not<false> *closure = make<Not<false>>();
+    closure->child = child;
+    return closure;
+  } else if (ExpressionFactorNode *nested =
+                 dynamic_cast<ExpressionFactorNode *>(factor)) {
+    return build(nested->child_expression);
+  } else if (ArrayFactorNode *element =
+                 dynamic_cast<ArrayFactorNode *>(factor)) {
+    ArrayRead *closure = make<ArrayRead>();
+    closure->index = build(element->index_expression);
+    closure->array = element->array;
+    closure->skip_check = element->skip_check;
+    return closure;
+  }
+  TreeFactor *closure = make<TreeFactor>();
+  closure->factor = factor;
+  return closure;
+}
+
+// An operand of an arithmetic or relational operator: read where it is
+// when it is a variable or constant, else a closure.
+enum { slotOperand, globalOperand, constantOperand, closureOperand };
+
+struct Operand {
+  int slot = 0;
+  float *global = nullptr;
+  float constant = 0.0;
+  const Closure *closure = nullptr;
+};
+
+template <int kind> OPERAND float load(const Operand &operand) {
+  if (kind == slotOperand)
+    return stack[framePointer + operand.slot];
+  if (kind == globalOperand)
+    return *operand.global;
+  if (kind == constantOperand)
+    return operand.constant;
+  return operand.closure->run(operand.closure);
+}
+
+template <int op, bool exact> OPERAND float apply(float first, float second) {
+  switch (op) {
+  case TOK_PLUS:
+    return first + second;
+  case TOK_MINUS:
+    return first - second;
+  case TOK_MULTIPLY:
+    return first * second;
+  case TOK_DIVIDE:
+    return first / second;
+  default:
+    return compare_fixed<op, exact>(first, second);
+  }
+}
+
+// op on two operands of the given kinds, evaluated left to right as
+// interpreted.
+template <int op, bool exact, int left, int right> struct Binary : Closure {
+  Operand first, second;
+  static float evaluate(const Closure *self) {
+    const Binary *binary = static_cast<const Binary *>(self);
+    float value = load<left>(binary->first);
+    return apply<op, exact>(value, load<right>(binary->second));
+  }
+};
+
+template <int op, bool exact, int left, int right>
+static const Closure *binary(const Operand &first, const Operand &second) {
+  Binary<op, exact, left, right> *closure =
+      make<Binary<op, exact, left, right>>();
+  closure->first = first;
+  closure->second = second;
+  return closure;
+}
+
+template <int op, bool exact, int left>
+static const Closure *binary(const Operand &first, int second_kind,
+                             const Operand &second) {
+  switch (second_kind) {
+  case slotOperand:
+    return binary<op, exact, left, slotOperand>(first, second);
+  case globalOperand:
+    return binary<op, exact, left, globalOperand>(first, second);
+  case constantOperand:
+    return binary<op, exact, left, constantOperand>(first, second);
+  default:
+    return binary<op, exact, left, closureOperand>(first, second);
+  }
+}
+
+// The operand a closure made by constant() or variable() stands for.
+static int operand_of(const Closure *closure, Operand &operand) {
+  if (closure->run == Constant::evaluate) {
+    operand.constant = static_cast<const Constant *>(closure)->value;
+    return constantOperand;
+  }
+  if (closure->run == SlotRead::evaluate) {
+    operand.slot = static_cast<const SlotRead *>(closure)->slot;
+    return slotOperand;
+  }
+  if (closure->run == GlobalRead::evaluate) {
+    operand.global = static_cast<const GlobalRead *>(closure)->storage;
+    return globalOperand;
+  }
+  operand.closure = closure;
+  return closureOperand;
+}
+
+template <int op, bool exact = false>
+static const Closure *binary(const Closure *first, const Closure *second) {
+  Operand left, right;
+  int left_kind = operand_of(first, left);
+  int right_kind = operand_of(second, right);
+  switch (left_kind) {
+  case slotOperand:
+    return binary<op, exact, slotOperand>(left, right_kind, right);
+  case globalOperand:
+    return binary<op, exact, globalOperand>(left, right_kind, right);
+  case constantOperand:
+    return binary<op, exact, constantOperand>(left, right_kind, right);
+  default:
+    return binary<op, exact, closureOperand>(left, right_kind, right);
+  }
+}
+
+// AND and OR, which skip their second operand once the first decides.
+template <bool is_and> struct Logical : Closure {
+  const Closure *first = nullptr;
+  const Closure *second = nullptr;
+  static float evaluate(const Closure *self) {
+    const Logical *logical = static_cast<const Logical *>(self);
+    bool holds = logical->first->run(logical->first) >= EPSILON;
+    if (holds == is_and)
+      holds = logical->second->run(logical->second) >= EPSILON;
+    return holds ? 1.0 : 0.0;
+  }
+};
+
+template <bool is_and>
+static const Closure *logical(const Closure *first, const Closure *second) {
+  Logical<is_and> *closure = make<Logical<is_and>>();
+  closure->first = first;
+  closure->second = second;
+  return closure;
+}
+
+static const Closure *build(TermNode *term) {
+  const Closure *result = build(term->first_factor);
+  for (size_t i = 0; i < term->following_operators.size(); i++) {
+    const Closure *next = build(term->following_factors[i]);
+    switch (term->following_operators[i]) {
+    case TOK_MULTIPLY:
+      result = binary<TOK_MULTIPLY>(result, next);
+      break;
+    case TOK_DIVIDE:
+      result = binary<TOK_DIVIDE>(result, next);
+      break;
+    case TOK_AND:
+      result = logical<true>(result, next);
+      break;
+    default:
+      break;
+    }
+  }
+  return result;
+}
+
+static const Closure *build(SimpleExpressionNode *simple_exp) {
+  const Closure *result = build(simple_exp->first_term);
+  for (size_t i = 0; i < simple_exp->following_operators.size(); i++) {
+    const Closure *next = build(simple_exp->following_terms[i]);
+    switch (simple_exp->following_operators[i]) {
+    case TOK_PLUS:
+      result = binary<TOK_PLUS>(result, next);
+      break;
+    case TOK_MINUS:
+      result = binary<TOK_MINUS>(result, next);
+      break;
+    case TOK_OR:
+      result = logical<false>(result, next);
+      break;
+    default:
+      break;
+    }
+  }
+  return result;
+}
+
+template <bool exact>
+static const Closure *comparison(int op, const Closure *first,
+                                 const Closure *second) {
+  switch (op) {
+  case TOK_LESSTHAN:
+    return binary<TOK_LESSTHAN, exact>(first, second);
+  case TOK_GREATERTHAN:
+    return binary<TOK_GREATERTHAN, exact>(first, second);
+  case TOK_EQUALTO:
+    return binary<TOK_EQUALTO, exact>(first, second);
+  default:
+    return binary<TOK_NOTEQUALTO, exact>(first, second);
+  }
+}
+
+static const Closure *build(ExpressionNode *expression) {
+  const Closure *first = build(expression->first_simple_exp);
+  if (expression->simple_exp_operator == TOK_UNKNOWN)
+    return first;
+  const Closure *second = build(expression->second_simple_exp);
+  if (expression->exact_compare)
+    return comparison<true>(expression->simple_exp_operator, first, second);
+  return comparison<false>(expression->simple_exp_operator, first, second);
+}
+
+// Statements
+
+struct TreeStatement : Closure {
+  StatementNode *statement = nullptr;
+  static float evaluate(const Closure *self) {
+    return static_cast<const TreeStatement *>(self)->statement->interpret();
+  }
+};
+
+template <bool has_loop_exit> struct Compound : Closure {
+  std::vector<const Closure *> children;
+  static float evaluate(const Closure *self) {
+    const Compound *compound = static_cast<const Compound *>(self);
+    const Closure *const *child = compound->children.data();
+    const Closure *const *end = child + compound->children.size();
+    if (countStatements)
+      statementsExecuted++;
+    float result = 0.0;
+    for (; child != end; child++) {
+      result = (*child)->run(*child);
+      if (has_loop_exit && pendingExit)
+        break;
+    }
+    return result;
+  }
+};
+
+struct SlotAssignment : Closure {
+  int slot = 0;
+  const Closure *value = nullptr;
+  static float evaluate(const Closure *self) {
+    const SlotAssignment *assignment =
+        static_cast<const SlotAssignment *>(self);
+    if (countStatements)
+      statementsExecuted++;
+    float value = assignment->value->run(assignment->value);
+    return stack[framePointer + assignment->slot] = value;
+  }
+};
+
+struct GlobalAssignment : Closure {
+  float *storage = nullptr;
+  const Closure *value = nullptr;
+  static float evaluate(const Closure *self) {
+    const GlobalAssignment *assignment =
+        static_cast<const GlobalAssignment *>(self);
+    if (countStatements)
+      statementsExecuted++;
+    return *assignment->storage = assignment->value->run(assignment->value);
+  }
+};
+
+struct ArrayAssignment : Closure {
+  const Closure *index = nullptr;
+  const Closure *value = nullptr;
+  ArrayVariable *array = nullptr;
+  const bool *skip_check = nullptr;
+  static float evaluate(const Closure *self) {
+    const ArrayAssignment *assignment =
+        static_cast<const ArrayAssignment *>(self);
+    if (countStatements)
+      statementsExecuted++;
+    float index = assignment->index->run(assignment->index);
+    float *element =
+        assignment->array->element(index, !*assignment->skip_check);
+    return *element = assignment->value->run(assignment->value);
+  }
+};
+
+// READ into a frame slot, or into a global's storage when it is set.
+struct Read : Closure {
+  int slot = 0;
+  float *storage = nullptr;
+  static float evaluate(const Closure *self) {
+    const Read *read = static_cast<const Read *>(self);
+    if (countStatements)
+      statementsExecuted++;
+    output_flush_for_input();
+    float value = input_read_value();
+    inputValuesConsumed++;
+    if (!read->storage)
+      return stack[framePointer + read->slot] = value;
+    return *read->storage = value;
+  }
+};
+
+struct WriteNumber : Closure {
+  const Closure *value = nullptr;
+  static float evaluate(const Closure *self) {
+    const WriteNumber *write = static_cast<const WriteNumber *>(self);
+    if (countStatements)
+      statementsExecuted++;
+    char text[numberTextSize];
+    size_t length = format_number(write->value->run(write->value), text);
+    text[length++] = '\n';
+    programOutput->write(text, length);
+    return 0.0;
+  }
+};
+
+struct WriteText : Closure {
+  const std::string *text = nullptr;
+  static float evaluate(const Closure *self) {
+    if (countStatements)
+      statementsExecuted++;
+    *programOutput << *static_cast<const WriteText *>(self)->text << "\n";
+    return 0.0;
+  }
+};
+
+template <bool integer_condition> struct If : Closure {
+  const Closure *condition = nullptr;
+  const Closure *then_statement = nullptr;
+  const Closure *else_statement = nullptr;
+  static float evaluate(const Closure *self) {
+    const If *branch = static_cast<const If *>(self);
+    if (countStatements)
+      statementsExecuted++;
+    float condition = branch->condition->run(branch->condition);
+    if (integer_condition ? condition > 0.0f : condition > EPSILON)
+      return branch->then_statement->run(branch->then_statement);
+    if (branch->else_statement)
+      return branch->else_statement->run(branch->else_statement);
+    return 0.0;
+  }
+};
+
+// Clears the pending exit once it reaches the loop it belongs to.
+static int take_exit() {
+  int exit_token = pendingExit;
+  pendingExit = 0;
+  return exit_token;
+}
+
+template <bool has_loop_exit> struct While : Closure {
+  const Closure *condition = nullptr;
+  const Closure *body = nullptr;
+  ClosedFormLoop *closed_form = nullptr;
+  static float evaluate(const Closure *self) {
+    const While *loop = static_cast<const While *>(self);
+    const Closure *condition = loop->condition;
+    const Closure *body = loop->body;
+    if (countStatements)
+      statementsExecuted++;
+    float result = 0.0;
+    if (loop->closed_form && run_closed_form(loop->closed_form, result))
+      return result;
+    while (condition->run(condition) == 1.0) {
+      result = body->run(body);
+      if (has_loop_exit && pendingExit && take_exit() == TOK_BREAK)
+        break;
+    }
+    return result;
+  }
+};
+
+// The loop node keeps its counter, bounds checks and parallel plan.
+template <bool has_loop_exit> struct For : Closure {
+  ForStatementNode *loop = nullptr;
+  const Closure *start = nullptr;
+  const Closure *end = nullptr;
+  const Closure *body = nullptr;
+  static float evaluate(const Closure *self) {
+    const For *closure = static_cast<const For *>(self);
+    ForStatementNode *loop = closure->loop;
+    const Closure *body = closure->body;
+    if (countStatements)
+      statementsExecuted++;
+    float *counter = loop->counter_storage();
+    float value = closure->start->run(closure->start);
+    float last = closure->end->run(closure->end);
+    long trips = for_trip_count(value, last, loop->is_downto);
+
+    bool outer_verified = loop->bounds_verified;
+    if (!loop->hoisted_arrays.empty())
+      loop->bounds_verified = loop->counter_in_bounds(value, trips);
+    float result = 0.0;
+    if (!loop->parallel || !run_parallel_loop(loop->parallel, counter, value,
+                                              trips, result)) {
+      float step = loop->is_downto ? -1.0 : 1.0;
+      for (; trips > 0; trips--) {
+        *counter = value;
+        result = body->run(body);
+        if (has_loop_exit && pendingExit && take_exit() == TOK_BREAK)
+          break;
+        value += step;
+      }
+    }
+    loop->bounds_verified = outer_verified;
+    return result;
+  }
+};
+
+struct LoopExit : Closure {
+  int exit_token = TOK_BREAK;
+  static float evaluate(const Closure *self) {
+    if (countStatements)
+      statementsExecuted++;
+    pendingExit = static_cast<const LoopExit *>(self)->exit_token;
+    return 0.0;
+  }
+};
+
+// The callee's frame starts at stackTop: its arguments, then its locals
+// zeroed.
+struct Call : Closure {
+  const Closure *const *body = nullptr;
+  std::vector<const Closure *> arguments;
+  size_t frame_size = 0;
+  static float evaluate(const Closure *self) {
+    const Call *call = static_cast<const Call *>(self);
+    size_t argument_count = call->arguments.size();
+    if (countStatements)
+      statementsExecuted++;
+    size_t frame = stackTop;
+    size_t frame_end = frame + call->frame_size;
+    if (frame_end > stackLimit || native_stack_exhausted())
+      throw("Procedure call failed: call stack overflow");
+    for (size_t i = 0; i < argument_count; i++)
+      stack[frame + i] = call->arguments[i]->run(call->arguments[i]);
+    std::fill(stack + frame + argument_count, stack + frame_end, 0.0f);
+
+    size_t caller = framePointer;
+    framePointer = frame;
+    stackTop = frame_end;
+    const Closure *body = *call->body;
+    float result = body->run(body);
+    framePointer = caller;
+    stackTop = frame;
+    return result;
+  }
+};
+
+static const Closure *tree(StatementNode *statement) {
+  TreeStatement *closure = make<TreeStatement>();
+  closure->statement = statement;
+  return closure;
+}
+
+template <bool has_loop_exit>
+static const Closure *build_compound(CompoundStatementNode *compound) {
+  Compound<has_loop_exit> *closure = make<Compound<has_loop_exit>>();
+  for (auto it = compound->statement_vector.begin();
+       it != compound->statement_vector.end(); ++it)
+    closure->children.push_back(build(*it));
+  return closure;
+}
+
+static const Closure *build_assignment(AssignmentStatementNode *assignment) {
+  if (assignment->frame_slot >= 0) {
+    SlotAssignment *closure = make<SlotAssignment>();
+    closure->slot = assignment->frame_slot;
+    closure->value = build(assignment->assignment_expr);
+    return closure;
+  }
+  auto var = symbolTable.find(assignment->identifier);
+  if (var == symbolTable.end())
+    return tree(assignment);
+  GlobalAssignment *closure = make<GlobalAssignment>();
+  closure->storage = &var->second;
+  closure->value = build(assignment->assignment_expr);
+  return closure;
+}
+
+static const Closure *build_array_assignment(
+    ArrayAssignmentStatementNode *assignment) {
+  ArrayAssignment *closure = make<ArrayAssignment>();
+  closure->index = build(assignment->index_expression);
+  closure->value = build(assignment->assignment_expr);
+  closure->array = assignment->array;
+  closure->skip_check = assignment->skip_check;
+  return closure;
+}
+
+static const Closure *build_read(ReadStatementNode *read_stmt) {
+  Read *closure = make<Read>();
+  closure->slot = read_stmt->frame_slot;
+  if (read_stmt->frame_slot < 0) {
+    auto var = symbolTable.find(read_stmt->read_text);
+    if (var == symbolTable.end())
+      return tree(read_stmt);
+    closure->storage = &var->second;
+  }
+  return closure;
+}
+
+static const Closure *build_write(WriteStatementNode *write) {
+  if (!write->element && write->frame_slot < 0 && !write->is_identifier) {
+    WriteText *closure = make<WriteText>();
+    closure->text = &write->write_text;
+    return closure;
+  }
+  WriteNumber *closure = make<WriteNumber>();
+  if (write->element)
+    closure->value = build(write->element);
+  else
+    closure->value = variable(write->write_text, write->frame_slot,
+                              "Write failed: variable not found");
+  return closure;
+}
+
+template <bool integer_condition>
+static const Closure *build_if(IfStatementNode *branch) {
+  If<integer_condition> *closure = make<If<integer_condition>>();
+  closure->condition = build(branch->if_expression);
+  closure->then_statement = build(branch->then_statement);
+  if (branch->has_else)
+    closure->else_statement = build(branch->else_statement);
+  return closure;
+}
+
+template <bool has_loop_exit>
+static const Closure *build_while(WhileStatementNode *loop) {
+  While<has_loop_exit> *closure = make<While<has_loop_exit>>();
+  closure->condition = build(loop->while_expression);
+  closure->body = build(loop->while_statement);
+  closure->closed_form = loop->closed_form;
+  return closure;
+}
+
+template <bool has_loop_exit>
+static const Closure *build_for(ForStatementNode *loop) {
+  For<has_loop_exit> *closure = make<For<has_loop_exit>>();
+  closure->loop = loop;
+  closure->start = build(loop->start_expression);
+  closure->end = build(loop->end_expression);
+  closure->body = build(loop->for_statement);
+  return closure;
+}
+
+static const Closure *build_call(CallStatementNode *statement) {
+  ProcedureNode *procedure = statement->procedure;
+  Call *closure = make<Call>();
+  auto body = bodies.find(procedure);
+  if (body == bodies.end()) {
+    body = bodies.insert(std::make_pair(procedure, nullptr)).first;
+    body->second = build(procedure->body);
+  }
+  closure->body = &body->second;
+  for (auto it = statement->arguments.begin();
+       it != statement->arguments.end(); ++it)
+    closure->arguments.push_back(build(*it));
+  closure->frame_size = procedure->frame_size;
+  return closure;
+}
+
+static const Closure *build(StatementNode *statement) {
+  // COBEGIN hands its statements to the thread pool as the tree.
+  if (dynamic_cast<CobeginStatementNode *>(statement))
+    return tree(statement);
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement))
+    return compound->has_loop_exit ? build_compound<true>(compound)
+                                   : build_compound<false>(compound);
+  if (AssignmentStatementNode *assignment =
+          dynamic_cast<AssignmentStatementNode *>(statement))
+    return build_assignment(assignment);
+  if (ArrayAssignmentStatementNode *assignment =
+          dynamic_cast<ArrayAssignmentStatementNode *>(statement))
+    return build_array_assignment(assignment);
+  if (ReadStatementNode *read_stmt =
+          dynamic_cast<ReadStatementNode *>(statement))
+    return build_read(read_stmt);
+  if (WriteStatementNode *write =
+          dynamic_cast<WriteStatementNode *>(statement))
+    return build_write(write);
+  if (IfStatementNode *branch = dynamic_cast<IfStatementNode *>(statement))
+    return branch->integer_condition ? build_if<true>(branch)
+                                     : build_if<false>(branch);
+  if (WhileStatementNode *loop =
+          dynamic_cast<WhileStatementNode *>(statement))
+    return loop->while_statement->has_loop_exit ? build_while<true>(loop)
+                                                : build_while<false>(loop);
+  if (ForStatementNode *loop = dynamic_cast<ForStatementNode *>(statement))
+    return loop->for_statement->has_loop_exit ? build_for<true>(loop)
+                                              : build_for<false>(loop);
+  if (LoopExitStatementNode *exit =
+          dynamic_cast<LoopExitStatementNode *>(statement)) {
+    LoopExit *closure = make<LoopExit>();
+    closure->exit_token = exit->exit_token;
+    return closure;
+  }
+  if (CallStatementNode *call = dynamic_cast<CallStatementNode *>(statement))
+    return build_call(call);
+  return tree(statement);
+}
+
+float run_closures(ProgramNode *root) {
+  closures.clear();
+  bodies.clear();
+  stack = callStack.data();
+  const Closure *program = build(root->program_block->compound_stmt);
+  framePointer = 0;
+  stackTop = root->frame_size;
+  return program->run(program);
+}
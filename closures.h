@@ -0,0 +1,17 @@
+#ifndef CLOSURES_H
+#define CLOSURES_H
+
+#include "parse_tree_nodes.h"
+
+// Closure-compiled execution (--closures). The tree is turned once into
+// closures: each holds the closures of its operands and the storage of its
+// variables, and its operator is chosen while building rather than on each
+// call. Parallel loops, COBEGIN statements and closed-form WHILE loops are
+// handed back to the tree as the interpreter runs them, and anything else
+// it does not build runs through interpret().
+//
+// Runs the program and returns what root->interpret() returns, with the
+// same output and errors.
+float run_closures(ProgramNode *root);
+
+#endif /* CLOSURES_H */
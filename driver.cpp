@@ -2,9 +2,29 @@
 #ifdef _MSC_VER
 #endif
 
+#include "checkpoint.h"
+#include "closures.h"
+#include "emit_c.h"
+#include "input.h"
+#include "ir.h"
+#include "jit.h"
 #include "lexer.h"
+#include "number_format.h"
+#include "optimizer.h"
+#include "pgo.h"
+#include "output.h"
+#include "parallel.h"
 #include "parser.h"
+#include "perf_counters.h"
+#include "profiler.h"
+#include "quicken.h"
+#include "range_analysis.h"
+#include "timing.h"
+#include "repl.h"
+#include "work_pool.h"
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <stdio.h>
 
@@ -24,8 +44,65 @@ extern int nextToken;
 bool printParse = false;
 bool printTree = false;
 bool printSymbolTable = false;
+bool interactiveMode = false;
+bool reportParallel = false;
+bool reportRanges = false;
+bool optimizeProgram = true;
+bool reportOptimizations = false;
+bool reportQuickening = false;
+bool profileStatements = false;
+const char *pgoRecordFile = nullptr;
+const char *pgoUseFile = nullptr;
+// -T: 1 for a text timing report, 2 for JSON.
+int timingReport = 0;
+bool perfCounters = false;
+bool useJit = false;
+bool useClosures = false;
+bool useIr = false;
+bool reportIr = false;
+bool emitC = false;
+
+static void lex_perf_phase(int leaving) {
+  if (leaving)
+    perf_phase_end(perfLex);
+  else
+    perf_phase_begin(perfLex);
+}
+
+static void print_symbol_table() {
+  char text[numberTextSize];
+  cout << endl << endl << "*** User Defined Symbols ***" << endl;
+  for (auto it = symbolTable.begin(); it != symbolTable.end(); ++it) {
+    format_fixed((*it).second, text);
+    cout << (*it).first << ": " << text << std::endl;
+  }
+  if (arrayTable.empty())
+    return;
+
+  size_t total = 0;
+  cout << endl << "*** User Defined Arrays ***" << endl;
+  for (auto it = arrayTable.begin(); it != arrayTable.end(); ++it) {
+    ArrayVariable *array = it->second;
+    size_t bytes = array->size * sizeof(float);
+    total += bytes;
+    cout << array->name << ": [" << array->low << ".."
+         << array->low + array->size - 1 << "] OF " << array->element_type
+         << ", " << bytes << " bytes" << endl;
+  }
+  cout << "Total array storage: " << total << " bytes" << endl;
+}
 
 int main(int argc, char *argv[]) {
+  const char *inputFile = nullptr;
+  const char *checkpointFile = nullptr;
+  const char *resumeFile = nullptr;
+  const char *foldedFile = nullptr;
+  unsigned long checkpointEvery = 0;
+  PhaseClock totalClock;
+  TimingReport timing;
+
+  output_start();
+
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-p") == 0) {
       printParse = true;
@@ -33,28 +110,117 @@ int main(int argc, char *argv[]) {
       printTree = true;
     } else if (strcmp(argv[i], "-s") == 0) {
       printSymbolTable = true;
+    } else if (strcmp(argv[i], "-i") == 0) {
+      interactiveMode = true;
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpointFile = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+      checkpointEvery = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+      resumeFile = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      pool_set_size(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--report-parallel") == 0) {
+      reportParallel = true;
+    } else if (strcmp(argv[i], "--report-ranges") == 0) {
+      reportRanges = true;
+    } else if (strcmp(argv[i], "--no-optimize") == 0) {
+      optimizeProgram = false;
+    } else if (strcmp(argv[i], "--report-optimizations") == 0) {
+      reportOptimizations = true;
+    } else if (strcmp(argv[i], "--report-quickening") == 0) {
+      reportQuickening = true;
+    } else if (strcmp(argv[i], "--pgo-record") == 0 && i + 1 < argc) {
+      pgoRecordFile = argv[++i];
+    } else if (strcmp(argv[i], "--pgo-use") == 0 && i + 1 < argc) {
+      pgoUseFile = argv[++i];
+    } else if (strcmp(argv[i], "-T") == 0) {
+      timingReport = 1;
+    } else if (strcmp(argv[i], "--timing-json") == 0) {
+      timingReport = 2;
+    } else if (strcmp(argv[i], "--perf-counters") == 0) {
+      perfCounters = true;
+    } else if (strcmp(argv[i], "--emit-c") == 0) {
+      emitC = true;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      useJit = true;
+    } else if (strcmp(argv[i], "--closures") == 0) {
+      useClosures = true;
+    } else if (strcmp(argv[i], "--ir") == 0) {
+      useIr = true;
+    } else if (strcmp(argv[i], "--report-ir") == 0) {
+      reportIr = true;
+    } else if (strcmp(argv[i], "-P") == 0) {
+      profileStatements = true;
+    } else if (strcmp(argv[i], "--profile-folded") == 0 && i + 1 < argc) {
+      profileStatements = true;
+      foldedFile = argv[++i];
+    } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+      if (!input_open(argv[++i])) {
+        cout << "ERROR: input file " << argv[i] << " not found\n";
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      if (!output_open(argv[++i])) {
+        cout << "ERROR: cannot create output file " << argv[i] << "\n";
+        return EXIT_FAILURE;
+      }
     } else {
-      printf("INFO: Using the %s file for input\n", argv[i]);
+      cout << "INFO: Using the " << argv[i] << " file for input\n";
       yyin = fopen(argv[i], "r");
+      inputFile = argv[i];
     }
   }
 
+  if (checkpointEvery != 0 && !checkpointFile) {
+    cout << "ERROR: --checkpoint-every needs --checkpoint\n";
+    return EXIT_FAILURE;
+  }
+
+  if (interactiveMode) {
+    if (!yyin)
+      yyin = stdin;
+    repl();
+    if (printSymbolTable)
+      print_symbol_table();
+    return EXIT_SUCCESS;
+  }
+
   if (!yyin) {
-    printf("ERROR: input file not found\n");
+    cout << "ERROR: input file not found\n";
     return EXIT_FAILURE;
   }
 
   yyout = stdout;
 
+  lexTiming = timingReport != 0;
+  countStatements = timingReport != 0;
+  if (perfCounters && perf_open())
+    lexPhaseHook = lex_perf_phase;
+  perf_phase_begin(perfParse);
+  PhaseClock parseClock;
   nextToken = yylex();
 
   ProgramNode *root = nullptr;
+  unsigned long long pgoHash = 0;
 
   try {
     root = program();
 
     if (nextToken != TOK_EOF)
       throw "EOF expected";
+    if (pgoRecordFile || pgoUseFile) {
+      // Statements are numbered as parsed, before the optimizer runs.
+      pgo_number(root);
+      pgoHash = checkpoint_hash_file(inputFile);
+    }
+    std::string pgoReason;
+    if (pgoUseFile && !pgo_load(pgoUseFile, pgoHash, pgoReason))
+      cerr << "INFO: --pgo-use: " << pgoReason << ", ignoring it" << endl;
+    // Checkpoints record statements and frames as they were parsed.
+    if (optimizeProgram && !checkpointFile && !resumeFile)
+      optimize_program(root, printSymbolTable);
+    analyze_ranges(root);
 
   } catch (char const *errmsg) {
     cout << endl << "***ERROR:" << endl;
@@ -64,6 +230,16 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  timing.parse = parseClock.stop();
+  perf_phase_end(perfParse);
+  lexPhaseHook = nullptr;
+  timing.parse.wall -= lexSeconds;
+  timing.parse.cpu -= lexCpuSeconds;
+  timing.lex.wall = lexSeconds;
+  timing.lex.cpu = lexCpuSeconds;
+  timing.tokens = lexTokens;
+  timing.nodes = nodesCreated;
+
   cout << endl << "=== parse successful ===" << endl;
 
   if (printTree) {
@@ -73,13 +249,126 @@ int main(int argc, char *argv[]) {
       cout << *root << endl;
   }
 
-  cout << root->interpret() << "\n";
+  if (reportParallel) {
+    cout << endl << "*** Parallel Loops ***" << endl;
+    for (auto it = parallelReport.begin(); it != parallelReport.end(); ++it)
+      cout << *it << endl;
+  }
+
+  if (reportOptimizations) {
+    cout << endl << "*** Optimizations ***" << endl;
+    for (auto it = optimizerReport.begin(); it != optimizerReport.end(); ++it)
+      cout << *it << endl;
+    cout << optimizerReport.size() << " changes" << endl;
+  }
+
+  if (reportRanges)
+    print_ranges(cout);
+
+  IrProgram irProgram;
+  if (useIr || reportIr)
+    lower_program(root, irProgram);
+  if (reportIr)
+    print_ir(irProgram, cout);
+
+  if (emitC) {
+    // prog.pas is translated to prog.c.
+    std::string cFile = inputFile;
+    size_t suffix = cFile.rfind(".pas");
+    if (suffix != std::string::npos && suffix + 4 == cFile.size())
+      cFile.erase(suffix);
+    cFile += ".c";
+    std::string reason;
+    std::ofstream c(cFile.c_str());
+    if (!emit_c(root, inputFile, c, reason)) {
+      cout << "ERROR: cannot translate to C: " << reason << endl;
+      return EXIT_FAILURE;
+    }
+    if (!c) {
+      cout << "ERROR: cannot write " << cFile << endl;
+      return EXIT_FAILURE;
+    }
+    cout << "INFO: Wrote " << cFile << endl;
+    return EXIT_SUCCESS;
+  }
+
+  if (checkpointFile || resumeFile) {
+    unsigned long long sourceHash = checkpoint_hash_file(inputFile);
+    if (resumeFile && !checkpoint_resume(resumeFile, sourceHash))
+      return EXIT_FAILURE;
+    if (checkpointFile)
+      checkpoint_init(checkpointFile, checkpointEvery, sourceHash);
+  }
+
+  if (profileStatements) {
+    // The profile counters are not shared between threads.
+    pool_set_size(1);
+    profile_program(root);
+  }
+  if (pgoRecordFile) {
+    // As with -P, the counters are not shared between threads.
+    pool_set_size(1);
+    pgo_record(root);
+  }
+
+  bool failed = false;
+  bool ranIr = false;
+  PhaseClock executeClock;
+  perf_phase_begin(perfExecute);
+  try {
+    // Checkpoints and the profilers work on the tree, so they interpret it.
+    float result = 0.0;
+    bool onTree =
+        checkpointFile || resumeFile || profileStatements || pgoRecordFile;
+    std::string jitReason;
+    bool compiled = useJit && !onTree && jit_run(root, result, jitReason);
+    if (useJit && !compiled && !jitReason.empty())
+      cerr << "INFO: --jit: " << jitReason << ", interpreting" << endl;
+    ranIr = !compiled && useIr && !onTree;
+    if (ranIr)
+      result = run_ir(irProgram);
+    else if (!compiled && useClosures && !onTree)
+      result = run_closures(root);
+    else if (!compiled)
+      result = root->interpret();
+    cout << result << "\n";
+  } catch (char const *errmsg) {
+    cout << endl << "***ERROR:" << endl;
+    cout << errmsg << endl;
+    failed = true;
+  }
+  perf_phase_end(perfExecute);
+  timing.execute = executeClock.stop();
+  timing.statements = statementsExecuted;
+
+  if (profileStatements) {
+    profile_report(cout);
+    if (foldedFile) {
+      std::ofstream folded(foldedFile);
+      profile_write_folded(folded);
+      if (!folded)
+        cout << "ERROR: cannot write " << foldedFile << endl;
+    }
+  }
+  if (reportQuickening)
+    print_quickening(cout);
+  if (reportIr && ranIr)
+    cout << irInstructionsExecuted << " IR instructions executed" << endl;
+  if (pgoRecordFile && !pgo_save(pgoRecordFile, pgoHash))
+    cout << "ERROR: cannot write " << pgoRecordFile << endl;
+  if (!failed && printSymbolTable)
+    print_symbol_table();
 
-  if (printSymbolTable) {
-    cout << endl << endl << "*** User Defined Symbols ***" << endl;
-    for (auto it = symbolTable.begin(); it != symbolTable.end(); ++it)
-      cout << (*it).first << ": " << std::to_string((*it).second) << std::endl;
+  if (timingReport) {
+    PhaseClock outputClock;
+    output_flush();
+    timing.output = outputClock.stop();
+    output_statistics(timing.output_bytes, timing.write_seconds);
+    timing.total = totalClock.stop();
+    print_timing(cerr, timing, timingReport == 2);
   }
+  if (perfCounters)
+    perf_report(cerr);
 
-  return EXIT_SUCCESS;
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,544 @@
+#include "emit_c.h"
+#include "lexer.h"
+#include "parser.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+// Runtime of the generated program. The helpers repeat the interpreter's
+// arithmetic: compare_values, the truth tests of AND, OR, NOT and IF, array
+// indexing, FOR trip counts, and READ as input_read_value reads.
+static const char *cRuntime = R"(#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __GNUC__
+#pragma GCC optimize("fp-contract=off")
+#define RUNTIME static __attribute__((unused))
+#else
+#define RUNTIME static
+#endif
+
+/* Hides a value from the optimizer, which would otherwise rewrite, for
+   example, -(a * b) as (-a) * b and so change the sign of a NaN result.
+   OPERATE(instruction, operator, a, b) sets a to a operator b with a as the
+   destination of the instruction, whose NaN is kept when both are NaN, as
+   in the interpreter; the optimizer may swap the operands of + and *. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BARRIER(x) __asm__("" : "+x"(x))
+#define OPERATE(instruction, operator, a, b)                                 \
+  __asm__(instruction " %1, %0" : "+x"(a) : "x"(b))
+#else
+#define BARRIER(x)
+#define OPERATE(instruction, operator, a, b) ((a) = (a) operator (b))
+#endif
+
+#define EPSILON 0.001
+
+RUNTIME void fail(const char *message) {
+  printf("\n***ERROR:\n%s\n", message);
+  exit(EXIT_FAILURE);
+}
+
+RUNTIME float add(float a, float b) {
+  OPERATE("addss", +, a, b);
+  return a;
+}
+RUNTIME float subtract(float a, float b) {
+  OPERATE("subss", -, a, b);
+  return a;
+}
+RUNTIME float multiply(float a, float b) {
+  OPERATE("mulss", *, a, b);
+  return a;
+}
+RUNTIME float divide(float a, float b) {
+  OPERATE("divss", /, a, b);
+  return a;
+}
+RUNTIME float negate(float x) {
+  BARRIER(x);
+  return -x;
+}
+
+RUNTIME int truth(float x) { return x >= EPSILON; }
+RUNTIME int if_true(float x) { return x > EPSILON; }
+RUNTIME float less(float a, float b) { return a - b < 0.0 ? 1.0f : 0.0f; }
+RUNTIME float greater(float a, float b) {
+  return a - b >= EPSILON ? 1.0f : 0.0f;
+}
+RUNTIME float equal(float a, float b) {
+  return fabsf(a - b) <= EPSILON ? 1.0f : 0.0f;
+}
+RUNTIME float not_equal(float a, float b) {
+  return fabsf(a - b) > EPSILON ? 1.0f : 0.0f;
+}
+
+RUNTIME float bits_float(unsigned bits) {
+  float value;
+  memcpy(&value, &bits, sizeof value);
+  return value;
+}
+
+RUNTIME float *element(float *elements, long low, long size, float index) {
+  long offset = lrintf(index) - low;
+  if ((unsigned long)offset >= (unsigned long)size)
+    fail("Array access failed: index out of bounds");
+  return elements + offset;
+}
+
+RUNTIME long trip_count(float first, float last, int is_downto) {
+  double span = is_downto ? (double)first - last : (double)last - first;
+  if (!(span >= 0.0))
+    return 0;
+  if (span >= 9.2e18)
+    return LONG_MAX;
+  return (long)floor(span) + 1;
+}
+
+RUNTIME void write_number(float value) { printf("%.6g\n", value); }
+
+RUNTIME void write_text(const char *text) {
+  fputs(text, stdout);
+  putchar('\n');
+}
+
+RUNTIME int is_space(int c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+static unsigned long inputLine = 1, inputColumn = 1;
+
+RUNTIME float read_value(void) {
+  static char *token;
+  static size_t capacity;
+  size_t length = 0;
+  char message[128];
+  char *end;
+  float value;
+  int c;
+
+  if (isatty(STDIN_FILENO))
+    fflush(stdout);
+  while ((c = getchar()) != EOF && is_space(c)) {
+    if (c == '\n') {
+      inputLine++;
+      inputColumn = 1;
+    } else {
+      inputColumn++;
+    }
+  }
+  if (c == EOF) {
+    snprintf(message, sizeof message, "Read failed: input ended at line %lu",
+             inputLine);
+    fail(message);
+  }
+  do {
+    if (length + 1 >= capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      token = realloc(token, capacity);
+      if (!token)
+        fail("Read failed: out of memory");
+    }
+    token[length++] = (char)c;
+  } while ((c = getchar()) != EOF && !is_space(c));
+  if (c != EOF)
+    ungetc(c, stdin);
+  token[length] = 0;
+
+  errno = 0;
+  value = strtof(token, &end);
+  if (end == token || errno == ERANGE) {
+    snprintf(message, sizeof message,
+             "Read failed: '%.20s' at input line %lu, column %lu %s", token,
+             inputLine, inputColumn,
+             end == token ? "is not a number" : "is out of range");
+    fail(message);
+  }
+  inputColumn += length;
+  return value;
+}
+)";
+
+// C string literal for text.
+static std::string c_string(const std::string &text) {
+  std::string quoted = "\"";
+  for (size_t i = 0; i < text.size(); i++) {
+    unsigned char c = text[i];
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c < ' ' || c > '~') {
+      char escape[8];
+      snprintf(escape, sizeof escape, "\\%03o", c);
+      quoted += escape;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+// C expression for a float, using the fewest digits that read back as the
+// same value.
+static std::string c_float(float value) {
+  char text[40];
+  if (!std::isfinite(value)) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    snprintf(text, sizeof text, "bits_float(0x%08xu)", bits);
+    return text;
+  }
+  for (int digits = 6; digits <= 9; digits++) {
+    snprintf(text, sizeof text, "%.*g", digits, value);
+    if (strtof(text, nullptr) == value)
+      break;
+  }
+  std::string literal = text;
+  if (literal.find_first_of(".e") == std::string::npos)
+    literal += ".0";
+  literal += "f";
+  return std::signbit(value) ? "(" + literal + ")" : literal;
+}
+
+struct CEmitter {
+  std::ostringstream *out = nullptr;
+  int depth = 1;
+  std::string reason;
+  std::vector<ProcedureNode *> procedures; // called, to be emitted
+  std::set<ProcedureNode *> seen;
+  bool uses_frames = false; // S, fp and top are needed
+
+  void unsupported(const std::string &why) {
+    if (reason.empty())
+      reason = why;
+  }
+
+  void line(const std::string &text) {
+    *out << std::string(depth * 2, ' ') << text << "\n";
+  }
+
+  std::string variable(int frame_slot, const std::string &name) {
+    if (frame_slot >= 0) {
+      uses_frames = true;
+      return "S[fp + " + std::to_string(frame_slot) + "]";
+    }
+    if (symbolTable.find(name) == symbolTable.end())
+      unsupported("variable " + name + " is not declared");
+    return "v_" + name;
+  }
+
+  std::string element(ArrayVariable *array, ExpressionNode *index) {
+    return "element(a_" + array->name + ", " + std::to_string(array->low) +
+           "L, " + std::to_string(array->size) + "L, " + expression(index) +
+           ")";
+  }
+
+  // Factors are emitted so that they can be used as operands as they are.
+  std::string factor(FactorNode *node) {
+    if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(node))
+      return variable(id->frame_slot, id->identifier);
+    if (FloatFactorNode *literal = dynamic_cast<FloatFactorNode *>(node))
+      return c_float(literal->float_literal);
+    if (ConstantFactorNode *named = dynamic_cast<ConstantFactorNode *>(node))
+      return c_float(named->constant_value);
+    if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(node)) {
+      try {
+        return c_float(std::stof(literal->int_literal));
+      } catch (std::exception &) {
+        unsupported("integer " + literal->int_literal + " out of range");
+        return "0.0f";
+      }
+    }
+    if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(node))
+      return "negate(" + factor(minus->child_factor) + ")";
+    if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(node)) {
+      std::string operand = factor(negation->child_factor);
+      if (negation->integer_operand)
+        return "(" + operand + " > 0.0f ? 0.0f : 1.0f)";
+      return "(truth(" + operand + ") ? 0.0f : 1.0f)";
+    }
+    if (ExpressionFactorNode *nested =
+            dynamic_cast<ExpressionFactorNode *>(node))
+      return "(" + expression(nested->child_expression) + ")";
+    if (ArrayFactorNode *array = dynamic_cast<ArrayFactorNode *>(node))
+      return "*" + element(array->array, array->index_expression);
+    unsupported("unknown factor");
+    return "0.0f";
+  }
+
+  // Operations are grouped from the left as the interpreter evaluates them;
+  // AND and OR short-circuit as it does.
+  std::string term(TermNode *node) {
+    std::string text = factor(node->first_factor);
+    for (size_t i = 0; i < node->following_operators.size(); i++) {
+      std::string next = factor(node->following_factors[i]);
+      switch (node->following_operators[i]) {
+      case TOK_MULTIPLY:
+        text = "multiply(" + text + ", " + next + ")";
+        break;
+      case TOK_DIVIDE:
+        text = "divide(" + text + ", " + next + ")";
+        break;
+      case TOK_AND:
+        text = "(truth(" + text + ") && truth(" + next + ") ? 1.0f : 0.0f)";
+        break;
+      default:
+        break;
+      }
+    }
+    return text;
+  }
+
+  std::string simple(SimpleExpressionNode *node) {
+    std::string text = term(node->first_term);
+    for (size_t i = 0; i < node->following_operators.size(); i++) {
+      std::string next = term(node->following_terms[i]);
+      switch (node->following_operators[i]) {
+      case TOK_PLUS:
+        text = "add(" + text + ", " + next + ")";
+        break;
+      case TOK_MINUS:
+        text = "subtract(" + text + ", " + next + ")";
+        break;
+      case TOK_OR:
+        text = "(truth(" + text + ") || truth(" + next + ") ? 1.0f : 0.0f)";
+        break;
+      default:
+        break;
+      }
+    }
+    return text;
+  }
+
+  // Operands range analysis has shown to be whole numbers.
+  std::string integer_comparison(int relational_operator,
+                                 const std::string &first,
+                                 const std::string &second) {
+    const char *op = " != ";
+    if (relational_operator == TOK_LESSTHAN)
+      op = " < ";
+    else if (relational_operator == TOK_GREATERTHAN)
+      op = " > ";
+    else if (relational_operator == TOK_EQUALTO)
+      op = " == ";
+    return "(" + first + op + second + " ? 1.0f : 0.0f)";
+  }
+
+  std::string expression(ExpressionNode *node) {
+    std::string first = simple(node->first_simple_exp);
+    if (node->simple_exp_operator == TOK_UNKNOWN)
+      return first;
+    std::string second = simple(node->second_simple_exp);
+    if (node->exact_compare)
+      return integer_comparison(node->simple_exp_operator, first, second);
+    switch (node->simple_exp_operator) {
+    case TOK_LESSTHAN:
+      return "less(" + first + ", " + second + ")";
+    case TOK_GREATERTHAN:
+      return "greater(" + first + ", " + second + ")";
+    case TOK_EQUALTO:
+      return "equal(" + first + ", " + second + ")";
+    case TOK_NOTEQUALTO:
+      return "not_equal(" + first + ", " + second + ")";
+    default:
+      unsupported("unknown relational operator");
+      return first;
+    }
+  }
+
+  // Every statement leaves its value in r, as interpret() returns it.
+  void statement(StatementNode *node) {
+    if (CompoundStatementNode *compound =
+            dynamic_cast<CompoundStatementNode *>(node)) {
+      // COBEGIN statements share no variables, so they run in order.
+      if (compound->statement_vector.empty())
+        line("r = 0.0f;");
+      for (auto it = compound->statement_vector.begin();
+           it != compound->statement_vector.end(); ++it)
+        statement(*it);
+    } else if (AssignmentStatementNode *assignment =
+                   dynamic_cast<AssignmentStatementNode *>(node)) {
+      line("r = " +
+           variable(assignment->frame_slot, assignment->identifier) + " = " +
+           expression(assignment->assignment_expr) + ";");
+    } else if (ArrayAssignmentStatementNode *assignment =
+                   dynamic_cast<ArrayAssignmentStatementNode *>(node)) {
+      // The index is checked before the value is evaluated.
+      line("{");
+      depth++;
+      line("float *e = " +
+           element(assignment->array, assignment->index_expression) + ";");
+      line("r = *e = " + expression(assignment->assignment_expr) + ";");
+      depth--;
+      line("}");
+    } else if (WriteStatementNode *write =
+                   dynamic_cast<WriteStatementNode *>(node)) {
+      if (write->element)
+        line("write_number(" + factor(write->element) + ");");
+      else if (write->frame_slot >= 0 || write->is_identifier)
+        line("write_number(" +
+             variable(write->frame_slot, write->write_text) + ");");
+      else
+        line("write_text(" + c_string(write->write_text) + ");");
+      line("r = 0.0f;");
+    } else if (ReadStatementNode *read =
+                   dynamic_cast<ReadStatementNode *>(node)) {
+      line("r = " + variable(read->frame_slot, read->read_text) +
+           " = read_value();");
+    } else if (IfStatementNode *branch =
+                   dynamic_cast<IfStatementNode *>(node)) {
+      std::string condition = expression(branch->if_expression);
+      if (branch->integer_condition)
+        line("if (" + condition + " > 0.0f) {");
+      else
+        line("if (if_true(" + condition + ")) {");
+      body(branch->then_statement);
+      line("} else {");
+      if (branch->has_else)
+        body(branch->else_statement);
+      else
+        body("r = 0.0f;");
+      line("}");
+    } else if (WhileStatementNode *loop =
+                   dynamic_cast<WhileStatementNode *>(node)) {
+      line("r = 0.0f;");
+      line("while (" + expression(loop->while_expression) + " == 1.0f) {");
+      body(loop->while_statement);
+      line("}");
+    } else if (ForStatementNode *loop =
+                   dynamic_cast<ForStatementNode *>(node)) {
+      for_statement(loop);
+    } else if (LoopExitStatementNode *exit =
+                   dynamic_cast<LoopExitStatementNode *>(node)) {
+      line("r = 0.0f;");
+      line(exit->exit_token == TOK_BREAK ? "break;" : "continue;");
+    } else if (CallStatementNode *call =
+                   dynamic_cast<CallStatementNode *>(node)) {
+      call_statement(call);
+    } else {
+      unsupported("unknown statement");
+    }
+  }
+
+  void body(StatementNode *node) {
+    depth++;
+    statement(node);
+    depth--;
+  }
+
+  void body(const std::string &text) {
+    depth++;
+    line(text);
+    depth--;
+  }
+
+  // The running value is kept apart from the counter, which the body may
+  // change; CONTINUE goes on to the next value.
+  void for_statement(ForStatementNode *loop) {
+    line("{");
+    depth++;
+    line("float value = " + expression(loop->start_expression) + ";");
+    line("long trips = trip_count(value, " +
+         expression(loop->end_expression) + ", " +
+         std::to_string(loop->is_downto) + ");");
+    line("r = 0.0f;");
+    line(std::string("for (; trips > 0; trips--, value += ") +
+         (loop->is_downto ? "-1.0f" : "1.0f") + ") {");
+    body(variable(loop->frame_slot, loop->identifier) + " = value;");
+    body(loop->for_statement);
+    line("}");
+    depth--;
+    line("}");
+  }
+
+  // Mirrors CallStatementNode::interpret: arguments, then zeroed locals, in
+  // a frame at the top of S.
+  void call_statement(CallStatementNode *call) {
+    ProcedureNode *procedure = call->procedure;
+    uses_frames = true;
+    if (seen.insert(procedure).second)
+      procedures.push_back(procedure);
+    line("{");
+    depth++;
+    line("size_t frame = top, frame_end = top + " +
+         std::to_string(procedure->frame_size) + ";");
+    line("if (frame_end > " + std::to_string(stackLimit) + ")");
+    body("fail(\"Procedure call failed: call stack overflow\");");
+    for (size_t i = 0; i < call->arguments.size(); i++)
+      line("S[frame + " + std::to_string(i) +
+           "] = " + expression(call->arguments[i]) + ";");
+    line("memset(&S[frame + " + std::to_string(call->arguments.size()) +
+         "], 0, (frame_end - frame - " +
+         std::to_string(call->arguments.size()) + ") * sizeof(float));");
+    line("size_t caller = fp;");
+    line("fp = frame;");
+    line("top = frame_end;");
+    line("r = p_" + procedure->name + "();");
+    line("fp = caller;");
+    line("top = frame;");
+    depth--;
+    line("}");
+  }
+};
+
+bool emit_c(ProgramNode *root, const char *source, std::ostream &os,
+            std::string &reason) {
+  CEmitter emitter;
+  std::ostringstream main_body, functions;
+
+  emitter.out = &main_body;
+  emitter.statement(root->program_block->compound_stmt);
+  emitter.out = &functions;
+  for (size_t i = 0; i < emitter.procedures.size(); i++) {
+    ProcedureNode *procedure = emitter.procedures[i];
+    functions << "\nstatic float p_" << procedure->name << "(void) {\n"
+              << "  float r = 0.0f;\n";
+    emitter.statement(procedure->body);
+    functions << "  return r;\n}\n";
+  }
+  if (!emitter.reason.empty()) {
+    reason = emitter.reason;
+    return false;
+  }
+
+  os << "/* Generated by tips --emit-c from " << source << ". Build with\n"
+     << "   gcc -O2 -o program program.c -lm */\n"
+     << cRuntime << "\n";
+  if (emitter.uses_frames)
+    os << "static float S[" << callStack.size() << "];\n"
+       << "static size_t fp, top;\n";
+  for (auto it = symbolTable.begin(); it != symbolTable.end(); ++it)
+    os << "static float v_" << it->first << " = " << c_float(it->second)
+       << ";\n";
+  for (auto it = arrayTable.begin(); it != arrayTable.end(); ++it)
+    os << "static float a_" << it->second->name << "[" << it->second->size
+       << "];\n";
+  for (size_t i = 0; i < emitter.procedures.size(); i++)
+    os << "static float p_" << emitter.procedures[i]->name << "(void);\n";
+  os << functions.str();
+
+  std::string banner = std::string("INFO: Using the ") + source +
+                       " file for input\n\n=== parse successful ===\n";
+  os << "\nint main(void) {\n"
+     << "  static char buffer[1 << 16];\n"
+     << "  float r = 0.0f;\n"
+     << "  setvbuf(stdout, buffer, _IOFBF, sizeof buffer);\n"
+     << "  fputs(" << c_string(banner) << ", stdout);\n";
+  if (emitter.uses_frames)
+    os << "  top = " << root->frame_size << ";\n";
+  os << main_body.str() << "  printf(\"%.6g\\n\", r);\n"
+     << "  return EXIT_SUCCESS;\n"
+     << "}\n";
+  return true;
+}
@@ -0,0 +1,17 @@
+#ifndef EMIT_C_H
+#define EMIT_C_H
+
+#include "parse_tree_nodes.h"
+#include <ostream>
+#include <string>
+
+// Translates a parsed program into one C file (--emit-c) that, built with
+// "gcc -O2 -o prog prog.c -lm", prints what "tips source" prints: the
+// banner, the WRITE output, errors, and the final value. Arithmetic is done
+// in float and compared with EPSILON as the interpreter does, and READ takes
+// values from standard input. Returns false, with the reason, for a program
+// that cannot be translated.
+bool emit_c(ProgramNode *root, const char *source, std::ostream &os,
+            std::string &reason);
+
+#endif /* EMIT_C_H */
@@ -0,0 +1,300 @@
+#include "input.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Bytes asked of read() at a time for pipes.
+static const size_t inputBlock = 1 << 20;
+
+static const double exactPowers[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+enum InputMode { notOpened, mappedFile, blockReads, stdioLines };
+
+struct InputSource {
+  InputMode mode = notOpened;
+  int fd = STDIN_FILENO;
+  bool stdin_shared = false;
+  bool at_end = false;
+
+  // The text not yet scanned is [next, end); in the mapped mode it is the
+  // whole file, otherwise the part of buffer read so far.
+  const char *next = nullptr;
+  const char *end = nullptr;
+  std::vector<char> buffer;
+
+  // Position of next in the input, for error messages.
+  unsigned long line = 1;
+  unsigned long column = 1;
+};
+
+static InputSource input;
+static std::string readError;
+
+void (*inputInterruptHook)() = nullptr;
+
+static void input_interrupted() {
+  if (inputInterruptHook)
+    inputInterruptHook();
+}
+
+static bool map_file(int fd) {
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    return false;
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (offset < 0)
+    offset = 0;
+  input.mode = mappedFile;
+  input.at_end = true;
+  if (info.st_size <= offset) {
+    input.next = input.end = nullptr;
+    return true;
+  }
+  void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    input.mode = notOpened;
+    input.at_end = false;
+    return false;
+  }
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+  input.next = (const char *)data + offset;
+  input.end = (const char *)data + info.st_size;
+  return true;
+}
+
+static void open_source() {
+  if (input.mode != notOpened)
+    return;
+  if (input.fd == STDIN_FILENO && (input.stdin_shared || isatty(input.fd)))
+    input.mode = stdioLines;
+  else if (!map_file(input.fd))
+    input.mode = blockReads;
+}
+
+// Reads more text after what is left of the buffer, keeping [keep, end).
+// Returns the new position of keep, or nullptr at the end of the input.
+static const char *refill(const char *keep) {
+  if (input.at_end)
+    return nullptr;
+  size_t kept = input.end - keep;
+  std::vector<char> &buffer = input.buffer;
+  if (kept != 0 && keep != buffer.data())
+    memmove(buffer.data(), keep, kept);
+
+  size_t added = 0;
+  if (input.mode == stdioLines) {
+    int c;
+    if (buffer.size() < kept + 256)
+      buffer.resize(kept + 256);
+    for (;;) {
+      c = getc(stdin);
+      if (c == EOF && ferror(stdin) && errno == EINTR) {
+        clearerr(stdin);
+        input_interrupted();
+        continue;
+      }
+      if (c == EOF)
+        break;
+      if (kept + added == buffer.size())
+        buffer.resize(buffer.size() * 2);
+      buffer[kept + added++] = (char)c;
+      if (c == '\n')
+        break;
+    }
+  } else {
+    if (buffer.size() < kept + inputBlock)
+      buffer.resize(kept + inputBlock);
+    ssize_t count;
+    for (;;) {
+      count = read(input.fd, buffer.data() + kept, buffer.size() - kept);
+      if (count >= 0 || errno != EINTR)
+        break;
+      input_interrupted();
+    }
+    added = count > 0 ? count : 0;
+  }
+  if (added == 0)
+    input.at_end = true;
+  input.next = buffer.data();
+  input.end = buffer.data() + kept + added;
+  return added == 0 ? nullptr : buffer.data();
+}
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+// Finds the next white-space separated value, as cin >> std::string would.
+static bool next_token(const char *&begin, const char *&finish) {
+  open_source();
+  for (;;) {
+    while (input.next != input.end && is_space(*input.next)) {
+      if (*input.next == '\n') {
+        input.line++;
+        input.column = 1;
+      } else {
+        input.column++;
+      }
+      input.next++;
+    }
+    if (input.next != input.end)
+      break;
+    if (!refill(input.end))
+      return false;
+  }
+
+  const char *scan = input.next;
+  for (;;) {
+    while (scan != input.end && !is_space(*scan))
+      scan++;
+    if (scan != input.end || input.at_end)
+      break;
+    size_t length = scan - input.next;
+    if (!refill(input.next)) {
+      scan = input.end;
+      break;
+    }
+    scan = input.next + length;
+  }
+  begin = input.next;
+  finish = scan;
+  return true;
+}
+
+static const char *position_error(const char *what, const char *begin,
+                                  const char *finish) {
+  std::string value(begin, finish - begin > 20 ? begin + 20 : finish);
+  readError = "Read failed: '" + value + "' at input line " +
+              std::to_string(input.line) + ", column " +
+              std::to_string(input.column) + " " + what;
+  return readError.c_str();
+}
+
+// Digits with an optional sign, point and exponent, taking the whole
+// token. The decimal value has at most 15 digits and a power of ten that
+// doubles hold exactly, so the quotient or product is the correctly rounded
+// double; rounding that to float gives strtof's result unless it lies
+// exactly halfway between two floats.
+static bool parse_simple(const char *scan, const char *finish, float &value) {
+  bool negative = false;
+  if (scan != finish && (*scan == '-' || *scan == '+'))
+    negative = *scan++ == '-';
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool any_digit = false;
+  for (; scan != finish && *scan >= '0' && *scan <= '9'; scan++) {
+    any_digit = true;
+    if (mantissa == 0 && *scan == '0')
+      continue;
+    if (++digits > 15)
+      return false;
+    mantissa = mantissa * 10 + (*scan - '0');
+  }
+  if (scan != finish && *scan == '.') {
+    for (scan++; scan != finish && *scan >= '0' && *scan <= '9'; scan++) {
+      any_digit = true;
+      exponent--;
+      if (mantissa == 0 && *scan == '0')
+        continue;
+      if (++digits > 15)
+        return false;
+      mantissa = mantissa * 10 + (*scan - '0');
+    }
+  }
+  if (!any_digit)
+    return false;
+  if (scan != finish && (*scan == 'e' || *scan == 'E')) {
+    scan++;
+    bool negative_exponent = false;
+    if (scan != finish && (*scan == '-' || *scan == '+'))
+      negative_exponent = *scan++ == '-';
+    if (scan == finish)
+      return false;
+    int written = 0;
+    for (; scan != finish && *scan >= '0' && *scan <= '9'; scan++) {
+      written = written * 10 + (*scan - '0');
+      if (written > 1000)
+        return false;
+    }
+    exponent += negative_exponent ? -written : written;
+  }
+  if (scan != finish || exponent < -22 || exponent > 22)
+    return false;
+
+  double result = (double)mantissa;
+  if (exponent >= 0)
+    result *= exactPowers[exponent];
+  else
+    result /= exactPowers[-exponent];
+  uint64_t bits;
+  memcpy(&bits, &result, sizeof bits);
+  if ((bits & 0x1fffffff) == 0x10000000)
+    return false;
+  value = negative ? -(float)result : (float)result;
+  return true;
+}
+
+float input_read_value() {
+  const char *begin, *finish;
+  if (!next_token(begin, finish)) {
+    readError = "Read failed: input ended at line " +
+                std::to_string(input.line);
+    throw(readError.c_str());
+  }
+  unsigned long width = finish - begin;
+
+  float value;
+  if (!parse_simple(begin, finish, value)) {
+    std::string text(begin, finish);
+    char *parsed_end;
+    errno = 0;
+    value = strtof(text.c_str(), &parsed_end);
+    const char *error = nullptr;
+    if (parsed_end == text.c_str())
+      error = position_error("is not a number", begin, finish);
+    else if (errno == ERANGE)
+      error = position_error("is out of range", begin, finish);
+    if (error) {
+      input.next = finish;
+      input.column += width;
+      throw(error);
+    }
+  }
+  input.next = finish;
+  input.column += width;
+  return value;
+}
+
+bool input_skip(unsigned long count) {
+  const char *begin, *finish;
+  for (unsigned long i = 0; i < count; i++) {
+    if (!next_token(begin, finish))
+      return false;
+    input.column += finish - begin;
+    input.next = finish;
+  }
+  return true;
+}
+
+bool input_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  input.fd = fd;
+  if (!map_file(fd))
+    input.mode = blockReads;
+  return true;
+}
+
+void input_share_stdin() { input.stdin_shared = true; }
@@ -0,0 +1,27 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+// Values for READ. By default they come from standard input; a file given
+// with --input, or standard input redirected from a file, is mapped into
+// memory, a pipe is read in large blocks, and a terminal a line at a time.
+// Values are separated by white space and parsed where they lie.
+
+// Reads values from path instead of standard input. False if it cannot be
+// opened.
+bool input_open(const char *path);
+// Standard input also holds the program (the REPL reading from stdin), so
+// values are taken through stdio a line at a time, after the lexer's lines.
+void input_share_stdin();
+
+// The next value, parsed as std::stof would. Throws an error naming the
+// position of the value when it is not a number or there is none left.
+float input_read_value();
+// Skips count values; false if the input ends first.
+bool input_skip(unsigned long count);
+
+// Called, when set, each time a signal interrupts the wait for more input,
+// before waiting again. Checkpointing uses it to act on SIGINT and SIGTERM
+// while a READ is blocked.
+extern void (*inputInterruptHook)();
+
+#endif /* INPUT_H */
@@ -0,0 +1,888 @@
+#define EPSILON 0.001
+
+#include "ir.h"
+#include "checkpoint.h"
+#include "input.h"
+#include "number_format.h"
+#include "output.h"
+#include "parser.h"
+#include <algorithm>
+#include <map>
+
+unsigned long irInstructionsExecuted = 0;
+
+// Lowering
+
+// Where BREAK and CONTINUE go in the innermost loop, and whether its value
+// is the value of the function.
+struct IrLoop {
+  int next;
+  int exit;
+  bool keeps_value;
+};
+
+struct IrBuilder {
+  IrProgram *program = nullptr;
+  int function = 0;
+  int block = 0;
+  std::vector<IrLoop> loops;
+  std::map<ProcedureNode *, int> callees;
+
+  // Blocks and functions are only reached by index while lowering, since
+  // adding one may move the others.
+  IrFunction &current() { return program->functions[function]; }
+  IrBlock &open() { return current().blocks[block]; }
+
+  int new_block() {
+    current().blocks.push_back(IrBlock());
+    return current().blocks.size() - 1;
+  }
+
+  IrValue temp() {
+    IrValue value;
+    value.kind = irTemp;
+    value.index = current().temps++;
+    return value;
+  }
+
+  IrValue result() {
+    IrValue value;
+    value.kind = irTemp;
+    value.index = irResult;
+    return value;
+  }
+
+  IrValue constant(float number) {
+    IrValue value;
+    value.kind = irConstant;
+    value.constant = number;
+    return value;
+  }
+
+  IrInstruction &emit(int op) {
+    open().code.push_back(IrInstruction());
+    open().code.back().op = op;
+    return open().code.back();
+  }
+
+  void fail(const char *message) { emit(irFail).text = message; }
+
+  // Ends the open block; the code that follows goes in next.
+  void jump(int target, int next) {
+    open().end.op = irJump;
+    open().end.target = target;
+    block = next;
+  }
+
+  void branch(int test, const IrValue &condition, int target, int other) {
+    open().end.op = irBranch;
+    open().end.test = test;
+    open().end.first = condition;
+    open().end.target = target;
+    open().end.other = other;
+  }
+
+  IrValue variable(const std::string &name, int frame_slot,
+                   const char *missing) {
+    IrValue value;
+    if (frame_slot >= 0) {
+      value.kind = irSlot;
+      value.index = frame_slot;
+      ProcedureNode *procedure = current().procedure;
+      if (procedure && (size_t)frame_slot < procedure->local_names.size())
+        value.name = &procedure->local_names[frame_slot];
+      return value;
+    }
+    auto var = symbolTable.find(name);
+    if (var == symbolTable.end()) {
+      fail(missing);
+      return constant(0.0);
+    }
+    value.kind = irGlobal;
+    value.storage = &var->second;
+    value.name = &var->first;
+    return value;
+  }
+
+  // dest = value, made by the instruction that computed value when that was
+  // the last one, so that X := A + B is one instruction.
+  void assign(const IrValue &dest, const IrValue &value) {
+    std::vector<IrInstruction> &code = open().code;
+    if (value.kind == irTemp && value.index != irResult && !code.empty() &&
+        code.back().dest.kind == irTemp &&
+        code.back().dest.index == value.index) {
+      code.back().dest = dest;
+      return;
+    }
+    IrInstruction &copy = emit(irCopy);
+    copy.dest = dest;
+    copy.first = value;
+  }
+
+  IrValue operation(int op, const IrValue &first, const IrValue &second) {
+    IrInstruction &instruction = emit(op);
+    instruction.first = first;
+    instruction.second = second;
+    return instruction.dest = temp();
+  }
+
+  IrValue factor(FactorNode *node) {
+    if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(node))
+      return variable(id->identifier, id->frame_slot,
+                      "Id Factor Node failed: var undefined");
+    if (FloatFactorNode *literal = dynamic_cast<FloatFactorNode *>(node))
+      return constant(literal->float_literal);
+    if (ConstantFactorNode *named = dynamic_cast<ConstantFactorNode *>(node))
+      return constant(named->constant_value);
+    if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(node)) {
+      try {
+        return constant(std::stof(literal->int_literal));
+      } catch (std::exception &) {
+        fail("Integer literal out of range");
+        return constant(0.0);
+      }
+    }
+    if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(node))
+      return operation(irNegate, factor(minus->child_factor), IrValue());
+    if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(node)) {
+      IrValue value =
+          operation(irNot, factor(negation->child_factor), IrValue());
+      open().code.back().exact = negation->integer_operand;
+      return value;
+    }
+    if (ExpressionFactorNode *nested =
+            dynamic_cast<ExpressionFactorNode *>(node))
+      return expression(nested->child_expression);
+    if (ArrayFactorNode *element = dynamic_cast<ArrayFactorNode *>(node)) {
+      IrValue value =
+          operation(irLoad, expression(element->index_expression), IrValue());
+      open().code.back().array = element->array;
+      return value;
+    }
+    fail("unknown factor");
+    return constant(0.0);
+  }
+
+  // AND and OR: the second operand is lowered into the block left open,
+  // reached only when the first does not decide. finish_logical() then
+  // joins the two ways into dest.
+  void begin_logical(bool is_and, const IrValue &first, const IrValue &dest,
+                    int &join) {
+    int second = new_block();
+    int decided = new_block();
+    join = new_block();
+    if (is_and)
+      branch(irTestTruth, first, second, decided);
+    else
+      branch(irTestTruth, first, decided, second);
+    block = decided;
+    assign(dest, constant(is_and ? 0.0 : 1.0));
+    jump(join, second);
+  }
+
+  void finish_logical(const IrValue &second, const IrValue &dest, int join) {
+    IrInstruction &truth = emit(irTruth);
+    truth.dest = dest;
+    truth.first = second;
+    jump(join, join);
+  }
+
+  // Operations are grouped from the left as the interpreter evaluates them.
+  IrValue term(TermNode *node) {
+    IrValue value = factor(node->first_factor);
+    for (size_t i = 0; i < node->following_operators.size(); i++) {
+      FactorNode *next = node->following_factors[i];
+      switch (node->following_operators[i]) {
+      case TOK_MULTIPLY:
+        value = operation(irMultiply, value, factor(next));
+        break;
+      case TOK_DIVIDE:
+        value = operation(irDivide, value, factor(next));
+        break;
+      case TOK_AND: {
+        IrValue dest = temp();
+        int join = -1;
+        begin_logical(true, value, dest, join);
+        finish_logical(factor(next), dest, join);
+        value = dest;
+        break;
+      }
+      default:
+        break;
+      }
+    }
+    return value;
+  }
+
+  IrValue simple(SimpleExpressionNode *node) {
+    IrValue value = term(node->first_term);
+    for (size_t i = 0; i < node->following_operators.size(); i++) {
+      TermNode *next = node->following_terms[i];
+      switch (node->following_operators[i]) {
+      case TOK_PLUS:
+        value = operation(irAdd, value, term(next));
+        break;
+      case TOK_MINUS:
+        value = operation(irSubtract, value, term(next));
+        break;
+      case TOK_OR: {
+        IrValue dest = temp();
+        int join = -1;
+        begin_logical(false, value, dest, join);
+        finish_logical(term(next), dest, join);
+        value = dest;
+        break;
+      }
+      default:
+        break;
+      }
+    }
+    return value;
+  }
+
+  IrValue expression(ExpressionNode *node) {
+    IrValue first = simple(node->first_simple_exp);
+    if (node->simple_exp_operator == TOK_UNKNOWN)
+      return first;
+    IrValue value =
+        operation(irCompare, first, simple(node->second_simple_exp));
+    open().code.back().relation = node->simple_exp_operator;
+    open().code.back().exact = node->exact_compare;
+    return value;
+  }
+
+  // Statements leave their value in the result temp when keeps_value is
+  // set, that is when it can be the value of the function; BREAK and
+  // CONTINUE set it for their loop.
+  void statement(StatementNode *node, bool keeps_value) {
+    open().statements++;
+    if (CompoundStatementNode *compound =
+            dynamic_cast<CompoundStatementNode *>(node)) {
+      // COBEGIN statements share no variables, so they run in order.
+      std::vector<StatementNode *> &statements = compound->statement_vector;
+      if (statements.empty() && keeps_value)
+        assign(result(), constant(0.0));
+      for (size_t i = 0; i < statements.size(); i++)
+        statement(statements[i], keeps_value && i + 1 == statements.size());
+    } else if (AssignmentStatementNode *assignment =
+                   dynamic_cast<AssignmentStatementNode *>(node)) {
+      IrValue dest =
+          variable(assignment->identifier, assignment->frame_slot,
+                   "Variable assignment failed: Variable not found");
+      assign(dest, expression(assignment->assignment_expr));
+      if (keeps_value)
+        assign(result(), dest);
+    } else if (ArrayAssignmentStatementNode *assignment =
+                   dynamic_cast<ArrayAssignmentStatementNode *>(node)) {
+      IrValue index = expression(assignment->index_expression);
+      IrValue value = expression(assignment->assignment_expr);
+      IrInstruction &store = emit(irStore);
+      store.array = assignment->array;
+      store.first = index;
+      store.second = value;
+      if (keeps_value)
+        assign(result(), value);
+    } else if (WriteStatementNode *write =
+                   dynamic_cast<WriteStatementNode *>(node)) {
+      IrValue value;
+      if (write->element)
+        value = factor(write->element);
+      else if (write->frame_slot >= 0 || write->is_identifier)
+        value = variable(write->write_text, write->frame_slot,
+                         "Write failed: variable not found");
+      IrInstruction &instruction = emit(irWrite);
+      instruction.first = value;
+      if (value.kind == irNone)
+        instruction.text = write->write_text;
+      if (keeps_value)
+        assign(result(), constant(0.0));
+    } else if (ReadStatementNode *read =
+                   dynamic_cast<ReadStatementNode *>(node)) {
+      IrValue dest = variable(read->read_text, read->frame_slot,
+                              "Read failed: identifier not found");
+      emit(irRead).dest = dest;
+      if (keeps_value)
+        assign(result(), dest);
+    } else if (IfStatementNode *branch =
+                   dynamic_cast<IfStatementNode *>(node)) {
+      if_statement(branch, keeps_value);
+    } else if (WhileStatementNode *loop =
+                   dynamic_cast<WhileStatementNode *>(node)) {
+      while_statement(loop, keeps_value);
+    } else if (ForStatementNode *loop =
+                   dynamic_cast<ForStatementNode *>(node)) {
+      for_statement(loop, keeps_value);
+    } else if (LoopExitStatementNode *exit =
+                   dynamic_cast<LoopExitStatementNode *>(node)) {
+      // What follows in the block is never run; it is dropped.
+      if (loops.back().keeps_value)
+        assign(result(), constant(0.0));
+      jump(exit->exit_token == TOK_BREAK ? loops.back().exit
+                                         : loops.back().next,
+           new_block());
+    } else if (CallStatementNode *call =
+                   dynamic_cast<CallStatementNode *>(node)) {
+      call_statement(call, keeps_value);
+    } else {
+      fail("unknown statement");
+    }
+  }
+
+  void if_statement(IfStatementNode *node, bool keeps_value) {
+    IrValue condition = expression(node->if_expression);
+    int then_block = new_block();
+    int else_block = node->has_else || keeps_value ? new_block() : -1;
+    int join = new_block();
+    branch(node->integer_condition ? irTestPositive : irTestAbove, condition,
+           then_block, else_block >= 0 ? else_block : join);
+    block = then_block;
+    statement(node->then_statement, keeps_value);
+    if (else_block < 0) {
+      jump(join, join);
+      return;
+    }
+    jump(join, else_block);
+    if (node->has_else)
+      statement(node->else_statement, keeps_value);
+    else
+      assign(result(), constant(0.0));
+    jump(join, join);
+  }
+
+  void while_statement(WhileStatementNode *node, bool keeps_value) {
+    if (keeps_value)
+      assign(result(), constant(0.0));
+    int head = new_block();
+    int body = new_block();
+    int exit = new_block();
+    jump(head, head);
+    branch(irTestOne, expression(node->while_expression), body, exit);
+    block = body;
+    loops.push_back(IrLoop{head, exit, keeps_value});
+    statement(node->while_statement, keeps_value);
+    loops.pop_back();
+    jump(head, exit);
+  }
+
+  // The running value is kept apart from the counter, which the body may
+  // change, and stepped before the body, which cannot see it; CONTINUE goes
+  // on to the next trip.
+  void for_statement(ForStatementNode *node, bool keeps_value) {
+    IrValue counter = variable(node->identifier, node->frame_slot,
+                               "For loop failed: Variable not found");
+    IrValue value = temp();
+    assign(value, expression(node->start_expression));
+    IrValue last = expression(node->end_expression);
+    IrInstruction &trips = emit(irTrips);
+    trips.first = value;
+    trips.second = last;
+    trips.exact = node->is_downto;
+    trips.counter = current().counters++;
+    int trip_counter = trips.counter;
+    if (keeps_value)
+      assign(result(), constant(0.0));
+
+    int head = new_block();
+    int body = new_block();
+    int exit = new_block();
+    jump(head, head);
+    open().end.op = irNext;
+    open().end.counter = trip_counter;
+    open().end.target = body;
+    open().end.other = exit;
+    block = body;
+    assign(counter, value);
+    IrInstruction &step = emit(irAdd);
+    step.dest = value;
+    step.first = value;
+    step.second = constant(node->is_downto ? -1.0 : 1.0);
+    loops.push_back(IrLoop{head, exit, keeps_value});
+    statement(node->for_statement, keeps_value);
+    loops.pop_back();
+    jump(head, exit);
+  }
+
+  void call_statement(CallStatementNode *call, bool keeps_value) {
+    ProcedureNode *procedure = call->procedure;
+    auto callee = callees.find(procedure);
+    if (callee == callees.end()) {
+      IrFunction added;
+      added.name = procedure->name;
+      added.procedure = procedure;
+      added.frame_size = procedure->frame_size;
+      program->functions.push_back(added);
+      callee = callees.insert(std::make_pair(
+                                  procedure, program->functions.size() - 1))
+                   .first;
+    }
+    std::vector<IrValue> arguments;
+    for (auto it = call->arguments.begin(); it != call->arguments.end(); ++it)
+      arguments.push_back(expression(*it));
+    IrInstruction &instruction = emit(irCall);
+    instruction.callee = callee->second;
+    instruction.arguments = arguments;
+    if (keeps_value)
+      instruction.dest = result();
+  }
+
+  void lower(int index, CompoundStatementNode *body) {
+    function = index;
+    block = new_block();
+    statement(body, true);
+    open().end.op = irReturn;
+    open().end.first = result();
+  }
+};
+
+// Blocks that only jump, and hold no statements, are skipped by the edges
+// into them.
+static int skip_forwarding(const IrFunction &function, int target) {
+  for (size_t hops = 0; hops < function.blocks.size(); hops++) {
+    const IrBlock &block = function.blocks[target];
+    if (!block.code.empty() || block.statements || block.end.op != irJump)
+      break;
+    target = block.end.target;
+  }
+  return target;
+}
+
+static void postorder(const IrFunction &function, int index,
+                      std::vector<bool> &seen, std::vector<int> &order) {
+  seen[index] = true;
+  const IrInstruction &end = function.blocks[index].end;
+  // Visiting the other edge first puts the taken edge's blocks first.
+  if (end.other >= 0 && !seen[end.other])
+    postorder(function, end.other, seen, order);
+  if (end.target >= 0 && !seen[end.target])
+    postorder(function, end.target, seen, order);
+  order.push_back(index);
+}
+
+// Drops the blocks no edge reaches, numbers the others in reverse
+// postorder, so that a block comes after those that lead into it other than
+// through a loop, and fills in the predecessors.
+static void tidy(IrFunction &function) {
+  for (auto it = function.blocks.begin(); it != function.blocks.end(); ++it) {
+    IrInstruction &end = it->end;
+    if (end.op == irReturn)
+      continue;
+    end.target = skip_forwarding(function, end.target);
+    if (end.op != irJump)
+      end.other = skip_forwarding(function, end.other);
+  }
+
+  std::vector<bool> seen(function.blocks.size(), false);
+  std::vector<int> order;
+  postorder(function, 0, seen, order);
+  std::reverse(order.begin(), order.end());
+
+  std::vector<int> number(function.blocks.size(), -1);
+  for (size_t i = 0; i < order.size(); i++)
+    number[order[i]] = i;
+  std::vector<IrBlock> blocks;
+  for (size_t i = 0; i < order.size(); i++) {
+    blocks.push_back(function.blocks[order[i]]);
+    IrInstruction &end = blocks.back().end;
+    if (end.target >= 0)
+      end.target = number[end.target];
+    if (end.other >= 0)
+      end.other = number[end.other];
+  }
+  for (size_t i = 0; i < blocks.size(); i++) {
+    const IrInstruction &end = blocks[i].end;
+    if (end.target >= 0)
+      blocks[end.target].predecessors.push_back(i);
+    if (end.other >= 0 && end.other != end.target)
+      blocks[end.other].predecessors.push_back(i);
+  }
+  function.blocks.swap(blocks);
+}
+
+void lower_program(ProgramNode *root, IrProgram &program) {
+  program.functions.clear();
+  IrFunction main;
+  main.name = "main";
+  main.frame_size = root->frame_size;
+  program.functions.push_back(main);
+
+  IrBuilder builder;
+  builder.program = &program;
+  builder.lower(0, root->program_block->compound_stmt);
+  // Lowering a procedure adds those it calls.
+  for (size_t i = 1; i < program.functions.size(); i++)
+    builder.lower(i, program.functions[i].procedure->body);
+  for (auto it = program.functions.begin(); it != program.functions.end();
+       ++it)
+    tidy(*it);
+}
+
+// Listing
+
+static std::string value_text(const IrValue &value) {
+  char text[numberTextSize];
+  switch (value.kind) {
+  case irTemp:
+    return value.index == irResult ? "r" : "t" + std::to_string(value.index);
+  case irSlot:
+    return (value.name ? *value.name : "") + "@" +
+           std::to_string(value.index);
+  case irGlobal:
+    return *value.name;
+  case irConstant:
+    format_number(value.constant, text);
+    return text;
+  default:
+    return "";
+  }
+}
+
+static const char *relation_name(int relation) {
+  switch (relation) {
+  case TOK_LESSTHAN:
+    return "lt";
+  case TOK_GREATERTHAN:
+    return "gt";
+  case TOK_EQUALTO:
+    return "eq";
+  default:
+    return "ne";
+  }
+}
+
+static const char *test_text(int test) {
+  switch (test) {
+  case irTestOne:
+    return " == 1";
+  case irTestAbove:
+    return " > 0.001";
+  case irTestPositive:
+    return " > 0";
+  default:
+    return " >= 0.001";
+  }
+}
+
+static void print_instruction(const IrProgram &program,
+                              const IrInstruction &instruction,
+                              std::ostream &os) {
+  std::string first = value_text(instruction.first);
+  std::string second = value_text(instruction.second);
+  std::string exact = instruction.exact ? ".int" : "";
+  os << "  ";
+  if (instruction.dest.kind != irNone)
+    os << value_text(instruction.dest) << " = ";
+  switch (instruction.op) {
+  case irCopy:
+    os << first;
+    break;
+  case irAdd:
+    os << "add " << first << ", " << second;
+    break;
+  case irSubtract:
+    os << "sub " << first << ", " << second;
+    break;
+  case irMultiply:
+    os << "mul " << first << ", " << second;
+    break;
+  case irDivide:
+    os << "div " << first << ", " << second;
+    break;
+  case irNegate:
+    os << "neg " << first;
+    break;
+  case irCompare:
+    os << relation_name(instruction.relation) << exact << " " << first
+       << ", " << second;
+    break;
+  case irNot:
+    os << "not" << exact << " " << first;
+    break;
+  case irTruth:
+    os << "truth " << first;
+    break;
+  case irLoad:
+    os << "load " << instruction.array->name << "[" << first << "]";
+    break;
+  case irStore:
+    os << "store " << instruction.array->name << "[" << first << "], "
+       << second;
+    break;
+  case irRead:
+    os << "read";
+    break;
+  case irWrite:
+    if (instruction.first.kind == irNone)
+      os << "write \"" << instruction.text << "\"";
+    else
+      os << "write " << first;
+    break;
+  case irCall:
+    os << "call " << program.functions[instruction.callee].name << "(";
+    for (size_t i = 0; i < instruction.arguments.size(); i++)
+      os << (i ? ", " : "") << value_text(instruction.arguments[i]);
+    os << ")";
+    break;
+  case irTrips:
+    os << "c" << instruction.counter << " = trips"
+       << (instruction.exact ? ".down " : " ") << first << ", " << second;
+    break;
+  case irFail:
+    os << "fail \"" << instruction.text << "\"";
+    break;
+  case irJump:
+    os << "jump L" << instruction.target;
+    break;
+  case irBranch:
+    os << "branch " << first << test_text(instruction.test) << " ? L"
+       << instruction.target << " : L" << instruction.other;
+    break;
+  case irNext:
+    os << "next c" << instruction.counter << " ? L" << instruction.target
+       << " : L" << instruction.other;
+    break;
+  case irReturn:
+    os << "return " << first;
+    break;
+  }
+  os << std::endl;
+}
+
+void print_ir(const IrProgram &program, std::ostream &os) {
+  size_t total_blocks = 0, total_instructions = 0;
+  os << std::endl << "*** IR ***" << std::endl;
+  for (auto function = program.functions.begin();
+       function != program.functions.end(); ++function) {
+    size_t instructions = 0;
+    for (auto it = function->blocks.begin(); it != function->blocks.end();
+         ++it)
+      instructions += it->code.size() + 1;
+    os << (function->procedure ? "procedure " : "") << function->name << ": "
+       << function->blocks.size() << " blocks, " << instructions
+       << " instructions" << std::endl;
+    for (size_t i = 0; i < function->blocks.size(); i++) {
+      const IrBlock &block = function->blocks[i];
+      os << "L" << i << ":";
+      for (size_t p = 0; p < block.predecessors.size(); p++)
+        os << (p ? ", L" : " <- L") << block.predecessors[p];
+      os << std::endl;
+      for (auto it = block.code.begin(); it != block.code.end(); ++it)
+        print_instruction(program, *it, os);
+      print_instruction(program, block.end, os);
+    }
+    total_blocks += function->blocks.size();
+    total_instructions += instructions;
+  }
+  os << program.functions.size() << " functions, " << total_blocks
+     << " blocks, " << total_instructions << " instructions" << std::endl;
+}
+
+// Interpreter
+
+// Temps and FOR trip counters of the running functions, the innermost
+// last. They are kept out of callStack and off the native stack, so a call
+// uses no more of either than in the tree. A nested call may grow them, so
+// a function finds its part by index after each call.
+static thread_local std::vector<float> irTemps;
+static thread_local std::vector<long> irCounters;
+static thread_local size_t irTempsTop = 0;
+static thread_local size_t irCountersTop = 0;
+
+// Zeroes count entries at top, growing arena if needed, and returns their
+// index.
+template <typename T>
+static size_t push_locals(std::vector<T> &arena, size_t &top, size_t count) {
+  size_t base = top;
+  top += count;
+  if (top > arena.size())
+    arena.resize(std::max(top, 2 * arena.size()));
+  std::fill(arena.begin() + base, arena.begin() + top, T());
+  return base;
+}
+
+static float load_value(const IrValue &value, const float *temps) {
+  switch (value.kind) {
+  case irTemp:
+    return temps[value.index];
+  case irSlot:
+    return callStack[framePointer + value.index];
+  case irGlobal:
+    return *value.storage;
+  default:
+    return value.constant;
+  }
+}
+
+static void store_value(const IrValue &value, float *temps, float number) {
+  switch (value.kind) {
+  case irTemp:
+    temps[value.index] = number;
+    break;
+  case irSlot:
+    callStack[framePointer + value.index] = number;
+    break;
+  case irGlobal:
+    *value.storage = number;
+    break;
+  default:
+    break;
+  }
+}
+
+static bool passes(int test, float value) {
+  switch (test) {
+  case irTestOne:
+    return value == 1.0;
+  case irTestAbove:
+    return value > EPSILON;
+  case irTestPositive:
+    return value > 0.0f;
+  default:
+    return value >= EPSILON;
+  }
+}
+
+// As CallStatementNode::interpret: arguments, then zeroed locals, in a
+// frame at stackTop, which becomes the current one. Returns the caller's.
+static size_t enter_call(const IrFunction &callee,
+                         const IrInstruction &instruction, const float *temps) {
+  const std::vector<IrValue> &arguments = instruction.arguments;
+  size_t frame = stackTop;
+  size_t frame_end = frame + callee.frame_size;
+  if (frame_end > stackLimit || native_stack_exhausted())
+    throw("Procedure call failed: call stack overflow");
+  for (size_t i = 0; i < arguments.size(); i++)
+    callStack[frame + i] = load_value(arguments[i], temps);
+  std::fill(callStack.begin() + frame + arguments.size(),
+            callStack.begin() + frame_end, 0.0f);
+
+  size_t caller = framePointer;
+  framePointer = frame;
+  stackTop = frame_end;
+  return caller;
+}
+
+// Runs an instruction other than a call.
+static void execute(const IrInstruction &instruction, float *temps,
+                    long *counters) {
+  float first = load_value(instruction.first, temps);
+  float second = load_value(instruction.second, temps);
+  switch (instruction.op) {
+  case irCopy:
+    store_value(instruction.dest, temps, first);
+    break;
+  case irAdd:
+    store_value(instruction.dest, temps, first + second);
+    break;
+  case irSubtract:
+    store_value(instruction.dest, temps, first - second);
+    break;
+  case irMultiply:
+    store_value(instruction.dest, temps, first * second);
+    break;
+  case irDivide:
+    store_value(instruction.dest, temps, first / second);
+    break;
+  case irNegate:
+    store_value(instruction.dest, temps, -first);
+    break;
+  case irCompare:
+    store_value(instruction.dest, temps,
+                instruction.exact
+                    ? compare_integers(instruction.relation, first, second)
+                    : compare_values(instruction.relation, first, second));
+    break;
+  case irNot:
+    if (instruction.exact)
+      store_value(instruction.dest, temps, first > 0.0f ? 0.0 : 1.0);
+    else
+      store_value(instruction.dest, temps, first >= EPSILON ? 0.0 : 1.0);
+    break;
+  case irTruth:
+    store_value(instruction.dest, temps, first >= EPSILON ? 1.0 : 0.0);
+    break;
+  case irLoad:
+    store_value(instruction.dest, temps,
+                *instruction.array->element(first, true));
+    break;
+  case irStore:
+    *instruction.array->element(first, true) = second;
+    break;
+  case irRead: {
+    output_flush_for_input();
+    float value = input_read_value();
+    inputValuesConsumed++;
+    store_value(instruction.dest, temps, value);
+    break;
+  }
+  case irWrite:
+    if (instruction.first.kind == irNone) {
+      *programOutput << instruction.text << "\n";
+    } else {
+      char text[numberTextSize];
+      size_t length = format_number(first, text);
+      text[length++] = '\n';
+      programOutput->write(text, length);
+    }
+    break;
+  case irTrips:
+    counters[instruction.counter] =
+        for_trip_count(first, second, instruction.exact);
+    break;
+  case irFail:
+    throw(instruction.text.c_str());
+  default:
+    break;
+  }
+}
+
+// Runs function in the frame at framePointer.
+static float run_function(const IrProgram &program,
+                          const IrFunction &function) {
+  size_t temps_base = push_locals(irTemps, irTempsTop, function.temps);
+  size_t counters_base =
+      push_locals(irCounters, irCountersTop, function.counters);
+  float *temps = &irTemps[temps_base];
+  long *counters = &irCounters[counters_base];
+
+  const IrBlock *block = &function.blocks[0];
+  for (;;) {
+    statementsExecuted += block->statements;
+    irInstructionsExecuted += block->code.size() + 1;
+    for (auto it = block->code.begin(); it != block->code.end(); ++it) {
+      if (it->op != irCall) {
+        execute(*it, temps, counters);
+        continue;
+      }
+      // Only this frame is on the native stack while the callee runs.
+      const IrFunction &callee = program.functions[it->callee];
+      size_t caller = enter_call(callee, *it, temps);
+      float value = run_function(program, callee);
+      stackTop = framePointer;
+      framePointer = caller;
+      temps = &irTemps[temps_base];
+      counters = &irCounters[counters_base];
+      store_value(it->dest, temps, value);
+    }
+
+    const IrInstruction &end = block->end;
+    int next = end.target;
+    if (end.op == irReturn) {
+      irTempsTop = temps_base;
+      irCountersTop = counters_base;
+      return load_value(end.first, temps);
+    }
+    if (end.op == irBranch && !passes(end.test, load_value(end.first, temps)))
+      next = end.other;
+    if (end.op == irNext && counters[end.counter]-- <= 0)
+      next = end.other;
+    block = &function.blocks[next];
+  }
+}
+
+float run_ir(const IrProgram &program) {
+  framePointer = 0;
+  stackTop = program.functions[0].frame_size;
+  irTempsTop = 0;
+  irCountersTop = 0;
+  return run_function(program, program.functions[0]);
+}
@@ -0,0 +1,114 @@
+#ifndef IR_H
+#define IR_H
+
+#include "parse_tree_nodes.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Control-flow-graph IR (--ir, --report-ir). The main program and each
+// procedure it calls are lowered to a function of basic blocks. A block is
+// a list of three-address instructions ending in one jump, branch or return,
+// so IF, WHILE, FOR, BREAK, CONTINUE and the short-circuit AND and OR are
+// edges between blocks rather than calls inside interpret(). Analyses can
+// walk the blocks and their predecessors without knowing the statements.
+
+// Operand or destination of an instruction.
+enum { irNone, irTemp, irSlot, irGlobal, irConstant };
+
+struct IrValue {
+  int kind = irNone;
+  int index = 0;                     // temp number, or frame slot
+  float *storage = nullptr;          // global
+  const std::string *name = nullptr; // global, or slot when known
+  float constant = 0.0;
+};
+
+// Temp 0 of every function holds the value interpret() would return: the
+// value of the last statement run, returned by the function.
+const int irResult = 0;
+
+enum {
+  // dest = first, or dest = op first, second
+  irCopy,
+  irAdd,
+  irSubtract,
+  irMultiply,
+  irDivide,
+  irNegate,
+  irCompare, // by relation, with EPSILON, or exactly when exact is set
+  irNot,   // 1 when first is false; first is tested against 0 when exact
+  irTruth, // 1 when first >= EPSILON, as AND and OR test their operands
+  irLoad,  // dest = array[first], bounds checked
+  irStore, // array[first] = second, bounds checked
+  irRead,  // dest = next input value
+  irWrite, // writes first, or text when first is irNone
+  irCall,  // dest = callee(arguments), in a new frame
+  irTrips, // counter = FOR trip count from first to second, down when exact
+  irFail,  // stops the program with text
+  // Terminators
+  irJump,   // to target
+  irBranch, // to target when first passes test, else to other
+  irNext,   // to target, counting down counter, or to other once it is 0
+  irReturn  // returns first
+};
+
+// Branch tests, as the statements test their conditions.
+enum {
+  irTestOne,      // == 1, WHILE
+  irTestAbove,    // > EPSILON, IF
+  irTestPositive, // > 0, IF on a whole-number condition
+  irTestTruth     // >= EPSILON, AND and OR
+};
+
+struct IrInstruction {
+  int op = irJump;
+  IrValue dest, first, second;
+  bool exact = false;
+  ArrayVariable *array = nullptr;
+  int relation = TOK_UNKNOWN;
+  std::string text;
+  int callee = -1;  // function index
+  int counter = -1; // FOR trip counter
+  std::vector<IrValue> arguments;
+  int test = irTestOne;
+  int target = -1, other = -1; // block indexes
+};
+
+struct IrBlock {
+  std::vector<IrInstruction> code;
+  IrInstruction end; // terminator
+  std::vector<int> predecessors;
+  // Statements the tree walker would count on entering the block.
+  unsigned long statements = 0;
+};
+
+struct IrFunction {
+  std::string name;
+  ProcedureNode *procedure = nullptr; // null for the main program
+  int frame_size = 0;
+  std::vector<IrBlock> blocks; // blocks[0] is the entry
+  int temps = 1;
+  int counters = 0;
+};
+
+struct IrProgram {
+  std::vector<IrFunction> functions; // functions[0] is the main program
+};
+
+// Instructions run by run_ir(), terminators included.
+extern unsigned long irInstructionsExecuted;
+
+// Lowers root and the procedures it calls. Blocks no edge reaches are
+// dropped. COBEGIN statements and parallel FOR loops run in order, as they
+// share no variables, and closed-form WHILE loops are iterated.
+void lower_program(ProgramNode *root, IrProgram &program);
+
+// Lists each function's blocks and instructions, with the counts of both.
+void print_ir(const IrProgram &program, std::ostream &os);
+
+// Runs the program, with the output, errors and final value of
+// root->interpret().
+float run_ir(const IrProgram &program);
+
+#endif /* IR_H */
@@ -0,0 +1,1064 @@
+#include "jit.h"
+#include "checkpoint.h"
+#include "input.h"
+#include "lexer.h"
+#include "number_format.h"
+#include "output.h"
+#include "parser.h"
+#include "pgo.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#ifdef __x86_64__
+#include <sys/mman.h>
+
+#define EPSILON 0.001
+
+// Register use of the generated code: xmm0-xmm5 hold the temporaries of an
+// expression by nesting depth, xmm6 and xmm7 are scratch, and xmm8-xmm15
+// hold the most used variables. rbx points at the data block, r12 counts
+// the statements run, and r13-r15 the trips left in the three outermost FOR
+// loops; deeper loops keep theirs in the data block.
+static const int expressionRegisters = 6;
+static const int scratch = 6;
+static const int scratch2 = 7;
+static const int firstVariableRegister = 8;
+static const int variableRegisters = 8;
+static const int tripRegisters = 3;
+
+// x86 condition codes; cc ^ 1 is the opposite condition.
+enum {
+  ccB = 2, ccAE = 3, ccE = 4, ccNE = 5, ccBE = 6, ccA = 7, ccP = 10,
+  ccLE = 14, ccG = 15
+};
+static const int always = -1;
+
+// Exit status of the generated code.
+enum { jitDone, jitBoundsError, jitRuntimeError };
+
+// Opcodes after 0F of the SSE instructions used.
+enum {
+  sseLoad = 0x10, sseStore = 0x11, sseMoveAll = 0x28, sseToInt = 0x2D,
+  sseFromInt = 0x2A, sseUnorderedCompare = 0x2E, sseCompare = 0x2F,
+  sseAnd = 0x54, sseXor = 0x57, sseAdd = 0x58, sseMultiply = 0x59,
+  sseConvert = 0x5A, sseSubtract = 0x5C, sseDivide = 0x5E
+};
+static const int single = 0xF3; // prefixes for scalar float and double
+static const int pairDouble = 0x66;
+static const int scalarDouble = 0xF2;
+
+// Message of the error a runtime call failed with.
+static const char *jitError = nullptr;
+
+// Runtime calls made by the generated code. They must not throw, because
+// there is no unwind information for the generated frames.
+static void jit_write_number(float value) {
+  char text[numberTextSize];
+  size_t length = format_number(value, text);
+  text[length++] = '\n';
+  programOutput->write(text, length);
+}
+
+static void jit_write_text(const std::string *text) {
+  *programOutput << *text << "\n";
+}
+
+static int jit_read(float *value) {
+  try {
+    output_flush_for_input();
+    *value = input_read_value();
+  } catch (char const *errmsg) {
+    jitError = errmsg;
+    return 1;
+  }
+  inputValuesConsumed++;
+  return 0;
+}
+
+// A variable, or the running value of a FOR loop, with its place in the
+// data block and the SSE register holding it, if any.
+struct JitSlot {
+  float *home = nullptr; // interpreter storage, copied in and out
+  double weight = 0.0;
+  int offset = 0;
+  int reg = -1;
+};
+
+// Runtime call for a procedure call that was not inlined, made by the
+// interpreter: the variables are copied from the data block to their homes
+// for it, and back after it, since the procedure may read or change them.
+static int jit_call(CallStatementNode *call, const std::vector<JitSlot> *slots,
+                    char *block, float *result) {
+  for (auto it = slots->begin(); it != slots->end(); ++it)
+    if (it->home)
+      memcpy(it->home, block + it->offset, sizeof(float));
+  int status = 0;
+  try {
+    float value = call->interpret();
+    if (result)
+      *result = value;
+  } catch (char const *errmsg) {
+    jitError = errmsg;
+    status = 1;
+  } catch (...) {
+    jitError = "Procedure call failed";
+    status = 1;
+  }
+  for (auto it = slots->begin(); it != slots->end(); ++it)
+    if (it->home)
+      memcpy(block + it->offset, it->home, sizeof(float));
+  return status;
+}
+
+// An operand of an SSE instruction: a register, or [rbx + offset].
+struct JitOperand {
+  int reg = -1;
+  int offset = 0;
+};
+
+struct JitLoop {
+  int exit_label;
+  int continue_label;
+};
+
+struct JitCompiler {
+  std::vector<uint8_t> code;
+  // Initial content of the data block: slots, constants and counters.
+  std::vector<char> data;
+  std::string reason; // why the program cannot be compiled
+
+  std::vector<JitSlot> slots;
+  std::map<std::string, int> globalSlots;
+  std::map<int, int> frameSlots;
+  std::map<ForStatementNode *, int> forValues;
+  std::map<uint64_t, int> constants;
+  int resultOffset = 0;
+  int countOffset = 0;
+
+  std::vector<long> labels;
+  std::vector<std::pair<size_t, int>> jumps;
+  std::vector<JitLoop> loops;
+  int forDepth = 0;
+  int boundsLabel = 0;
+  int runtimeLabel = 0;
+
+  void unsupported(const std::string &why) {
+    if (reason.empty())
+      reason = why;
+  }
+
+  // Data block
+
+  int allocate(size_t size, size_t align) {
+    while (data.size() % align)
+      data.push_back(0);
+    int offset = data.size();
+    data.resize(offset + size);
+    return offset;
+  }
+
+  int constant(const void *value, size_t size) {
+    uint64_t bits = 0;
+    memcpy(&bits, value, size);
+    bits = bits * 2 + (size == 8);
+    auto found = constants.find(bits);
+    if (found != constants.end())
+      return found->second;
+    int offset = allocate(size, size);
+    memcpy(&data[offset], value, size);
+    constants[bits] = offset;
+    return offset;
+  }
+  int float_constant(float value) { return constant(&value, sizeof value); }
+  int mask_constant(uint32_t bits) { return constant(&bits, sizeof bits); }
+  int epsilon() {
+    double value = EPSILON;
+    return constant(&value, sizeof value);
+  }
+
+  int new_slot(float *home) {
+    JitSlot slot;
+    slot.home = home;
+    slot.offset = allocate(sizeof(float), sizeof(float));
+    slots.push_back(slot);
+    return slots.size() - 1;
+  }
+
+  // The slot of a frame slot or global variable, -1 if there is none.
+  int variable(int frame_slot, const std::string &name) {
+    if (frame_slot >= 0) {
+      if ((size_t)frame_slot >= callStack.size()) {
+        unsupported("frame slot outside the call stack");
+        return -1;
+      }
+      auto found = frameSlots.find(frame_slot);
+      if (found != frameSlots.end())
+        return found->second;
+      return frameSlots[frame_slot] = new_slot(&callStack[frame_slot]);
+    }
+    auto found = globalSlots.find(name);
+    if (found != globalSlots.end())
+      return found->second;
+    auto var = symbolTable.find(name);
+    if (var == symbolTable.end()) {
+      unsupported("variable " + name + " is not declared");
+      return -1;
+    }
+    return globalSlots[name] = new_slot(&var->second);
+  }
+
+  int for_value(ForStatementNode *loop) {
+    auto found = forValues.find(loop);
+    if (found != forValues.end())
+      return found->second;
+    return forValues[loop] = new_slot(nullptr);
+  }
+
+  JitOperand slot_operand(int slot) {
+    JitOperand operand;
+    if (slot >= 0) {
+      operand.reg = slots[slot].reg;
+      operand.offset = slots[slot].offset;
+    }
+    return operand;
+  }
+
+  // Register allocation: the heaviest slots get the variable registers.
+  // A use weighs 16 times more for every loop around it, or, with a
+  // --pgo-use profile, as many times as its statement ran.
+
+  void weigh(int slot, double weight) {
+    if (slot >= 0)
+      slots[slot].weight += weight;
+  }
+
+  void weigh(FactorNode *factor, double weight) {
+    if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor))
+      weigh(variable(id->frame_slot, id->identifier), weight);
+    else if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor))
+      weigh(minus->child_factor, weight);
+    else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor))
+      weigh(negation->child_factor, weight);
+    else if (ExpressionFactorNode *nested =
+                 dynamic_cast<ExpressionFactorNode *>(factor))
+      weigh(nested->child_expression, weight);
+    else if (ArrayFactorNode *element = dynamic_cast<ArrayFactorNode *>(factor))
+      weigh(element->index_expression, weight);
+  }
+
+  void weigh(TermNode *term, double weight) {
+    weigh(term->first_factor, weight);
+    for (auto it = term->following_factors.begin();
+         it != term->following_factors.end(); ++it)
+      weigh(*it, weight);
+  }
+
+  void weigh(SimpleExpressionNode *simple_exp, double weight) {
+    weigh(simple_exp->first_term, weight);
+    for (auto it = simple_exp->following_terms.begin();
+         it != simple_exp->following_terms.end(); ++it)
+      weigh(*it, weight);
+  }
+
+  void weigh(ExpressionNode *expression, double weight) {
+    weigh(expression->first_simple_exp, weight);
+    if (expression->second_simple_exp)
+      weigh(expression->second_simple_exp, weight);
+  }
+
+  void weigh(StatementNode *statement, double weight) {
+    long long runs = pgo_count(statement);
+    if (runs >= 0)
+      weight = runs;
+    if (CompoundStatementNode *compound =
+            dynamic_cast<CompoundStatementNode *>(statement)) {
+      for (auto it = compound->statement_vector.begin();
+           it != compound->statement_vector.end(); ++it)
+        weigh(*it, weight);
+    } else if (AssignmentStatementNode *assignment =
+                   dynamic_cast<AssignmentStatementNode *>(statement)) {
+      weigh(variable(assignment->frame_slot, assignment->identifier), weight);
+      weigh(assignment->assignment_expr, weight);
+    } else if (ArrayAssignmentStatementNode *assignment =
+                   dynamic_cast<ArrayAssignmentStatementNode *>(statement)) {
+      weigh(assignment->index_expression, weight);
+      weigh(assignment->assignment_expr, weight);
+    } else if (WriteStatementNode *write =
+                   dynamic_cast<WriteStatementNode *>(statement)) {
+      if (write->element)
+        weigh(write->element, weight);
+      else if (write->frame_slot >= 0 || write->is_identifier)
+        weigh(variable(write->frame_slot, write->write_text), weight);
+    } else if (ReadStatementNode *read =
+                   dynamic_cast<ReadStatementNode *>(statement)) {
+      weigh(variable(read->frame_slot, read->read_text), weight);
+    } else if (IfStatementNode *branch =
+                   dynamic_cast<IfStatementNode *>(statement)) {
+      weigh(branch->if_expression, weight);
+      weigh(branch->then_statement, weight);
+      if (branch->has_else)
+        weigh(branch->else_statement, weight);
+    } else if (WhileStatementNode *loop =
+                   dynamic_cast<WhileStatementNode *>(statement)) {
+      double trips = pgo_trips(loop);
+      weigh(loop->while_expression,
+            runs >= 0 && trips >= 0 ? weight * (trips + 1) : weight * 16);
+      weigh(loop->while_statement, weight * 16);
+    } else if (ForStatementNode *loop =
+                   dynamic_cast<ForStatementNode *>(statement)) {
+      weigh(loop->start_expression, weight);
+      weigh(loop->end_expression, weight);
+      weigh(variable(loop->frame_slot, loop->identifier), weight * 16);
+      weigh(for_value(loop), weight * 32);
+      weigh(loop->for_statement, weight * 16);
+    }
+  }
+
+  void assign_registers() {
+    std::vector<int> order;
+    for (size_t i = 0; i < slots.size(); i++)
+      order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+      return slots[a].weight > slots[b].weight;
+    });
+    for (int i = 0; i < variableRegisters && i < (int)order.size(); i++)
+      slots[order[i]].reg = firstVariableRegister + i;
+  }
+
+  // Instruction encoding
+
+  void byte(int value) { code.push_back((uint8_t)value); }
+  void bytes(std::initializer_list<int> values) {
+    for (auto it = values.begin(); it != values.end(); ++it)
+      byte(*it);
+  }
+  void dword(uint32_t value) {
+    for (int i = 0; i < 4; i++)
+      byte(value >> (8 * i));
+  }
+  void qword(uint64_t value) {
+    for (int i = 0; i < 8; i++)
+      byte(value >> (8 * i));
+  }
+
+  // SSE instruction on two registers; wide makes a general register rm
+  // 64 bits.
+  void sse(int prefix, int opcode, int reg, int rm, bool wide = false) {
+    if (prefix)
+      byte(prefix);
+    int rex = (wide ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+    if (rex)
+      byte(0x40 | rex);
+    bytes({0x0F, opcode, 0xC0 | (reg & 7) << 3 | (rm & 7)});
+  }
+
+  // SSE instruction on a register and [rbx + offset].
+  void sse_memory(int prefix, int opcode, int reg, int offset) {
+    if (prefix)
+      byte(prefix);
+    if (reg >= 8)
+      byte(0x44);
+    bytes({0x0F, opcode, 0x80 | (reg & 7) << 3 | 3});
+    dword(offset);
+  }
+
+  // SSE instruction on a register and the element [rcx + index * 4], index
+  // being rax (0) or rdx (2).
+  void sse_element(int opcode, int reg, int index) {
+    byte(single);
+    if (reg >= 8)
+      byte(0x44);
+    bytes({0x0F, opcode, (reg & 7) << 3 | 4, 0x80 | index << 3 | 1});
+  }
+
+  void sse_operand(int prefix, int opcode, int reg, const JitOperand &operand) {
+    if (operand.reg >= 0)
+      sse(prefix, opcode, reg, operand.reg);
+    else
+      sse_memory(prefix, opcode, reg, operand.offset);
+  }
+
+  void load(int reg, const JitOperand &operand) {
+    if (operand.reg < 0)
+      sse_memory(single, sseLoad, reg, operand.offset);
+    else if (operand.reg != reg)
+      sse(0, sseMoveAll, reg, operand.reg);
+  }
+
+  void store(const JitOperand &operand, int reg) {
+    if (operand.reg < 0)
+      sse_memory(single, sseStore, reg, operand.offset);
+    else if (operand.reg != reg)
+      sse(0, sseMoveAll, operand.reg, reg);
+  }
+
+  void load_constant(int reg, float value) {
+    sse_memory(single, sseLoad, reg, float_constant(value));
+  }
+
+  void zero(int reg) { sse(0, sseXor, reg, reg); }
+
+  int new_label() {
+    labels.push_back(-1);
+    return labels.size() - 1;
+  }
+
+  void bind(int label) { labels[label] = code.size(); }
+
+  void jump(int cc, int label) {
+    if (cc == always)
+      byte(0xE9);
+    else
+      bytes({0x0F, 0x80 | cc});
+    jumps.push_back(std::make_pair(code.size(), label));
+    dword(0);
+  }
+
+  void mov_rax(const void *value) {
+    bytes({0x48, 0xB8});
+    qword((uint64_t)value);
+  }
+
+  void mov_rdi(const void *value) {
+    bytes({0x48, 0xBF});
+    qword((uint64_t)value);
+  }
+
+  // Variables in registers are stored before a runtime call, which may use
+  // every SSE register, and loaded again after it.
+  void store_variables() {
+    for (auto it = slots.begin(); it != slots.end(); ++it)
+      if (it->reg >= 0)
+        sse_memory(single, sseStore, it->reg, it->offset);
+  }
+
+  void load_variables() {
+    for (auto it = slots.begin(); it != slots.end(); ++it)
+      if (it->reg >= 0)
+        sse_memory(single, sseLoad, it->reg, it->offset);
+  }
+
+  void call(const void *function) {
+    store_variables();
+    mov_rax(function);
+    bytes({0xFF, 0xD0}); // call rax
+    load_variables();
+  }
+
+  void count_statement() { bytes({0x49, 0xFF, 0xC4}); } // inc r12
+
+  void store_result(int reg) {
+    sse_memory(single, sseStore, reg, resultOffset);
+  }
+
+  void store_zero_result() {
+    zero(scratch);
+    store_result(scratch);
+  }
+
+  // Expressions leave their value in xmm<depth>.
+
+  void check_depth(int depth) {
+    if (depth >= expressionRegisters)
+      unsupported("expression nested too deeply");
+  }
+
+  // Sets the flags to compare xmm<reg> with EPSILON.
+  void compare_epsilon(int reg) {
+    sse(single, sseConvert, scratch, reg);
+    sse_memory(pairDouble, sseCompare, scratch, epsilon());
+  }
+
+  // Sets xmm<reg> to 1.0 when condition cc holds, else 0.0.
+  void materialize(int cc, int reg) {
+    bytes({0x0F, 0x90 | cc, 0xC0});  // setcc al
+    bytes({0x0F, 0xB6, 0xC0});       // movzx eax, al
+    sse(single, sseFromInt, reg, 0); // cvtsi2ss
+  }
+
+  // The operand a factor can be used as directly, if it is a variable or a
+  // constant.
+  bool factor_operand(FactorNode *factor, JitOperand &operand) {
+    if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor)) {
+      operand = slot_operand(variable(id->frame_slot, id->identifier));
+      return true;
+    }
+    if (FloatFactorNode *literal = dynamic_cast<FloatFactorNode *>(factor)) {
+      operand.offset = float_constant(literal->float_literal);
+      return true;
+    }
+    if (ConstantFactorNode *named =
+            dynamic_cast<ConstantFactorNode *>(factor)) {
+      operand.offset = float_constant(named->constant_value);
+      return true;
+    }
+    if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(factor)) {
+      try {
+        operand.offset = float_constant(std::stof(literal->int_literal));
+      } catch (std::exception &) {
+        unsupported("integer literal out of range");
+      }
+      return true;
+    }
+    return false;
+  }
+
+  bool term_operand(TermNode *term, JitOperand &operand) {
+    return term->following_operators.empty() &&
+           factor_operand(term->first_factor, operand);
+  }
+
+  bool simple_operand(SimpleExpressionNode *simple_exp, JitOperand &operand) {
+    return simple_exp->following_operators.empty() &&
+           term_operand(simple_exp->first_term, operand);
+  }
+
+  // Leaves the offset of the array element indexed by xmm<reg> in rax,
+  // jumping to the bounds error when it is outside the array.
+  void element_offset(ArrayVariable *array, int reg) {
+    if (array->low < INT32_MIN || array->low > INT32_MAX ||
+        array->size > INT32_MAX)
+      unsupported("array " + array->name + " too large");
+    sse(single, sseToInt, 0, reg, true); // cvtss2si rax, rounding to nearest
+    if (array->low) {
+      bytes({0x48, 0x2D}); // sub rax, low
+      dword(array->low);
+    }
+    bytes({0x48, 0x3D}); // cmp rax, size
+    dword(array->size);
+    jump(ccAE, boundsLabel);
+    mov_rcx(array->elements);
+  }
+
+  void mov_rcx(const void *value) {
+    bytes({0x48, 0xB9});
+    qword((uint64_t)value);
+  }
+
+  void gen_factor(FactorNode *factor, int depth) {
+    check_depth(depth);
+    JitOperand operand;
+    if (factor_operand(factor, operand)) {
+      load(depth, operand);
+    } else if (MinusFactorNode *minus =
+                   dynamic_cast<MinusFactorNode *>(factor)) {
+      gen_factor(minus->child_factor, depth);
+      sse_memory(single, sseLoad, scratch2, mask_constant(0x80000000));
+      sse(0, sseXor, depth, scratch2);
+    } else if (NotFactorNode *negation =
+                   dynamic_cast<NotFactorNode *>(factor)) {
+      gen_factor(negation->child_factor, depth);
+      if (negation->integer_operand) {
+        compare_zero(depth);
+        materialize(ccBE, depth);
+      } else {
+        compare_epsilon(depth);
+        materialize(ccB, depth);
+      }
+    } else if (ExpressionFactorNode *nested =
+                   dynamic_cast<ExpressionFactorNode *>(factor)) {
+      gen_expression(nested->child_expression, depth);
+    } else if (ArrayFactorNode *element =
+                   dynamic_cast<ArrayFactorNode *>(factor)) {
+      gen_expression(element->index_expression, depth);
+      element_offset(element->array, depth);
+      sse_element(sseLoad, depth, 0);
+    } else {
+      unsupported("unknown factor");
+    }
+  }
+
+  // Applies an arithmetic opcode to xmm<depth> and the value of factor.
+  void apply(int opcode, FactorNode *factor, int depth) {
+    JitOperand operand;
+    if (!factor_operand(factor, operand)) {
+      gen_factor(factor, depth + 1);
+      operand.reg = depth + 1;
+    }
+    sse_operand(single, opcode, depth, operand);
+  }
+
+  void apply(int opcode, TermNode *term, int depth) {
+    JitOperand operand;
+    if (!term_operand(term, operand)) {
+      gen_term(term, depth + 1);
+      operand.reg = depth + 1;
+    }
+    sse_operand(single, opcode, depth, operand);
+  }
+
+  void gen_term(TermNode *term, int depth) {
+    gen_factor(term->first_factor, depth);
+    for (size_t i = 0; i < term->following_operators.size(); i++) {
+      FactorNode *factor = term->following_factors[i];
+      switch (term->following_operators[i]) {
+      case TOK_MULTIPLY:
+        apply(sseMultiply, factor, depth);
+        break;
+      case TOK_DIVIDE:
+        apply(sseDivide, factor, depth);
+        break;
+      case TOK_AND: {
+        int no = new_label(), done = new_label();
+        compare_epsilon(depth);
+        jump(ccB, no);
+        gen_factor(factor, depth);
+        compare_epsilon(depth);
+        jump(ccB, no);
+        load_constant(depth, 1.0);
+        jump(always, done);
+        bind(no);
+        zero(depth);
+        bind(done);
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+
+  void gen_simple(SimpleExpressionNode *simple_exp, int depth) {
+    gen_term(simple_exp->first_term, depth);
+    for (size_t i = 0; i < simple_exp->following_operators.size(); i++) {
+      TermNode *term = simple_exp->following_terms[i];
+      switch (simple_exp->following_operators[i]) {
+      case TOK_PLUS:
+        apply(sseAdd, term, depth);
+        break;
+      case TOK_MINUS:
+        apply(sseSubtract, term, depth);
+        break;
+      case TOK_OR: {
+        int yes = new_label(), done = new_label();
+        compare_epsilon(depth);
+        jump(ccAE, yes);
+        gen_term(term, depth);
+        compare_epsilon(depth);
+        jump(ccAE, yes);
+        zero(depth);
+        jump(always, done);
+        bind(yes);
+        load_constant(depth, 1.0);
+        bind(done);
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+
+  // Sets the flags for a relational expression as compare_values tests it,
+  // and returns the condition under which it holds.
+  int gen_comparison(ExpressionNode *expression, int depth) {
+    gen_simple(expression->first_simple_exp, depth);
+    JitOperand operand;
+    if (!simple_operand(expression->second_simple_exp, operand)) {
+      check_depth(depth + 1);
+      gen_simple(expression->second_simple_exp, depth + 1);
+      operand.reg = depth + 1;
+    }
+    if (expression->exact_compare)
+      return gen_integer_comparison(expression, depth, operand);
+    sse_operand(single, sseSubtract, depth, operand);
+
+    switch (expression->simple_exp_operator) {
+    case TOK_LESSTHAN: // 0 > first - second
+      zero(scratch);
+      sse(0, sseCompare, scratch, depth);
+      return ccA;
+    case TOK_GREATERTHAN: // first - second >= EPSILON
+      compare_epsilon(depth);
+      return ccAE;
+    case TOK_EQUALTO: // EPSILON >= |first - second|
+      sse_memory(single, sseLoad, scratch2, mask_constant(0x7FFFFFFF));
+      sse(0, sseAnd, depth, scratch2);
+      sse(single, sseConvert, scratch, depth);
+      sse_memory(scalarDouble, sseLoad, scratch2, epsilon());
+      sse(pairDouble, sseCompare, scratch2, scratch);
+      return ccAE;
+    case TOK_NOTEQUALTO: // |first - second| > EPSILON
+      sse_memory(single, sseLoad, scratch2, mask_constant(0x7FFFFFFF));
+      sse(0, sseAnd, depth, scratch2);
+      compare_epsilon(depth);
+      return ccA;
+    default:
+      unsupported("unknown relational operator");
+      return ccA;
+    }
+  }
+
+  // Whole numbers, which range analysis has shown both operands to be,
+  // compare directly.
+  int gen_integer_comparison(ExpressionNode *expression, int depth,
+                             const JitOperand &operand) {
+    sse_operand(0, sseCompare, depth, operand);
+    switch (expression->simple_exp_operator) {
+    case TOK_LESSTHAN:
+      return ccB;
+    case TOK_GREATERTHAN:
+      return ccA;
+    case TOK_EQUALTO:
+      return ccE;
+    default:
+      return ccNE;
+    }
+  }
+
+  // Sets the flags to compare xmm<reg>, a whole number, with zero.
+  void compare_zero(int reg) {
+    zero(scratch);
+    sse(0, sseCompare, reg, scratch);
+  }
+
+  void gen_expression(ExpressionNode *expression, int depth) {
+    if (expression->simple_exp_operator == TOK_UNKNOWN)
+      gen_simple(expression->first_simple_exp, depth);
+    else
+      materialize(gen_comparison(expression, depth), depth);
+  }
+
+  // Jumps to false_label unless the condition holds: the value is 1.0 for
+  // WHILE, or greater than EPSILON for IF (zero when integer_condition is
+  // set). Comparisons are 1.0 or 0.0, so their flags are used directly.
+  void gen_condition(ExpressionNode *expression, int false_label,
+                     bool is_while, bool integer_condition) {
+    if (expression->simple_exp_operator != TOK_UNKNOWN) {
+      jump(gen_comparison(expression, 0) ^ 1, false_label);
+      return;
+    }
+    gen_simple(expression->first_simple_exp, 0);
+    if (is_while) {
+      sse_memory(0, sseUnorderedCompare, 0, float_constant(1.0));
+      jump(ccNE, false_label);
+      jump(ccP, false_label);
+    } else {
+      if (integer_condition)
+        compare_zero(0);
+      else
+        compare_epsilon(0);
+      jump(ccBE, false_label);
+    }
+  }
+
+  // Jumps to true_label when the condition of an IF holds; the flags tested
+  // are the opposite of gen_condition's.
+  void gen_taken(ExpressionNode *expression, int true_label,
+                 bool integer_condition) {
+    if (expression->simple_exp_operator != TOK_UNKNOWN) {
+      jump(gen_comparison(expression, 0), true_label);
+      return;
+    }
+    gen_simple(expression->first_simple_exp, 0);
+    if (integer_condition)
+      compare_zero(0);
+    else
+      compare_epsilon(0);
+    jump(ccA, true_label);
+  }
+
+  // Statements store their value at resultOffset when wanted is set, which
+  // is when it may become the value of the program.
+
+  void gen_statement(StatementNode *statement, bool wanted) {
+    // Calls count themselves, being interpreted.
+    if (!dynamic_cast<CallStatementNode *>(statement))
+      count_statement();
+    if (CompoundStatementNode *compound =
+            dynamic_cast<CompoundStatementNode *>(statement)) {
+      // COBEGIN statements share no variables, so running them in order
+      // gives the same output.
+      std::vector<StatementNode *> &children = compound->statement_vector;
+      if (children.empty() && wanted)
+        store_zero_result();
+      for (size_t i = 0; i < children.size(); i++)
+        gen_statement(children[i], wanted && (compound->has_loop_exit ||
+                                              i + 1 == children.size()));
+    } else if (AssignmentStatementNode *assignment =
+                   dynamic_cast<AssignmentStatementNode *>(statement)) {
+      int slot = variable(assignment->frame_slot, assignment->identifier);
+      gen_expression(assignment->assignment_expr, 0);
+      store(slot_operand(slot), 0);
+      if (wanted)
+        store_result(0);
+    } else if (ArrayAssignmentStatementNode *assignment =
+                   dynamic_cast<ArrayAssignmentStatementNode *>(statement)) {
+      // The index is checked before the value is evaluated.
+      gen_expression(assignment->index_expression, 0);
+      element_offset(assignment->array, 0);
+      bytes({0x48, 0x89, 0xC2}); // mov rdx, rax
+      gen_expression(assignment->assignment_expr, 0);
+      mov_rcx(assignment->array->elements);
+      sse_element(sseStore, 0, 2);
+      if (wanted)
+        store_result(0);
+    } else if (WriteStatementNode *write =
+                   dynamic_cast<WriteStatementNode *>(statement)) {
+      if (write->element) {
+        gen_factor(write->element, 0);
+        call((const void *)jit_write_number);
+      } else if (write->frame_slot >= 0 || write->is_identifier) {
+        load(0, slot_operand(variable(write->frame_slot, write->write_text)));
+        call((const void *)jit_write_number);
+      } else {
+        mov_rdi(&write->write_text);
+        call((const void *)jit_write_text);
+      }
+      if (wanted)
+        store_zero_result();
+    } else if (ReadStatementNode *read =
+                   dynamic_cast<ReadStatementNode *>(statement)) {
+      int slot = variable(read->frame_slot, read->read_text);
+      store_variables();
+      bytes({0x48, 0x8D, 0xBB}); // lea rdi, [rbx + offset]
+      dword(slot_operand(slot).offset);
+      mov_rax((const void *)jit_read);
+      bytes({0xFF, 0xD0}); // call rax
+      load_variables();
+      bytes({0x85, 0xC0}); // test eax, eax
+      jump(ccNE, runtimeLabel);
+      if (wanted) {
+        load(0, slot_operand(slot));
+        store_result(0);
+      }
+    } else if (IfStatementNode *branch =
+                   dynamic_cast<IfStatementNode *>(statement)) {
+      int otherwise = new_label(), done = new_label();
+      if (branch->has_else && pgo_count(branch->else_statement) >
+                                  pgo_count(branch->then_statement)) {
+        // The profile shows the ELSE branch runs more often, so it is the
+        // one that falls through.
+        int taken = otherwise;
+        gen_taken(branch->if_expression, taken, branch->integer_condition);
+        gen_statement(branch->else_statement, wanted);
+        jump(always, done);
+        bind(taken);
+        gen_statement(branch->then_statement, wanted);
+      } else {
+        gen_condition(branch->if_expression, otherwise, false,
+                      branch->integer_condition);
+        gen_statement(branch->then_statement, wanted);
+        jump(always, done);
+        bind(otherwise);
+        if (branch->has_else)
+          gen_statement(branch->else_statement, wanted);
+        else if (wanted)
+          store_zero_result();
+      }
+      bind(done);
+    } else if (WhileStatementNode *loop =
+                   dynamic_cast<WhileStatementNode *>(statement)) {
+      JitLoop labels = {new_label(), new_label()};
+      if (wanted)
+        store_zero_result();
+      bind(labels.continue_label);
+      gen_condition(loop->while_expression, labels.exit_label, true, false);
+      loops.push_back(labels);
+      gen_statement(loop->while_statement, wanted);
+      loops.pop_back();
+      jump(always, labels.continue_label);
+      bind(labels.exit_label);
+    } else if (ForStatementNode *loop =
+                   dynamic_cast<ForStatementNode *>(statement)) {
+      gen_for(loop, wanted);
+    } else if (LoopExitStatementNode *exit =
+                   dynamic_cast<LoopExitStatementNode *>(statement)) {
+      if (wanted)
+        store_zero_result();
+      if (loops.empty()) {
+        unsupported("BREAK or CONTINUE outside a loop");
+        return;
+      }
+      jump(always, exit->exit_token == TOK_BREAK ? loops.back().exit_label
+                                                 : loops.back().continue_label);
+    } else if (CallStatementNode *call =
+                   dynamic_cast<CallStatementNode *>(statement)) {
+      store_variables();
+      mov_rdi(call);
+      bytes({0x48, 0xBE}); // mov rsi, &slots
+      qword((uint64_t)&slots);
+      bytes({0x48, 0x89, 0xDA}); // mov rdx, rbx
+      if (wanted) {
+        bytes({0x48, 0x8D, 0x8B}); // lea rcx, [rbx + result]
+        dword(resultOffset);
+      } else {
+        bytes({0x31, 0xC9}); // xor ecx, ecx
+      }
+      mov_rax((const void *)jit_call);
+      bytes({0xFF, 0xD0}); // call rax
+      load_variables();
+      bytes({0x85, 0xC0}); // test eax, eax
+      jump(ccNE, runtimeLabel);
+    } else {
+      unsupported("unknown statement");
+    }
+  }
+
+  // Trips are counted down in r13-r15 or in the data block, and the value
+  // is kept apart from the counter, which the body may change.
+  void gen_for(ForStatementNode *loop, bool wanted) {
+    JitLoop labels = {new_label(), new_label()};
+    int top = new_label();
+    JitOperand counter = slot_operand(variable(loop->frame_slot,
+                                               loop->identifier));
+    JitOperand value = slot_operand(for_value(loop));
+    int trips = forDepth < tripRegisters ? -1 : allocate(8, 8);
+
+    gen_expression(loop->start_expression, 0);
+    store(value, 0);
+    check_depth(1);
+    gen_expression(loop->end_expression, 1);
+    bytes({0xBF}); // mov edi, is_downto
+    dword(loop->is_downto);
+    call((const void *)for_trip_count);
+    if (trips < 0) {
+      bytes({0x49, 0x89, 0xC5 + forDepth}); // mov r13+depth, rax
+    } else {
+      bytes({0x48, 0x89, 0x83}); // mov [rbx + trips], rax
+      dword(trips);
+    }
+    if (wanted)
+      store_zero_result();
+    bytes({0x48, 0x85, 0xC0}); // test rax, rax
+    jump(ccLE, labels.exit_label);
+
+    bind(top);
+    if (counter.reg >= 0) {
+      load(counter.reg, value);
+    } else {
+      load(0, value);
+      store(counter, 0);
+    }
+    loops.push_back(labels);
+    forDepth++;
+    gen_statement(loop->for_statement, wanted);
+    forDepth--;
+    loops.pop_back();
+
+    bind(labels.continue_label);
+    int step = float_constant(loop->is_downto ? -1.0 : 1.0);
+    if (value.reg >= 0) {
+      sse_memory(single, sseAdd, value.reg, step);
+    } else {
+      load(0, value);
+      sse_memory(single, sseAdd, 0, step);
+      store(value, 0);
+    }
+    if (trips < 0) {
+      bytes({0x49, 0xFF, 0xCD + forDepth}); // dec r13+depth
+    } else {
+      bytes({0x48, 0x83, 0xAB}); // sub qword [rbx + trips], 1
+      dword(trips);
+      byte(1);
+    }
+    jump(ccG, top);
+    bind(labels.exit_label);
+  }
+
+  bool compile(ProgramNode *root) {
+    if ((size_t)root->frame_size > callStack.size()) {
+      unsupported("frame larger than the call stack");
+      return false;
+    }
+    resultOffset = allocate(sizeof(float), sizeof(float));
+    countOffset = allocate(8, 8);
+    StatementNode *body = root->program_block->compound_stmt;
+    weigh(body, 1.0);
+    if (!reason.empty())
+      return false;
+    assign_registers();
+
+    boundsLabel = new_label();
+    runtimeLabel = new_label();
+    int exit = new_label();
+    bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+    bytes({0x48, 0x89, 0xFB});       // mov rbx, rdi
+    bytes({0x45, 0x31, 0xE4});       // xor r12d, r12d
+    load_variables();
+
+    gen_statement(body, true);
+    bytes({0x31, 0xC0}); // xor eax, eax
+    jump(always, exit);
+    bind(boundsLabel);
+    byte(0xB8);
+    dword(jitBoundsError);
+    jump(always, exit);
+    bind(runtimeLabel);
+    byte(0xB8);
+    dword(jitRuntimeError);
+
+    bind(exit);
+    store_variables();
+    bytes({0x4C, 0x89, 0xA3}); // mov [rbx + count], r12
+    dword(countOffset);
+    bytes({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+    bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3});
+
+    for (auto it = jumps.begin(); it != jumps.end(); ++it) {
+      int32_t distance = labels[it->second] - (long)(it->first + 4);
+      memcpy(&code[it->first], &distance, sizeof distance);
+    }
+    return reason.empty();
+  }
+};
+
+bool jit_run(ProgramNode *root, float &result, std::string &reason) {
+  JitCompiler compiler;
+  if (!compiler.compile(root)) {
+    reason = compiler.reason;
+    return false;
+  }
+
+  size_t size = compiler.code.size();
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    reason = std::string("cannot map code: ") + strerror(errno);
+    return false;
+  }
+  memcpy(memory, compiler.code.data(), size);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    reason = std::string("cannot make code executable: ") + strerror(errno);
+    munmap(memory, size);
+    return false;
+  }
+
+  framePointer = 0;
+  stackTop = root->frame_size;
+  std::vector<char> block = compiler.data;
+  for (auto it = compiler.slots.begin(); it != compiler.slots.end(); ++it)
+    if (it->home)
+      memcpy(&block[it->offset], it->home, sizeof(float));
+
+  jitError = nullptr;
+  int (*program)(char *) = (int (*)(char *))memory;
+  int status = program(block.data());
+  munmap(memory, size);
+
+  for (auto it = compiler.slots.begin(); it != compiler.slots.end(); ++it)
+    if (it->home)
+      memcpy(it->home, &block[it->offset], sizeof(float));
+  uint64_t count;
+  memcpy(&count, &block[compiler.countOffset], sizeof count);
+  statementsExecuted += count;
+  memcpy(&result, &block[compiler.resultOffset], sizeof result);
+
+  if (status == jitBoundsError)
+    throw("Array access failed: index out of bounds");
+  if (status == jitRuntimeError)
+    throw jitError;
+  return true;
+}
+#else
+bool jit_run(ProgramNode *root, float &result, std::string &reason) {
+  reason = "the JIT needs x86-64";
+  return false;
+}
+#endif
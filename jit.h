@@ -0,0 +1,19 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "parse_tree_nodes.h"
+#include <string>
+
+// Native x86-64 code for the main program (--jit). The most used variables
+// and the FOR loop counters live in SSE registers, and the code calls back
+// into the runtime only for READ and WRITE, and into the interpreter for
+// calls of procedures that were not inlined.
+//
+// Returns false before anything has run, with the reason in reason, when the
+// program uses something the compiler does not handle (expressions nested
+// too deeply, or a machine other than x86-64); the caller then interprets
+// it. Otherwise runs the program and sets result to what root->interpret()
+// returns. Runtime errors are thrown as the interpreter throws them.
+bool jit_run(ProgramNode *root, float &result, std::string &reason);
+
+#endif /* JIT_H */
@@ -17,6 +17,12 @@
 #define TOK_VAR 1014
 #define TOK_WHILE 1015
 #define TOK_WRITE 1016
+#define TOK_DO 1017
+#define TOK_PROCEDURE 1018
+#define TOK_ARRAY 1019
+#define TOK_OF 1020
+#define TOK_COBEGIN 1021
+#define TOK_COEND 1022
 
 #define TOK_INTEGER 1100
 #define TOK_REAL 1101
@@ -25,6 +31,10 @@
 #define TOK_COLON 2001
 #define TOK_OPENPAREN 2002
 #define TOK_CLOSEPAREN 2003
+#define TOK_COMMA 2004
+#define TOK_OPENBRACKET 2005
+#define TOK_CLOSEBRACKET 2006
+#define TOK_DOTDOT 2007
 
 #define TOK_PLUS 3000
 #define TOK_MINUS 3001
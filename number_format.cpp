@@ -0,0 +1,144 @@
+#include "number_format.h"
+#include <cmath>
+#include <cstdio>
+#include <stdint.h>
+
+// Powers of ten that doubles hold exactly.
+static const double exactPowers[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+static const int maxExactPower = 22;
+
+// Significant digits of the default stream precision.
+static const int generalDigits = 6;
+
+static size_t write_digits(uint64_t number, char *text) {
+  char reversed[24];
+  size_t count = 0;
+  do {
+    reversed[count++] = '0' + number % 10;
+    number /= 10;
+  } while (number != 0);
+  for (size_t i = 0; i < count; i++)
+    text[i] = reversed[count - 1 - i];
+  return count;
+}
+
+// value * 10^power with one rounding, or false when 10^power is not exact.
+static bool scale(double value, int power, double &scaled) {
+  if (power >= 0 && power <= maxExactPower)
+    scaled = value * exactPowers[power];
+  else if (power < 0 && -power <= maxExactPower)
+    scaled = value / exactPowers[-power];
+  else
+    return false;
+  return true;
+}
+
+static size_t format_with_printf(const char *format, float value, char *text) {
+  int length = snprintf(text, numberTextSize, format, (double)value);
+  return length < 0 ? 0 : length;
+}
+
+size_t format_number(float value, char *text) {
+  double magnitude = std::fabs((double)value);
+  if (!std::isfinite(magnitude) || (magnitude != 0.0 && magnitude < 1e-22) ||
+      magnitude >= 1e22)
+    return format_with_printf("%g", value, text);
+
+  size_t length = 0;
+  if (std::signbit(value))
+    text[length++] = '-';
+  if (magnitude == 0.0) {
+    text[length++] = '0';
+    text[length] = '\0';
+    return length;
+  }
+
+  // The six digits are round(magnitude / 10^(exponent - 5)). The scaled
+  // value is within about 1e-10 of the exact one, so unless it lies that
+  // close to a tie it rounds the same way printf does.
+  int exponent = (int)std::floor(std::log10(magnitude));
+  double scaled = 0.0;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!scale(magnitude, generalDigits - 1 - exponent, scaled))
+      return format_with_printf("%g", value, text);
+    if (scaled < 1e5)
+      exponent--;
+    else if (scaled >= 1e6)
+      exponent++;
+    else
+      break;
+  }
+  double whole = std::floor(scaled);
+  double fraction = scaled - whole;
+  if (std::fabs(fraction - 0.5) < 1e-6 || whole < 1e5 || whole >= 1e6)
+    return format_with_printf("%g", value, text);
+  uint64_t digits = (uint64_t)whole + (fraction > 0.5 ? 1 : 0);
+  if (digits == 1000000) {
+    digits = 100000;
+    exponent++;
+  }
+
+  char six[generalDigits];
+  write_digits(digits, six);
+  int significant = generalDigits;
+  while (significant > 1 && six[significant - 1] == '0')
+    significant--;
+
+  if (exponent >= -4 && exponent < generalDigits) {
+    if (exponent < 0) {
+      text[length++] = '0';
+      text[length++] = '.';
+      for (int i = -1; i > exponent; i--)
+        text[length++] = '0';
+      for (int i = 0; i < significant; i++)
+        text[length++] = six[i];
+    } else {
+      for (int i = 0; i <= exponent; i++)
+        text[length++] = six[i];
+      if (significant > exponent + 1) {
+        text[length++] = '.';
+        for (int i = exponent + 1; i < significant; i++)
+          text[length++] = six[i];
+      }
+    }
+  } else {
+    text[length++] = six[0];
+    if (significant > 1) {
+      text[length++] = '.';
+      for (int i = 1; i < significant; i++)
+        text[length++] = six[i];
+    }
+    text[length++] = 'e';
+    text[length++] = exponent < 0 ? '-' : '+';
+    int shown = exponent < 0 ? -exponent : exponent;
+    if (shown < 10)
+      text[length++] = '0';
+    length += write_digits(shown, text + length);
+  }
+  text[length] = '\0';
+  return length;
+}
+
+// A float times 10^6 fits a double exactly while it is below 2^53, so the
+// six decimals round exactly as printf rounds them.
+size_t format_fixed(float value, char *text) {
+  double magnitude = std::fabs((double)value);
+  if (!(magnitude < 9e9))
+    return format_with_printf("%f", value, text);
+
+  double micros = std::nearbyint(magnitude * 1e6);
+  uint64_t units = (uint64_t)micros;
+  size_t length = 0;
+  if (std::signbit(value))
+    text[length++] = '-';
+  length += write_digits(units / 1000000, text + length);
+  text[length++] = '.';
+  char decimals[8];
+  write_digits(units % 1000000 + 1000000, decimals);
+  for (int i = 1; i <= 6; i++)
+    text[length++] = decimals[i];
+  text[length] = '\0';
+  return length;
+}
@@ -0,0 +1,17 @@
+#ifndef NUMBER_FORMAT_H
+#define NUMBER_FORMAT_H
+
+#include <cstddef>
+
+// Room for any float written by the functions below, with the terminator.
+const size_t numberTextSize = 64;
+
+// Writes value the way std::ostream << value does with default flags
+// ("%.6g" in the C locale) and returns the length. Values whose rounding
+// cannot be settled in double arithmetic go through snprintf.
+size_t format_number(float value, char *text);
+
+// Writes value as std::to_string(value) does ("%f").
+size_t format_fixed(float value, char *text);
+
+#endif /* NUMBER_FORMAT_H */
@@ -0,0 +1,1260 @@
+#define EPSILON 0.001
+
+#include "optimizer.h"
+#include "closed_form.h"
+#include "parallel.h"
+#include "parser.h"
+#include "pgo.h"
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <sstream>
+
+std::vector<std::string> optimizerReport;
+
+// Variables a statement or expression may read and write. Frame slots are
+// those of the frame being optimized; procedures called have their own
+// frames, but may use any global.
+struct Effects {
+  std::set<Scalar> reads;
+  std::set<Scalar> writes;
+  std::set<ProcedureNode *> callees;
+};
+
+// The frame being optimized: the main program's or a procedure's. Moved
+// computations are kept in slots added to it.
+static int *frameSlots = nullptr;
+static int temporaries = 0;
+// Set for the body of a recursive procedure, whose frame must not grow:
+// every call nested in it takes another, and a larger one runs out of the
+// call stack at a smaller depth.
+static bool fixedFrame = false;
+
+// While moving computations out of a WHILE loop: what the loop changes, and
+// the assignments to run before it.
+static const Effects *loopEffects = nullptr;
+static int loopLine = 0;
+static std::vector<StatementNode *> preheader;
+
+static std::set<Scalar> frameReads;
+static std::set<Scalar> globalReads;
+static bool globalsLive = false;
+
+static Scalar variable(const std::string &name, int frame_slot) {
+  return frame_slot >= 0 ? Scalar("", frame_slot) : Scalar(name, -1);
+}
+
+static void report(int line, const std::string &what) {
+  optimizerReport.push_back("line " + std::to_string(line) + ": " + what);
+}
+
+// Below these iterations per run in the --pgo-use profile, moving
+// computations out of a WHILE loop, or computing it in closed form, costs
+// more than it saves.
+static const double hoistTrips = 1.0;
+static const double closedFormTrips = 4.0;
+
+static std::string trips_text(double trips) {
+  std::ostringstream os;
+  os << trips;
+  return os.str();
+}
+
+// Set while text() gives keys that tell computations apart: frame slots
+// with the names, and numbers in full.
+static bool exactText = false;
+
+static std::string text(ExpressionNode *expression);
+
+static std::string number(float value) {
+  std::ostringstream os;
+  if (exactText)
+    os << std::hexfloat;
+  os << value;
+  return os.str();
+}
+
+// The source form of an expression, for the report.
+static std::string text(FactorNode *factor) {
+  if (FloatFactorNode *literal = dynamic_cast<FloatFactorNode *>(factor))
+    return number(literal->float_literal);
+  if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(factor))
+    return literal->int_literal;
+  if (ConstantFactorNode *constant = dynamic_cast<ConstantFactorNode *>(factor))
+    return constant->constant_name.empty() ? number(constant->constant_value)
+                                           : constant->constant_name;
+  if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor))
+    return exactText ? id->identifier + "@" + std::to_string(id->frame_slot)
+                     : id->identifier;
+  if (ArrayFactorNode *element = dynamic_cast<ArrayFactorNode *>(factor))
+    return element->array->name + "[" + text(element->index_expression) + "]";
+  if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor))
+    return "-" + text(minus->child_factor);
+  if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor))
+    return "NOT " + text(negation->child_factor);
+  if (ExpressionFactorNode *nested =
+          dynamic_cast<ExpressionFactorNode *>(factor))
+    return "(" + text(nested->child_expression) + ")";
+  return "?";
+}
+
+// Only the first count operations, if given.
+static std::string text(TermNode *term, size_t count = SIZE_MAX) {
+  std::string result = text(term->first_factor);
+  for (size_t i = 0; i < term->following_operators.size() && i < count; i++) {
+    int op = term->following_operators[i];
+    result += op == TOK_MULTIPLY ? " * " : op == TOK_DIVIDE ? " / " : " AND ";
+    result += text(term->following_factors[i]);
+  }
+  return result;
+}
+
+static std::string text(SimpleExpressionNode *simple_exp,
+                        size_t count = SIZE_MAX) {
+  std::string result = text(simple_exp->first_term);
+  for (size_t i = 0; i < simple_exp->following_operators.size() && i < count;
+       i++) {
+    int op = simple_exp->following_operators[i];
+    result += op == TOK_PLUS ? " + " : op == TOK_MINUS ? " - " : " OR ";
+    result += text(simple_exp->following_terms[i]);
+  }
+  return result;
+}
+
+static std::string text(ExpressionNode *expression) {
+  std::string result = text(expression->first_simple_exp);
+  switch (expression->simple_exp_operator) {
+  case TOK_LESSTHAN:
+    return result + " < " + text(expression->second_simple_exp);
+  case TOK_GREATERTHAN:
+    return result + " > " + text(expression->second_simple_exp);
+  case TOK_EQUALTO:
+    return result + " = " + text(expression->second_simple_exp);
+  case TOK_NOTEQUALTO:
+    return result + " <> " + text(expression->second_simple_exp);
+  default:
+    return result;
+  }
+}
+
+static void effects(ExpressionNode *expression, Effects &into);
+
+static void effects(FactorNode *factor, Effects &into) {
+  if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor))
+    into.reads.insert(variable(id->identifier, id->frame_slot));
+  else if (ArrayFactorNode *element = dynamic_cast<ArrayFactorNode *>(factor))
+    effects(element->index_expression, into);
+  else if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor))
+    effects(minus->child_factor, into);
+  else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor))
+    effects(negation->child_factor, into);
+  else if (ExpressionFactorNode *nested =
+               dynamic_cast<ExpressionFactorNode *>(factor))
+    effects(nested->child_expression, into);
+}
+
+static void effects(TermNode *term, Effects &into) {
+  effects(term->first_factor, into);
+  for (auto it = term->following_factors.begin();
+       it != term->following_factors.end(); ++it)
+    effects(*it, into);
+}
+
+static void effects(SimpleExpressionNode *simple_exp, Effects &into) {
+  effects(simple_exp->first_term, into);
+  for (auto it = simple_exp->following_terms.begin();
+       it != simple_exp->following_terms.end(); ++it)
+    effects(*it, into);
+}
+
+static void effects(ExpressionNode *expression, Effects &into) {
+  effects(expression->first_simple_exp, into);
+  if (expression->second_simple_exp)
+    effects(expression->second_simple_exp, into);
+}
+
+static void effects(StatementNode *statement, Effects &into) {
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      effects(*it, into);
+  } else if (AssignmentStatementNode *assignment =
+                 dynamic_cast<AssignmentStatementNode *>(statement)) {
+    into.writes.insert(variable(assignment->identifier, assignment->frame_slot));
+    effects(assignment->assignment_expr, into);
+  } else if (ArrayAssignmentStatementNode *assignment =
+                 dynamic_cast<ArrayAssignmentStatementNode *>(statement)) {
+    effects(assignment->index_expression, into);
+    effects(assignment->assignment_expr, into);
+  } else if (ReadStatementNode *read =
+                 dynamic_cast<ReadStatementNode *>(statement)) {
+    into.writes.insert(variable(read->read_text, read->frame_slot));
+  } else if (WriteStatementNode *write =
+                 dynamic_cast<WriteStatementNode *>(statement)) {
+    if (write->element)
+      effects(write->element, into);
+    else if (write->frame_slot >= 0 || write->is_identifier)
+      into.reads.insert(variable(write->write_text, write->frame_slot));
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    effects(if_stmt->if_expression, into);
+    effects(if_stmt->then_statement, into);
+    if (if_stmt->has_else)
+      effects(if_stmt->else_statement, into);
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    effects(loop->while_expression, into);
+    effects(loop->while_statement, into);
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    into.writes.insert(variable(loop->identifier, loop->frame_slot));
+    effects(loop->start_expression, into);
+    effects(loop->end_expression, into);
+    effects(loop->for_statement, into);
+  } else if (CallStatementNode *call =
+                 dynamic_cast<CallStatementNode *>(statement)) {
+    into.callees.insert(call->procedure);
+    for (auto it = call->arguments.begin(); it != call->arguments.end(); ++it)
+      effects(*it, into);
+  }
+}
+
+// True when the value of variable may come from before the loop no longer
+// holds inside it.
+static bool changed_in_loop(const Scalar &variable) {
+  return loopEffects->writes.count(variable) ||
+         (variable.second < 0 && !loopEffects->callees.empty());
+}
+
+// Invariant parts read only variables the loop leaves alone, no array
+// elements, whose index could be out of bounds, and no literals too large
+// for a float: computing them before the loop, even when it does not run,
+// can neither fail nor give another value.
+static bool invariant(ExpressionNode *expression);
+
+static bool invariant(FactorNode *factor) {
+  if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(factor)) {
+    try {
+      std::stof(literal->int_literal);
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+  if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor))
+    return !changed_in_loop(variable(id->identifier, id->frame_slot));
+  if (dynamic_cast<ArrayFactorNode *>(factor))
+    return false;
+  if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor))
+    return invariant(minus->child_factor);
+  if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor))
+    return invariant(negation->child_factor);
+  if (ExpressionFactorNode *nested =
+          dynamic_cast<ExpressionFactorNode *>(factor))
+    return invariant(nested->child_expression);
+  return true;
+}
+
+static bool invariant(TermNode *term) {
+  if (!invariant(term->first_factor))
+    return false;
+  for (auto it = term->following_factors.begin();
+       it != term->following_factors.end(); ++it)
+    if (!invariant(*it))
+      return false;
+  return true;
+}
+
+static bool invariant(SimpleExpressionNode *simple_exp) {
+  if (!invariant(simple_exp->first_term))
+    return false;
+  for (auto it = simple_exp->following_terms.begin();
+       it != simple_exp->following_terms.end(); ++it)
+    if (!invariant(*it))
+      return false;
+  return true;
+}
+
+static bool invariant(ExpressionNode *expression) {
+  return invariant(expression->first_simple_exp) &&
+         (!expression->second_simple_exp ||
+          invariant(expression->second_simple_exp));
+}
+
+// Whether there is anything to compute, rather than a variable or constant
+// to fetch.
+static bool computes(ExpressionNode *expression);
+
+static bool computes(FactorNode *factor) {
+  if (dynamic_cast<MinusFactorNode *>(factor) ||
+      dynamic_cast<NotFactorNode *>(factor))
+    return true;
+  if (ExpressionFactorNode *nested =
+          dynamic_cast<ExpressionFactorNode *>(factor))
+    return computes(nested->child_expression);
+  return false;
+}
+
+static bool computes(TermNode *term) {
+  return !term->following_factors.empty() || computes(term->first_factor);
+}
+
+static bool computes(SimpleExpressionNode *simple_exp) {
+  return !simple_exp->following_terms.empty() ||
+         computes(simple_exp->first_term);
+}
+
+static bool computes(ExpressionNode *expression) {
+  return expression->simple_exp_operator != TOK_UNKNOWN ||
+         computes(expression->first_simple_exp);
+}
+
+static TermNode *term_of(FactorNode *factor, int level) {
+  TermNode *term = new TermNode(level);
+  term->first_factor = factor;
+  return term;
+}
+
+static SimpleExpressionNode *simple_of(TermNode *term, int level) {
+  SimpleExpressionNode *simple_exp = new SimpleExpressionNode(level);
+  simple_exp->first_term = term;
+  return simple_exp;
+}
+
+static ExpressionNode *expression_of(SimpleExpressionNode *simple_exp,
+                                     int level, int line) {
+  ExpressionNode *expression = new ExpressionNode(level);
+  expression->line = line;
+  expression->first_simple_exp = simple_exp;
+  return expression;
+}
+
+// A computation that can be taken out of an expression: a factor, the first
+// count operations of a term or simple expression, or a whole expression.
+// Operators group from the left, so only leading operands form a part that
+// is computed on its own.
+struct Part {
+  FactorNode **factor = nullptr;
+  TermNode *term = nullptr;
+  SimpleExpressionNode *simple_exp = nullptr;
+  ExpressionNode *expression = nullptr;
+  size_t count = 0;
+};
+
+static Part factor_part(FactorNode *&factor) {
+  Part part;
+  part.factor = &factor;
+  return part;
+}
+
+static Part term_part(TermNode *term, size_t count) {
+  Part part;
+  part.term = term;
+  part.count = count;
+  return part;
+}
+
+static Part simple_part(SimpleExpressionNode *simple_exp, size_t count) {
+  Part part;
+  part.simple_exp = simple_exp;
+  part.count = count;
+  return part;
+}
+
+static Part expression_part(ExpressionNode *expression) {
+  Part part;
+  part.expression = expression;
+  return part;
+}
+
+static std::string text(const Part &part) {
+  if (part.factor)
+    return text(*part.factor);
+  if (part.term)
+    return text(part.term, part.count);
+  if (part.simple_exp)
+    return text(part.simple_exp, part.count);
+  return text(part.expression);
+}
+
+static std::string key(const Part &part) {
+  exactText = true;
+  std::string result = text(part);
+  exactText = false;
+  return result;
+}
+
+// Takes part out of its expression, leaving factor in its place, and
+// returns it as an expression of its own.
+static ExpressionNode *take(const Part &part, FactorNode *factor, int line) {
+  if (part.factor) {
+    int level = (*part.factor)->_level;
+    ExpressionNode *value = expression_of(
+        simple_of(term_of(*part.factor, level), level), level, line);
+    *part.factor = factor;
+    return value;
+  }
+  if (TermNode *term = part.term) {
+    int level = term->_level;
+    size_t count = part.count;
+    TermNode *prefix = new TermNode(level);
+    prefix->first_factor = term->first_factor;
+    prefix->following_operators.assign(term->following_operators.begin(),
+                                       term->following_operators.begin() +
+                                           count);
+    prefix->following_factors.assign(term->following_factors.begin(),
+                                     term->following_factors.begin() + count);
+    term->following_operators.erase(term->following_operators.begin(),
+                                    term->following_operators.begin() + count);
+    term->following_factors.erase(term->following_factors.begin(),
+                                  term->following_factors.begin() + count);
+    term->first_factor = factor;
+    return expression_of(simple_of(prefix, level), level, line);
+  }
+  if (SimpleExpressionNode *simple_exp = part.simple_exp) {
+    int level = simple_exp->_level;
+    size_t count = part.count;
+    SimpleExpressionNode *prefix = new SimpleExpressionNode(level);
+    prefix->first_term = simple_exp->first_term;
+    prefix->following_operators.assign(
+        simple_exp->following_operators.begin(),
+        simple_exp->following_operators.begin() + count);
+    prefix->following_terms.assign(simple_exp->following_terms.begin(),
+                                   simple_exp->following_terms.begin() +
+                                       count);
+    simple_exp->following_operators.erase(
+        simple_exp->following_operators.begin(),
+        simple_exp->following_operators.begin() + count);
+    simple_exp->following_terms.erase(simple_exp->following_terms.begin(),
+                                      simple_exp->following_terms.begin() +
+                                          count);
+    simple_exp->first_term = term_of(factor, level + 1);
+    return expression_of(prefix, level, line);
+  }
+  ExpressionNode *expression = part.expression;
+  int level = expression->_level;
+  ExpressionNode *value = new ExpressionNode(level);
+  value->line = line;
+  value->simple_exp_operator = expression->simple_exp_operator;
+  value->first_simple_exp = expression->first_simple_exp;
+  value->second_simple_exp = expression->second_simple_exp;
+  expression->simple_exp_operator = TOK_UNKNOWN;
+  expression->second_simple_exp = nullptr;
+  expression->first_simple_exp =
+      simple_of(term_of(factor, level + 2), level + 1);
+  return value;
+}
+
+// Gives id a new frame slot, named $1, $2, ... in the tree.
+static void new_temporary(IdFactorNode *id) {
+  id->frame_slot = (*frameSlots)++;
+  id->identifier = "$" + std::to_string(++temporaries);
+}
+
+static AssignmentStatementNode *store(IdFactorNode *id, ExpressionNode *value,
+                                      int level, int line) {
+  AssignmentStatementNode *assignment = new AssignmentStatementNode(level);
+  assignment->line = line;
+  assignment->identifier = id->identifier;
+  assignment->frame_slot = id->frame_slot;
+  assignment->assignment_expr = value;
+  return assignment;
+}
+
+// Computes part before the loop, into a new frame slot read in its place;
+// the same computation moved twice shares the slot.
+static void hoist(const Part &part, int level) {
+  std::string part_key = key(part);
+  IdFactorNode *id = new IdFactorNode(level, "");
+  ExpressionNode *value = take(part, id, loopLine);
+  for (auto it = preheader.begin(); it != preheader.end(); ++it) {
+    AssignmentStatementNode *earlier =
+        static_cast<AssignmentStatementNode *>(*it);
+    if (key(expression_part(earlier->assignment_expr)) == part_key) {
+      id->identifier = earlier->identifier;
+      id->frame_slot = earlier->frame_slot;
+      delete value;
+      return;
+    }
+  }
+  new_temporary(id);
+  report(loopLine, "moved " + text(value) + " out of the WHILE loop");
+  preheader.push_back(store(id, value, level, loopLine));
+}
+
+static void hoist_in(ExpressionNode *expression);
+
+static void hoist_in(FactorNode *&factor) {
+  if (computes(factor) && invariant(factor)) {
+    hoist(factor_part(factor), factor->_level);
+  } else if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor)) {
+    hoist_in(minus->child_factor);
+  } else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor)) {
+    hoist_in(negation->child_factor);
+  } else if (ExpressionFactorNode *nested =
+                 dynamic_cast<ExpressionFactorNode *>(factor)) {
+    hoist_in(nested->child_expression);
+  } else if (ArrayFactorNode *element =
+                 dynamic_cast<ArrayFactorNode *>(factor)) {
+    hoist_in(element->index_expression);
+  }
+}
+
+static void hoist_in(TermNode *term) {
+  size_t count = 0;
+  if (invariant(term->first_factor))
+    while (count < term->following_factors.size() &&
+           invariant(term->following_factors[count]))
+      count++;
+  if (count > 0)
+    hoist(term_part(term, count), term->_level + 1);
+  hoist_in(term->first_factor);
+  for (size_t i = 0; i < term->following_factors.size(); i++)
+    hoist_in(term->following_factors[i]);
+}
+
+static void hoist_in(SimpleExpressionNode *simple_exp) {
+  size_t count = 0;
+  if (invariant(simple_exp->first_term))
+    while (count < simple_exp->following_terms.size() &&
+           invariant(simple_exp->following_terms[count]))
+      count++;
+  if (count > 0)
+    hoist(simple_part(simple_exp, count), simple_exp->_level + 2);
+  hoist_in(simple_exp->first_term);
+  for (auto it = simple_exp->following_terms.begin();
+       it != simple_exp->following_terms.end(); ++it)
+    hoist_in(*it);
+}
+
+static void hoist_in(ExpressionNode *expression) {
+  if (expression->simple_exp_operator != TOK_UNKNOWN &&
+      invariant(expression)) {
+    hoist(expression_part(expression), expression->_level + 3);
+    return;
+  }
+  hoist_in(expression->first_simple_exp);
+  if (expression->second_simple_exp)
+    hoist_in(expression->second_simple_exp);
+}
+
+static void hoist_in(StatementNode *statement) {
+  if (dynamic_cast<CobeginStatementNode *>(statement))
+    return;
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      hoist_in(*it);
+  } else if (AssignmentStatementNode *assignment =
+                 dynamic_cast<AssignmentStatementNode *>(statement)) {
+    hoist_in(assignment->assignment_expr);
+  } else if (ArrayAssignmentStatementNode *assignment =
+                 dynamic_cast<ArrayAssignmentStatementNode *>(statement)) {
+    hoist_in(assignment->index_expression);
+    hoist_in(assignment->assignment_expr);
+  } else if (WriteStatementNode *write =
+                 dynamic_cast<WriteStatementNode *>(statement)) {
+    if (write->element)
+      hoist_in(write->element);
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    hoist_in(if_stmt->if_expression);
+    hoist_in(if_stmt->then_statement);
+    if (if_stmt->has_else)
+      hoist_in(if_stmt->else_statement);
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    hoist_in(loop->while_expression);
+    hoist_in(loop->while_statement);
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    hoist_in(loop->start_expression);
+    hoist_in(loop->end_expression);
+    if (!loop->parallel)
+      hoist_in(loop->for_statement);
+  } else if (CallStatementNode *call =
+                 dynamic_cast<CallStatementNode *>(statement)) {
+    for (auto it = call->arguments.begin(); it != call->arguments.end(); ++it)
+      hoist_in(*it);
+  }
+}
+
+// Moves what the loop computes the same way on every iteration in front of
+// it; the loop becomes a compound statement that ends with it.
+static void hoist_invariants(StatementNode *&statement) {
+  WhileStatementNode *loop = static_cast<WhileStatementNode *>(statement);
+  Effects changed;
+  effects(loop->while_expression, changed);
+  effects(loop->while_statement, changed);
+  loopEffects = &changed;
+  loopLine = loop->line;
+  preheader.clear();
+  hoist_in(loop->while_expression);
+  hoist_in(loop->while_statement);
+  loopEffects = nullptr;
+  if (preheader.empty())
+    return;
+
+  CompoundStatementNode *block = new CompoundStatementNode(loop->_level);
+  block->line = loop->line;
+  block->has_loop_exit = loop->has_loop_exit;
+  block->statement_vector = preheader;
+  block->statement_vector.push_back(loop);
+  statement = block;
+}
+
+// The value of a condition made of a single constant.
+static bool constant_condition(ExpressionNode *expression, float &value) {
+  if (expression->simple_exp_operator != TOK_UNKNOWN)
+    return false;
+  SimpleExpressionNode *simple_exp = expression->first_simple_exp;
+  if (!simple_exp->following_terms.empty() ||
+      !simple_exp->first_term->following_factors.empty())
+    return false;
+  FactorNode *factor = simple_exp->first_term->first_factor;
+  if (!dynamic_cast<ConstantFactorNode *>(factor) &&
+      !dynamic_cast<IntFactorNode *>(factor) &&
+      !dynamic_cast<FloatFactorNode *>(factor))
+    return false;
+  try {
+    value = expression->interpret();
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+
+// Does nothing, with the value 0.0 a statement that did not run gives.
+static StatementNode *empty_statement(StatementNode *replaced) {
+  CompoundStatementNode *empty = new CompoundStatementNode(replaced->_level);
+  empty->line = replaced->line;
+  return empty;
+}
+
+static bool does_nothing(StatementNode *statement) {
+  CompoundStatementNode *compound =
+      dynamic_cast<CompoundStatementNode *>(statement);
+  return compound && !dynamic_cast<CobeginStatementNode *>(compound) &&
+         compound->statement_vector.empty();
+}
+
+// Removes branches that cannot run and optimizes WHILE loops, innermost
+// first.
+static void optimize(StatementNode *&statement) {
+  if (dynamic_cast<CobeginStatementNode *>(statement))
+    return;
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    std::vector<StatementNode *> &statements = compound->statement_vector;
+    for (size_t i = 0; i < statements.size(); i++)
+      optimize(statements[i]);
+    // The last statement gives the compound its value, even if empty.
+    for (size_t i = 0; i + 1 < statements.size(); i++)
+      if (does_nothing(statements[i])) {
+        delete statements[i];
+        statements.erase(statements.begin() + i--);
+      }
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    optimize(if_stmt->then_statement);
+    if (if_stmt->has_else)
+      optimize(if_stmt->else_statement);
+    float value = 0.0;
+    if (!constant_condition(if_stmt->if_expression, value))
+      return;
+    StatementNode *kept = nullptr;
+    if (value > EPSILON) {
+      report(if_stmt->line, if_stmt->has_else
+                                ? "IF condition is always true, removed the "
+                                  "ELSE branch"
+                                : "IF condition is always true, kept the "
+                                  "THEN branch alone");
+      std::swap(kept, if_stmt->then_statement);
+    } else if (if_stmt->has_else) {
+      report(if_stmt->line,
+             "IF condition is always false, removed the THEN branch");
+      std::swap(kept, if_stmt->else_statement);
+    } else {
+      report(if_stmt->line,
+             "IF condition is always false, removed the IF statement");
+      kept = empty_statement(if_stmt);
+    }
+    delete if_stmt;
+    statement = kept;
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    // Before the body is optimized, while its statements are those profiled.
+    double trips = pgo_trips(loop);
+    optimize(loop->while_statement);
+    float value = 0.0;
+    if (!constant_condition(loop->while_expression, value)) {
+      if (fixedFrame)
+        report(loop->line, "WHILE loop is in a recursive procedure, nothing "
+                           "moved out of it");
+      else if (trips < 0 || trips >= hoistTrips)
+        hoist_invariants(statement);
+      else
+        report(loop->line, "WHILE loop ran " + trips_text(trips) +
+                               " times a run in the profile, nothing moved "
+                               "out of it");
+    } else if (value != 1.0) {
+      report(loop->line, "WHILE condition is always false, removed the loop");
+      statement = empty_statement(loop);
+      delete loop;
+    }
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    if (!loop->parallel)
+      optimize(loop->for_statement);
+  }
+}
+
+// Whether evaluating the expression can fail: only an array index out of
+// bounds can.
+static bool can_fail(ExpressionNode *expression);
+
+static bool can_fail(FactorNode *factor) {
+  if (dynamic_cast<ArrayFactorNode *>(factor))
+    return true;
+  if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor))
+    return can_fail(minus->child_factor);
+  if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor))
+    return can_fail(negation->child_factor);
+  if (ExpressionFactorNode *nested =
+          dynamic_cast<ExpressionFactorNode *>(factor))
+    return can_fail(nested->child_expression);
+  return false;
+}
+
+static bool can_fail(TermNode *term) {
+  if (can_fail(term->first_factor))
+    return true;
+  for (auto it = term->following_factors.begin();
+       it != term->following_factors.end(); ++it)
+    if (can_fail(*it))
+      return true;
+  return false;
+}
+
+static bool can_fail(SimpleExpressionNode *simple_exp) {
+  if (can_fail(simple_exp->first_term))
+    return true;
+  for (auto it = simple_exp->following_terms.begin();
+       it != simple_exp->following_terms.end(); ++it)
+    if (can_fail(*it))
+      return true;
+  return false;
+}
+
+static bool can_fail(ExpressionNode *expression) {
+  return can_fail(expression->first_simple_exp) ||
+         (expression->second_simple_exp &&
+          can_fail(expression->second_simple_exp));
+}
+
+static bool can_fail(const Part &part) {
+  if (part.factor)
+    return can_fail(*part.factor);
+  if (TermNode *term = part.term) {
+    if (can_fail(term->first_factor))
+      return true;
+    for (size_t i = 0; i < part.count; i++)
+      if (can_fail(term->following_factors[i]))
+        return true;
+    return false;
+  }
+  if (SimpleExpressionNode *simple_exp = part.simple_exp) {
+    if (can_fail(simple_exp->first_term))
+      return true;
+    for (size_t i = 0; i < part.count; i++)
+      if (can_fail(simple_exp->following_terms[i]))
+        return true;
+    return false;
+  }
+  return can_fail(part.expression);
+}
+
+static void effects(const Part &part, Effects &into) {
+  if (part.factor) {
+    effects(*part.factor, into);
+  } else if (TermNode *term = part.term) {
+    effects(term->first_factor, into);
+    for (size_t i = 0; i < part.count; i++)
+      effects(term->following_factors[i], into);
+  } else if (SimpleExpressionNode *simple_exp = part.simple_exp) {
+    effects(simple_exp->first_term, into);
+    for (size_t i = 0; i < part.count; i++)
+      effects(simple_exp->following_terms[i], into);
+  } else {
+    effects(part.expression, into);
+  }
+}
+
+// Every part of an expression that computes something, outermost first.
+static void parts_in(ExpressionNode *expression, std::vector<Part> &into);
+
+static void parts_in(FactorNode *&factor, std::vector<Part> &into) {
+  if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor)) {
+    into.push_back(factor_part(factor));
+    parts_in(minus->child_factor, into);
+  } else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor)) {
+    into.push_back(factor_part(factor));
+    parts_in(negation->child_factor, into);
+  } else if (ExpressionFactorNode *nested =
+                 dynamic_cast<ExpressionFactorNode *>(factor)) {
+    parts_in(nested->child_expression, into);
+  } else if (ArrayFactorNode *element =
+                 dynamic_cast<ArrayFactorNode *>(factor)) {
+    parts_in(element->index_expression, into);
+  }
+}
+
+static void parts_in(TermNode *term, std::vector<Part> &into) {
+  for (size_t count = term->following_factors.size(); count > 0; count--)
+    into.push_back(term_part(term, count));
+  parts_in(term->first_factor, into);
+  for (size_t i = 0; i < term->following_factors.size(); i++)
+    parts_in(term->following_factors[i], into);
+}
+
+static void parts_in(SimpleExpressionNode *simple_exp,
+                     std::vector<Part> &into) {
+  for (size_t count = simple_exp->following_terms.size(); count > 0; count--)
+    into.push_back(simple_part(simple_exp, count));
+  parts_in(simple_exp->first_term, into);
+  for (auto it = simple_exp->following_terms.begin();
+       it != simple_exp->following_terms.end(); ++it)
+    parts_in(*it, into);
+}
+
+static void parts_in(ExpressionNode *expression, std::vector<Part> &into) {
+  if (expression->simple_exp_operator != TOK_UNKNOWN)
+    into.push_back(expression_part(expression));
+  parts_in(expression->first_simple_exp, into);
+  if (expression->second_simple_exp)
+    parts_in(expression->second_simple_exp, into);
+}
+
+// A computation made more than once in a row of statements.
+struct CommonValue {
+  std::vector<Part> uses;
+  std::set<Scalar> reads;
+  size_t first = 0; // statement of the first use
+};
+
+// Computes the largest computation repeated within a run of assignments and
+// WRITE statements, with none of its variables assigned in between, once
+// into a new frame slot before its first use. Parts that read array
+// elements are left, since their index may be out of bounds. Returns false
+// when there is none.
+static bool share_common_value(std::vector<StatementNode *> &statements) {
+  std::vector<CommonValue> values;
+  std::map<std::string, size_t> current;
+  size_t best = SIZE_MAX;
+  size_t best_length = 0;
+  for (size_t i = 0; i < statements.size(); i++) {
+    std::vector<Part> parts;
+    AssignmentStatementNode *assignment =
+        dynamic_cast<AssignmentStatementNode *>(statements[i]);
+    if (assignment) {
+      parts_in(assignment->assignment_expr, parts);
+    } else if (ArrayAssignmentStatementNode *element =
+                   dynamic_cast<ArrayAssignmentStatementNode *>(
+                       statements[i])) {
+      parts_in(element->index_expression, parts);
+      parts_in(element->assignment_expr, parts);
+    } else if (WriteStatementNode *write =
+                   dynamic_cast<WriteStatementNode *>(statements[i])) {
+      if (write->element)
+        parts_in(write->element, parts);
+    } else {
+      current.clear();
+      continue;
+    }
+
+    for (auto it = parts.begin(); it != parts.end(); ++it) {
+      if (can_fail(*it))
+        continue;
+      std::string part_key = key(*it);
+      auto found = current.find(part_key);
+      if (found != current.end()) {
+        CommonValue &value = values[found->second];
+        value.uses.push_back(*it);
+        if (value.uses.size() == 2 && part_key.size() > best_length) {
+          best = found->second;
+          best_length = part_key.size();
+        }
+        continue;
+      }
+      CommonValue value;
+      value.uses.push_back(*it);
+      Effects reads;
+      effects(*it, reads);
+      value.reads = reads.reads;
+      value.first = i;
+      current[part_key] = values.size();
+      values.push_back(value);
+    }
+
+    // The assignment is made after its expression is computed.
+    if (assignment) {
+      Scalar target =
+          variable(assignment->identifier, assignment->frame_slot);
+      for (auto it = current.begin(); it != current.end();)
+        if (values[it->second].reads.count(target))
+          it = current.erase(it);
+        else
+          ++it;
+    }
+  }
+  if (best == SIZE_MAX)
+    return false;
+
+  CommonValue &value = values[best];
+  StatementNode *first = statements[value.first];
+  IdFactorNode *id = new IdFactorNode(first->_level, "");
+  ExpressionNode *shared = take(value.uses[0], id, first->line);
+  new_temporary(id);
+  for (size_t i = 1; i < value.uses.size(); i++)
+    delete take(value.uses[i], id->clone(0), first->line);
+  report(first->line, "computed " + text(shared) + " once for " +
+                          std::to_string(value.uses.size()) + " uses");
+  statements.insert(statements.begin() + value.first,
+                    store(id, shared, first->_level, first->line));
+  return true;
+}
+
+static void share_common_values(StatementNode *statement) {
+  if (dynamic_cast<CobeginStatementNode *>(statement))
+    return;
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      share_common_values(*it);
+    while (share_common_value(compound->statement_vector))
+      ;
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    share_common_values(if_stmt->then_statement);
+    if (if_stmt->has_else)
+      share_common_values(if_stmt->else_statement);
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    share_common_values(loop->while_statement);
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    if (!loop->parallel)
+      share_common_values(loop->for_statement);
+  }
+}
+
+// A whole-number constant small enough to be exact in a float.
+static bool whole_constant(FactorNode *factor, long &value) {
+  if (!dynamic_cast<IntFactorNode *>(factor) &&
+      !dynamic_cast<FloatFactorNode *>(factor) &&
+      !dynamic_cast<ConstantFactorNode *>(factor))
+    return false;
+  float number = 0.0;
+  try {
+    number = factor->interpret();
+  } catch (...) {
+    return false;
+  }
+  if (!(std::fabs(number) <= 16777216) || number != std::floor(number))
+    return false;
+  value = (long)number;
+  return true;
+}
+
+// The factor of a simple expression without operations.
+static FactorNode *lone_factor(SimpleExpressionNode *simple_exp) {
+  if (!simple_exp->following_terms.empty() ||
+      !simple_exp->first_term->following_factors.empty())
+    return nullptr;
+  return simple_exp->first_term->first_factor;
+}
+
+static bool is_variable(FactorNode *factor, const Scalar &target) {
+  IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor);
+  return id && variable(id->identifier, id->frame_slot) == target;
+}
+
+static bool closed_form_update(StatementNode *statement, const Scalar &counter,
+                               ClosedFormUpdate &update) {
+  AssignmentStatementNode *assignment =
+      dynamic_cast<AssignmentStatementNode *>(statement);
+  if (!assignment ||
+      assignment->assignment_expr->simple_exp_operator != TOK_UNKNOWN)
+    return false;
+  SimpleExpressionNode *sum = assignment->assignment_expr->first_simple_exp;
+  if (sum->following_terms.size() != 1 ||
+      !sum->first_term->following_factors.empty() ||
+      !sum->following_terms[0]->following_factors.empty())
+    return false;
+  int op = sum->following_operators[0];
+  if (op != TOK_PLUS && op != TOK_MINUS)
+    return false;
+
+  update.variable = variable(assignment->identifier, assignment->frame_slot);
+  FactorNode *left = sum->first_term->first_factor;
+  FactorNode *right = sum->following_terms[0]->first_factor;
+  FactorNode *operand = nullptr;
+  if (is_variable(left, update.variable))
+    operand = right;
+  else if (op == TOK_PLUS && is_variable(right, update.variable))
+    operand = left;
+  else
+    return false;
+
+  int sign = op == TOK_PLUS ? 1 : -1;
+  long value = 0;
+  if (whole_constant(operand, value)) {
+    update.step = sign * value;
+    return true;
+  }
+  if (update.variable != counter && is_variable(operand, counter)) {
+    update.counter_sign = sign;
+    return true;
+  }
+  return false;
+}
+
+// Recognizes a WHILE loop that counts a variable to a bound while adding
+// constants or the counter to others; see closed_form.h.
+static ClosedFormLoop *plan_closed_form(WhileStatementNode *loop) {
+  ExpressionNode *condition = loop->while_expression;
+  int op = condition->simple_exp_operator;
+  if (op != TOK_LESSTHAN && op != TOK_GREATERTHAN && op != TOK_NOTEQUALTO)
+    return nullptr;
+  IdFactorNode *id =
+      dynamic_cast<IdFactorNode *>(lone_factor(condition->first_simple_exp));
+  if (!id)
+    return nullptr;
+  Scalar counter = variable(id->identifier, id->frame_slot);
+
+  std::vector<StatementNode *> body(1, loop->while_statement);
+  if (dynamic_cast<CobeginStatementNode *>(loop->while_statement))
+    return nullptr;
+  ClosedFormLoop plan;
+  plan.statements = 1;
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(loop->while_statement)) {
+    body = compound->statement_vector;
+    plan.statements += body.size();
+  }
+
+  std::set<Scalar> targets;
+  for (auto it = body.begin(); it != body.end(); ++it) {
+    ClosedFormUpdate update;
+    if (!closed_form_update(*it, counter, update) ||
+        !targets.insert(update.variable).second)
+      return nullptr;
+    if (update.variable == counter) {
+      if (update.step == 0)
+        return nullptr;
+      plan.counter = plan.updates.size();
+    }
+    plan.updates.push_back(update);
+  }
+  if (!targets.count(counter) || can_fail(condition->second_simple_exp))
+    return nullptr;
+  Effects bound;
+  effects(condition->second_simple_exp, bound);
+  for (auto it = bound.reads.begin(); it != bound.reads.end(); ++it)
+    if (targets.count(*it))
+      return nullptr;
+
+  plan.relational_operator = op;
+  plan.bound = condition->second_simple_exp;
+  return new ClosedFormLoop(plan);
+}
+
+static void plan_closed_forms(StatementNode *statement) {
+  if (dynamic_cast<CobeginStatementNode *>(statement))
+    return;
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      plan_closed_forms(*it);
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    plan_closed_forms(if_stmt->then_statement);
+    if (if_stmt->has_else)
+      plan_closed_forms(if_stmt->else_statement);
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    plan_closed_forms(loop->while_statement);
+    loop->closed_form = plan_closed_form(loop);
+    double trips = pgo_trips(loop);
+    if (loop->closed_form && trips >= 0 && trips < closedFormTrips) {
+      delete loop->closed_form;
+      loop->closed_form = nullptr;
+      report(loop->line, "WHILE loop ran " + trips_text(trips) +
+                             " times a run in the profile, too few to "
+                             "compute in closed form");
+    }
+    if (loop->closed_form)
+      report(loop->line, "WHILE loop computed in closed form when its "
+                         "variables hold whole numbers");
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    if (!loop->parallel)
+      plan_closed_forms(loop->for_statement);
+  }
+}
+
+static bool never_read(const Scalar &variable) {
+  if (variable.second >= 0)
+    return !frameReads.count(variable);
+  return !globalsLive && !globalReads.count(variable);
+}
+
+// Whether the statements after statements[i] assign variable again before
+// anything can read it. A failure on the way ends the program, and with it
+// any use of the value.
+static bool overwritten(const std::vector<StatementNode *> &statements,
+                        size_t i, const Scalar &target) {
+  for (size_t k = i + 1; k < statements.size(); k++) {
+    StatementNode *next = statements[k];
+    Effects after;
+    effects(next, after);
+    if (after.reads.count(target) ||
+        (target.second < 0 && !after.callees.empty()))
+      return false;
+    if (AssignmentStatementNode *assignment =
+            dynamic_cast<AssignmentStatementNode *>(next))
+      if (variable(assignment->identifier, assignment->frame_slot) == target)
+        return true;
+    if (ReadStatementNode *read = dynamic_cast<ReadStatementNode *>(next))
+      if (variable(read->read_text, read->frame_slot) == target)
+        return true;
+    if (next->has_loop_exit || dynamic_cast<LoopExitStatementNode *>(next))
+      return false;
+  }
+  return false;
+}
+
+// Removes assignments whose value is never used. The last statement of a
+// compound statement is kept, since its value may be the program's.
+static bool remove_dead_stores(StatementNode *statement) {
+  bool removed = false;
+  if (dynamic_cast<CobeginStatementNode *>(statement))
+    return false;
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    std::vector<StatementNode *> &statements = compound->statement_vector;
+    for (size_t i = 0; i < statements.size(); i++) {
+      removed |= remove_dead_stores(statements[i]);
+      AssignmentStatementNode *store =
+          dynamic_cast<AssignmentStatementNode *>(statements[i]);
+      if (!store || i + 1 == statements.size() ||
+          can_fail(store->assignment_expr))
+        continue;
+      Scalar target = variable(store->identifier, store->frame_slot);
+      const char *why = nullptr;
+      if (never_read(target))
+        why = " is never read";
+      else if (overwritten(statements, i, target))
+        why = " is assigned again before it is read";
+      if (!why)
+        continue;
+      report(store->line, "removed " + store->identifier + " := " +
+                              text(store->assignment_expr) + ", " +
+                              store->identifier + why);
+      delete store;
+      statements.erase(statements.begin() + i--);
+      removed = true;
+    }
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    removed |= remove_dead_stores(if_stmt->then_statement);
+    if (if_stmt->has_else)
+      removed |= remove_dead_stores(if_stmt->else_statement);
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    removed |= remove_dead_stores(loop->while_statement);
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    if (!loop->parallel)
+      removed |= remove_dead_stores(loop->for_statement);
+  }
+  return removed;
+}
+
+// The reads of frame slots among those of body.
+static void note_frame_reads(StatementNode *body) {
+  Effects uses;
+  effects(body, uses);
+  frameReads.clear();
+  for (auto it = uses.reads.begin(); it != uses.reads.end(); ++it)
+    if (it->second >= 0)
+      frameReads.insert(*it);
+}
+
+void optimize_program(ProgramNode *root, bool globals_live) {
+  BlockNode *block = root->program_block;
+  globalsLive = globals_live;
+
+  // Procedures still called at run time; the bodies of the others were
+  // inlined into their callers and never run themselves.
+  Effects program;
+  effects(block->compound_stmt, program);
+  std::set<ProcedureNode *> called;
+  std::vector<ProcedureNode *> pending(program.callees.begin(),
+                                       program.callees.end());
+  while (!pending.empty()) {
+    ProcedureNode *procedure = pending.back();
+    pending.pop_back();
+    if (!called.insert(procedure).second)
+      continue;
+    Effects body;
+    effects(procedure->body, body);
+    pending.insert(pending.end(), body.callees.begin(), body.callees.end());
+  }
+
+  StatementNode *main_body = block->compound_stmt;
+  frameSlots = &root->frame_size;
+  fixedFrame = false;
+  optimize(main_body);
+  share_common_values(main_body);
+  for (auto it = called.begin(); it != called.end(); ++it) {
+    StatementNode *body = (*it)->body;
+    frameSlots = &(*it)->frame_size;
+    fixedFrame = (*it)->is_recursive;
+    optimize(body);
+    if (!fixedFrame)
+      share_common_values(body);
+  }
+  fixedFrame = false;
+
+  // Removing one assignment can leave the variables it read unused.
+  bool removed = true;
+  while (removed) {
+    Effects everything;
+    effects(block->compound_stmt, everything);
+    for (auto it = block->procedures.begin(); it != block->procedures.end();
+         ++it)
+      effects((*it)->body, everything);
+    globalReads.clear();
+    for (auto it = everything.reads.begin(); it != everything.reads.end();
+         ++it)
+      if (it->second < 0)
+        globalReads.insert(*it);
+
+    note_frame_reads(block->compound_stmt);
+    removed = remove_dead_stores(block->compound_stmt);
+    for (auto it = called.begin(); it != called.end(); ++it) {
+      note_frame_reads((*it)->body);
+      removed |= remove_dead_stores((*it)->body);
+    }
+  }
+
+  plan_closed_forms(block->compound_stmt);
+  for (auto it = called.begin(); it != called.end(); ++it)
+    plan_closed_forms((*it)->body);
+}
@@ -0,0 +1,35 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "parse_tree_nodes.h"
+#include <string>
+#include <vector>
+
+// What optimize_program() moved or removed, one line each; printed by
+// --report-optimizations.
+extern std::vector<std::string> optimizerReport;
+
+// Rewrites the parsed program so that it does less work with the same
+// output, errors and final value:
+//  - computations in a WHILE loop whose variables the loop does not change
+//    are made once before it, into a new frame slot;
+//  - a computation repeated in a row of assignments and WRITE statements,
+//    with its variables unchanged in between, is made once into a new frame
+//    slot before its first use;
+//  - assignments whose value is never read, or is assigned again before it
+//    is read, are removed;
+//  - IF branches and WHILE loops whose condition is a constant that never
+//    selects them are removed;
+//  - WHILE loops that only count and sum are given a closed form
+//    (closed_form.h), used when it gives the same values as iterating.
+// With a --pgo-use profile (pgo.h), WHILE loops that it shows iterating
+// less than once a run keep their computations, and those iterating only a
+// few times are not given a closed form.
+// Statements are never reordered, so READ and WRITE keep their order, and
+// operations are never regrouped, so float results are unchanged. The
+// bodies of parallel FOR loops and COBEGIN statements, planned at parse
+// time, are left as they are. globals_live keeps assignments to globals
+// that -s would show at the end.
+void optimize_program(ProgramNode *root, bool globals_live);
+
+#endif /* OPTIMIZER_H */
@@ -0,0 +1,232 @@
+#include "output.h"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Bytes collected before a block is handed to the kernel.
+static const size_t outputBlock = 1 << 16;
+
+class OutputBuffer : public std::streambuf {
+public:
+  OutputBuffer();
+  void set_fd(int fd) { output_fd = fd; }
+  void flush();
+  void finish();
+
+protected:
+  int overflow(int c);
+  int sync() { return 0; }
+
+private:
+  void hand_off();
+  void writer_main();
+  void write_blocks(std::vector<std::vector<char>> &blocks);
+
+  int output_fd = STDOUT_FILENO;
+  std::vector<char> current;
+
+public:
+  // Updated by whichever thread writes; read after flush().
+  unsigned long long bytes_written = 0;
+  double write_seconds = 0.0;
+
+private:
+
+  // Filled blocks waiting for the writer thread, and emptied ones it gives
+  // back for reuse.
+  std::mutex lock;
+  std::condition_variable work_ready;
+  std::condition_variable work_done;
+  std::vector<std::vector<char>> full;
+  std::vector<std::vector<char>> spare;
+  bool writing = false;
+  bool stopping = false;
+  bool background_checked = false;
+  std::thread writer;
+};
+
+static OutputBuffer outputBuffer;
+static bool outputStarted = false;
+static std::streambuf *consoleBuffer = nullptr;
+
+OutputBuffer::OutputBuffer() {
+  current.resize(outputBlock);
+  setp(current.data(), current.data() + current.size());
+}
+
+int OutputBuffer::overflow(int c) {
+  hand_off();
+  if (c != traits_type::eof()) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+// Passes the filled part of the current block on and starts a fresh one.
+void OutputBuffer::hand_off() {
+  size_t used = pptr() - pbase();
+  if (used == 0)
+    return;
+  current.resize(used);
+
+  if (!background_checked) {
+    background_checked = true;
+    if (!isatty(output_fd))
+      writer = std::thread(&OutputBuffer::writer_main, this);
+  }
+
+  if (!writer.joinable()) {
+    std::vector<std::vector<char>> blocks(1);
+    blocks[0].swap(current);
+    write_blocks(blocks);
+    current.swap(blocks[0]);
+  } else {
+    std::lock_guard<std::mutex> guard(lock);
+    full.push_back(std::vector<char>());
+    full.back().swap(current);
+    if (!spare.empty()) {
+      current.swap(spare.back());
+      spare.pop_back();
+    }
+    work_ready.notify_one();
+  }
+  current.resize(outputBlock);
+  setp(current.data(), current.data() + current.size());
+}
+
+void OutputBuffer::writer_main() {
+  std::vector<std::vector<char>> blocks;
+  std::unique_lock<std::mutex> guard(lock);
+  for (;;) {
+    work_ready.wait(guard, [this] { return stopping || !full.empty(); });
+    if (full.empty())
+      return;
+    blocks.swap(full);
+    writing = true;
+    guard.unlock();
+    write_blocks(blocks);
+    guard.lock();
+    for (auto it = blocks.begin(); it != blocks.end(); ++it)
+      spare.push_back(std::move(*it));
+    blocks.clear();
+    writing = false;
+    work_done.notify_all();
+  }
+}
+
+// Writes blocks in order with as few system calls as possible. Output that
+// cannot be written is dropped, as std::cout does once it fails.
+void OutputBuffer::write_blocks(std::vector<std::vector<char>> &blocks) {
+  std::vector<struct iovec> pieces;
+  for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+    struct iovec piece;
+    piece.iov_base = it->data();
+    piece.iov_len = it->size();
+    pieces.push_back(piece);
+  }
+  auto start = std::chrono::steady_clock::now();
+  size_t first = 0;
+  while (first < pieces.size()) {
+    int count = (int)std::min(pieces.size() - first, (size_t)IOV_MAX);
+    ssize_t written = writev(output_fd, &pieces[first], count);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    bytes_written += written;
+    while (first < pieces.size() && (size_t)written >= pieces[first].iov_len) {
+      written -= pieces[first].iov_len;
+      first++;
+    }
+    if (written > 0) {
+      pieces[first].iov_base = (char *)pieces[first].iov_base + written;
+      pieces[first].iov_len -= written;
+    }
+  }
+  write_seconds += std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+}
+
+void OutputBuffer::flush() {
+  hand_off();
+  if (!writer.joinable())
+    return;
+  std::unique_lock<std::mutex> guard(lock);
+  work_done.wait(guard, [this] { return full.empty() && !writing; });
+}
+
+void OutputBuffer::finish() {
+  flush();
+  if (!writer.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  work_ready.notify_one();
+  writer.join();
+}
+
+// Runs at exit, before outputBuffer is destroyed; std::cout is flushed once
+// more after that, so it gets its own buffer back.
+static void finish_output() {
+  outputBuffer.finish();
+  std::cout.rdbuf(consoleBuffer);
+}
+
+static std::terminate_handler previousTerminate = nullptr;
+
+static void terminate_after_flush() {
+  outputBuffer.flush();
+  if (previousTerminate)
+    previousTerminate();
+  abort();
+}
+
+void output_start() {
+  if (outputStarted)
+    return;
+  outputStarted = true;
+  consoleBuffer = std::cout.rdbuf(&outputBuffer);
+  atexit(finish_output);
+  previousTerminate = std::set_terminate(terminate_after_flush);
+}
+
+bool output_open(const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  outputBuffer.set_fd(fd);
+  return true;
+}
+
+void output_flush() {
+  if (outputStarted)
+    outputBuffer.flush();
+}
+
+void output_statistics(unsigned long long &bytes, double &write_seconds) {
+  bytes = outputBuffer.bytes_written;
+  write_seconds = outputBuffer.write_seconds;
+}
+
+void output_flush_for_input() {
+  static const bool interactive = isatty(STDIN_FILENO);
+  if (interactive)
+    output_flush();
+}
@@ -0,0 +1,22 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+// Standard output of the interpreter. After output_start, std::cout writes
+// into large blocks that reach the kernel only when full, at output_flush,
+// and at exit; std::endl and std::flush no longer write anything. When the
+// output is not a terminal, full blocks are written by a background thread,
+// several at a time with writev.
+void output_start();
+// Sends the output to path instead of standard output (-o). False if the
+// file cannot be created.
+bool output_open(const char *path);
+// Writes everything buffered and waits until it has been written.
+void output_flush();
+// Bytes written so far and the time spent in write calls, for -T.
+void output_statistics(unsigned long long &bytes, double &write_seconds);
+
+// Flushes before READ takes a value from a terminal, so prompts written by
+// the program are seen first.
+void output_flush_for_input();
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,730 @@
+#include "parallel.h"
+#include "parser.h"
+#include "work_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <set>
+
+std::vector<std::string> parallelReport;
+
+// Iterations handed to the pool at a time; bounds the reduction records and
+// the array contents saved for falling back to serial execution.
+static const long parallelBlock = 1L << 16;
+// Loops without an inner loop need this many iterations to be worth the
+// hand-off to other threads.
+static const long minParallelTrips = 1024;
+// Floats represent every integer up to here exactly.
+static const double exactIntegers = 16777216.0;
+
+ParallelLoop::~ParallelLoop() {
+  for (auto it = reductions.begin(); it != reductions.end(); ++it)
+    delete it->record;
+  for (auto it = worker_bodies.begin(); it != worker_bodies.end(); ++it)
+    delete (*it);
+}
+
+static Scalar scalar(const std::string &name, int frame_slot) {
+  return frame_slot >= 0 ? Scalar("", frame_slot) : Scalar(name, -1);
+}
+
+// Variables and arrays used by part of a loop body.
+struct Uses {
+  std::set<Scalar> reads;
+  std::set<Scalar> writes;
+  std::map<Scalar, std::string> names;
+  std::set<ArrayVariable *> array_writes;
+  std::vector<std::pair<ArrayVariable *, ExpressionNode *>> array_accesses;
+  bool has_loop = false;
+  // What keeps the statements from running on another thread, if anything.
+  std::string unsafe;
+
+  // Whether to look into the procedures called, rather than calling them
+  // unsafe, and READ and WRITE, which then count as a write and a read.
+  bool follow_calls = false;
+  bool has_read = false;
+  int call_depth = 0;
+  std::set<ProcedureNode *> called;
+};
+
+static void note(Uses &uses, std::set<Scalar> &into, const std::string &name,
+                 int frame_slot) {
+  // The frame of a called procedure is private to the call.
+  if (frame_slot >= 0 && uses.call_depth > 0)
+    return;
+  Scalar var = scalar(name, frame_slot);
+  into.insert(var);
+  uses.names[var] = name;
+}
+
+static void collect(ExpressionNode *expression, Uses &uses);
+
+static void collect(FactorNode *factor, Uses &uses) {
+  if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor)) {
+    note(uses, uses.reads, id->identifier, id->frame_slot);
+  } else if (ArrayFactorNode *element = dynamic_cast<ArrayFactorNode *>(factor)) {
+    uses.array_accesses.push_back(
+        std::make_pair(element->array, element->index_expression));
+    collect(element->index_expression, uses);
+  } else if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor)) {
+    collect(minus->child_factor, uses);
+  } else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor)) {
+    collect(negation->child_factor, uses);
+  } else if (ExpressionFactorNode *nested =
+                 dynamic_cast<ExpressionFactorNode *>(factor)) {
+    collect(nested->child_expression, uses);
+  }
+}
+
+static void collect(TermNode *term, Uses &uses) {
+  collect(term->first_factor, uses);
+  for (auto it = term->following_factors.begin();
+       it != term->following_factors.end(); ++it)
+    collect(*it, uses);
+}
+
+static void collect(SimpleExpressionNode *simple_exp, Uses &uses) {
+  collect(simple_exp->first_term, uses);
+  for (auto it = simple_exp->following_terms.begin();
+       it != simple_exp->following_terms.end(); ++it)
+    collect(*it, uses);
+}
+
+static void collect(ExpressionNode *expression, Uses &uses) {
+  collect(expression->first_simple_exp, uses);
+  if (expression->second_simple_exp)
+    collect(expression->second_simple_exp, uses);
+}
+
+static void collect(StatementNode *statement, Uses &uses) {
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      collect(*it, uses);
+  } else if (AssignmentStatementNode *assignment =
+                 dynamic_cast<AssignmentStatementNode *>(statement)) {
+    collect(assignment->assignment_expr, uses);
+    note(uses, uses.writes, assignment->identifier, assignment->frame_slot);
+  } else if (ArrayAssignmentStatementNode *element =
+                 dynamic_cast<ArrayAssignmentStatementNode *>(statement)) {
+    collect(element->index_expression, uses);
+    collect(element->assignment_expr, uses);
+    uses.array_writes.insert(element->array);
+    uses.array_accesses.push_back(
+        std::make_pair(element->array, element->index_expression));
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    collect(if_stmt->if_expression, uses);
+    collect(if_stmt->then_statement, uses);
+    if (if_stmt->has_else)
+      collect(if_stmt->else_statement, uses);
+  } else if (WhileStatementNode *while_stmt =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    uses.has_loop = true;
+    collect(while_stmt->while_expression, uses);
+    collect(while_stmt->while_statement, uses);
+  } else if (ForStatementNode *for_stmt =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    uses.has_loop = true;
+    collect(for_stmt->start_expression, uses);
+    collect(for_stmt->end_expression, uses);
+    note(uses, uses.writes, for_stmt->identifier, for_stmt->frame_slot);
+    collect(for_stmt->for_statement, uses);
+  } else if (!uses.follow_calls) {
+    if (!uses.unsafe.empty())
+      return;
+    if (dynamic_cast<ReadStatementNode *>(statement))
+      uses.unsafe = "body contains READ";
+    else if (dynamic_cast<WriteStatementNode *>(statement))
+      uses.unsafe = "body contains WRITE";
+    else if (dynamic_cast<CallStatementNode *>(statement))
+      uses.unsafe = "body calls a procedure";
+    else if (dynamic_cast<LoopExitStatementNode *>(statement))
+      uses.unsafe = "body contains BREAK or CONTINUE";
+    else
+      uses.unsafe = "body contains an unknown statement";
+  } else if (ReadStatementNode *read =
+                 dynamic_cast<ReadStatementNode *>(statement)) {
+    uses.has_read = true;
+    note(uses, uses.writes, read->read_text, read->frame_slot);
+  } else if (WriteStatementNode *write =
+                 dynamic_cast<WriteStatementNode *>(statement)) {
+    if (write->element)
+      collect(write->element, uses);
+    else if (write->is_identifier)
+      note(uses, uses.reads, write->write_text, write->frame_slot);
+  } else if (CallStatementNode *call =
+                 dynamic_cast<CallStatementNode *>(statement)) {
+    for (auto it = call->arguments.begin(); it != call->arguments.end(); ++it)
+      collect(*it, uses);
+    ProcedureNode *procedure = call->procedure;
+    if (!procedure->body) {
+      // A call of the procedure still being parsed.
+      if (uses.unsafe.empty())
+        uses.unsafe = "calls a procedure being declared";
+    } else if (uses.called.insert(procedure).second) {
+      uses.call_depth++;
+      collect(procedure->body, uses);
+      uses.call_depth--;
+    }
+  } else if (!dynamic_cast<LoopExitStatementNode *>(statement) &&
+             uses.unsafe.empty()) {
+    uses.unsafe = "contains an unknown statement";
+  }
+}
+
+static void merge(Uses &into, const Uses &from) {
+  into.reads.insert(from.reads.begin(), from.reads.end());
+  into.writes.insert(from.writes.begin(), from.writes.end());
+  into.names.insert(from.names.begin(), from.names.end());
+  into.array_writes.insert(from.array_writes.begin(), from.array_writes.end());
+  into.array_accesses.insert(into.array_accesses.end(),
+                             from.array_accesses.begin(),
+                             from.array_accesses.end());
+  into.has_loop = into.has_loop || from.has_loop;
+  if (into.unsafe.empty())
+    into.unsafe = from.unsafe;
+}
+
+static void flatten(StatementNode *statement,
+                    std::vector<StatementNode *> &statements,
+                    size_t &compounds) {
+  CompoundStatementNode *compound =
+      dynamic_cast<CompoundStatementNode *>(statement);
+  if (!compound) {
+    statements.push_back(statement);
+    return;
+  }
+  compounds++;
+  for (auto it = compound->statement_vector.begin();
+       it != compound->statement_vector.end(); ++it)
+    flatten(*it, statements, compounds);
+}
+
+static bool bare_scalar(TermNode *term, Scalar &var) {
+  if (!term->following_factors.empty())
+    return false;
+  IdFactorNode *id = dynamic_cast<IdFactorNode *>(term->first_factor);
+  if (id)
+    var = scalar(id->identifier, id->frame_slot);
+  return id != nullptr;
+}
+
+static bool bare_scalar(SimpleExpressionNode *simple_exp, Scalar &var) {
+  return simple_exp->following_terms.empty() &&
+         bare_scalar(simple_exp->first_term, var);
+}
+
+static bool bare_scalar(ExpressionNode *expression, Scalar &var) {
+  return expression->simple_exp_operator == TOK_UNKNOWN &&
+         bare_scalar(expression->first_simple_exp, var);
+}
+
+// True for a variable, array element, literal or constant that evaluates
+// the same way in both places.
+static bool same_operand(SimpleExpressionNode *first,
+                         SimpleExpressionNode *second) {
+  if (!first->following_terms.empty() || !second->following_terms.empty() ||
+      !first->first_term->following_factors.empty() ||
+      !second->first_term->following_factors.empty())
+    return false;
+  FactorNode *a = first->first_term->first_factor;
+  FactorNode *b = second->first_term->first_factor;
+
+  Scalar var_a, var_b;
+  if (bare_scalar(first, var_a))
+    return bare_scalar(second, var_b) && var_a == var_b;
+  ArrayFactorNode *element_a = dynamic_cast<ArrayFactorNode *>(a);
+  ArrayFactorNode *element_b = dynamic_cast<ArrayFactorNode *>(b);
+  if (element_a)
+    return element_b && element_a->array == element_b->array &&
+           bare_scalar(element_a->index_expression, var_a) &&
+           bare_scalar(element_b->index_expression, var_b) && var_a == var_b;
+  IntFactorNode *int_a = dynamic_cast<IntFactorNode *>(a);
+  IntFactorNode *int_b = dynamic_cast<IntFactorNode *>(b);
+  if (int_a)
+    return int_b && int_a->int_literal == int_b->int_literal;
+  FloatFactorNode *float_a = dynamic_cast<FloatFactorNode *>(a);
+  FloatFactorNode *float_b = dynamic_cast<FloatFactorNode *>(b);
+  if (float_a)
+    return float_b && float_a->float_literal == float_b->float_literal;
+  ConstantFactorNode *constant_a = dynamic_cast<ConstantFactorNode *>(a);
+  ConstantFactorNode *constant_b = dynamic_cast<ConstantFactorNode *>(b);
+  return constant_a && constant_b &&
+         constant_a->constant_value == constant_b->constant_value;
+}
+
+static ExpressionNode *record_expression(int level, TermNode *term) {
+  ExpressionNode *record = new ExpressionNode(level);
+  record->first_simple_exp = new SimpleExpressionNode(level + 1);
+  record->first_simple_exp->first_term = term->clone(0);
+  return record;
+}
+
+static bool match_reduction(StatementNode *statement, Reduction &reduction) {
+  Scalar operand;
+  Uses value_uses;
+
+  if (AssignmentStatementNode *assignment =
+          dynamic_cast<AssignmentStatementNode *>(statement)) {
+    ExpressionNode *expression = assignment->assignment_expr;
+    SimpleExpressionNode *sum = expression->first_simple_exp;
+    if (expression->simple_exp_operator != TOK_UNKNOWN ||
+        sum->following_terms.size() != 1)
+      return false;
+    Scalar var = scalar(assignment->identifier, assignment->frame_slot);
+    int op = sum->following_operators[0];
+    TermNode *value = nullptr;
+    if ((op == TOK_PLUS || op == TOK_MINUS) &&
+        bare_scalar(sum->first_term, operand) && operand == var)
+      value = sum->following_terms[0];
+    else if (op == TOK_PLUS && bare_scalar(sum->following_terms[0], operand) &&
+             operand == var)
+      value = sum->first_term;
+    if (!value)
+      return false;
+    collect(value, value_uses);
+    if (value_uses.reads.count(var))
+      return false;
+    reduction.variable = var;
+    reduction.op = op;
+    reduction.record = record_expression(expression->_level, value);
+    return true;
+  }
+
+  IfStatementNode *if_stmt = dynamic_cast<IfStatementNode *>(statement);
+  if (!if_stmt || if_stmt->has_else)
+    return false;
+  AssignmentStatementNode *assignment =
+      dynamic_cast<AssignmentStatementNode *>(if_stmt->then_statement);
+  ExpressionNode *condition = if_stmt->if_expression;
+  if (!assignment || condition->simple_exp_operator == TOK_UNKNOWN ||
+      assignment->assignment_expr->simple_exp_operator != TOK_UNKNOWN)
+    return false;
+  Scalar var = scalar(assignment->identifier, assignment->frame_slot);
+  SimpleExpressionNode *value = nullptr;
+  if (bare_scalar(condition->first_simple_exp, operand) && operand == var) {
+    reduction.variable_first = true;
+    value = condition->second_simple_exp;
+  } else if (bare_scalar(condition->second_simple_exp, operand) &&
+             operand == var) {
+    reduction.variable_first = false;
+    value = condition->first_simple_exp;
+  } else {
+    return false;
+  }
+  collect(value, value_uses);
+  if (value_uses.reads.count(var) ||
+      !same_operand(value, assignment->assignment_expr->first_simple_exp))
+    return false;
+  reduction.variable = var;
+  reduction.op = condition->simple_exp_operator;
+  reduction.record = record_expression(condition->_level, value->first_term);
+  return true;
+}
+
+static bool intersects(const std::set<Scalar> &first,
+                       const std::set<Scalar> &second) {
+  for (auto it = first.begin(); it != first.end(); ++it)
+    if (second.count(*it))
+      return true;
+  return false;
+}
+
+bool statements_share_variables(const std::vector<StatementNode *> &statements) {
+  size_t count = statements.size();
+  std::vector<Uses> uses(count);
+  for (size_t i = 0; i < count; i++) {
+    uses[i].follow_calls = true;
+    collect(statements[i], uses[i]);
+    if (!uses[i].unsafe.empty())
+      return true;
+  }
+  for (size_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < count; j++) {
+      if (i == j)
+        continue;
+      if (intersects(uses[i].writes, uses[j].reads) ||
+          intersects(uses[i].writes, uses[j].writes) ||
+          (uses[i].has_read && uses[j].has_read))
+        return true;
+      for (auto it = uses[j].array_accesses.begin();
+           it != uses[j].array_accesses.end(); ++it)
+        if (uses[i].array_writes.count(it->first))
+          return true;
+    }
+  }
+  return false;
+}
+
+// True when statement has a FOR loop with hoisted bounds checks, not
+// counting the procedures it calls.
+static bool has_hoisted_check(StatementNode *statement) {
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      if (has_hoisted_check(*it))
+        return true;
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    return has_hoisted_check(if_stmt->then_statement) ||
+           (if_stmt->has_else && has_hoisted_check(if_stmt->else_statement));
+  } else if (WhileStatementNode *while_stmt =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    return has_hoisted_check(while_stmt->while_statement);
+  } else if (ForStatementNode *for_stmt =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    return !for_stmt->hoisted_arrays.empty() ||
+           has_hoisted_check(for_stmt->for_statement);
+  }
+  return false;
+}
+
+bool statements_share_loop_checks(
+    const std::vector<StatementNode *> &statements) {
+  std::set<ProcedureNode *> called;
+  for (auto it = statements.begin(); it != statements.end(); ++it) {
+    Uses uses;
+    uses.follow_calls = true;
+    collect(*it, uses);
+    for (auto procedure = uses.called.begin(); procedure != uses.called.end();
+         ++procedure)
+      if (!called.insert(*procedure).second &&
+          has_hoisted_check((*procedure)->body))
+        return true;
+  }
+  return false;
+}
+
+// True when expression is just the loop counter.
+static bool is_counter(ExpressionNode *expression, const Scalar &counter) {
+  Scalar var;
+  return bare_scalar(expression, var) && var == counter;
+}
+
+ParallelLoop *plan_parallel_loop(ForStatementNode *loop,
+                                 std::string &why_serial) {
+  std::unique_ptr<ParallelLoop> plan(new ParallelLoop());
+  plan->loop = loop;
+  flatten(loop->for_statement, plan->statements, plan->flattened_compounds);
+  Scalar counter = scalar(loop->identifier, loop->frame_slot);
+
+  size_t count = plan->statements.size();
+  std::vector<Uses> uses(count);
+  Uses body;
+  for (size_t i = 0; i < count; i++) {
+    collect(plan->statements[i], uses[i]);
+    merge(body, uses[i]);
+  }
+  if (!body.unsafe.empty()) {
+    why_serial = body.unsafe;
+    return nullptr;
+  }
+  if (body.writes.count(counter)) {
+    why_serial = "counter is assigned in the body";
+    return nullptr;
+  }
+
+  // An array written by the body may only be touched at the counter's
+  // element, which no other iteration uses.
+  for (auto it = body.array_accesses.begin(); it != body.array_accesses.end();
+       ++it) {
+    if (body.array_writes.count(it->first) && !is_counter(it->second, counter)) {
+      why_serial = "array " + it->first->name +
+                   " is written and used at other elements than " +
+                   loop->identifier;
+      return nullptr;
+    }
+  }
+  plan->written_arrays.assign(body.array_writes.begin(),
+                              body.array_writes.end());
+  plan->has_inner_loop = body.has_loop;
+
+  // A reduction variable must appear nowhere else in the body.
+  std::vector<int> reduction_at(count, -1);
+  std::set<Scalar> reduced;
+  for (size_t i = 0; i < count; i++) {
+    Reduction reduction;
+    if (!match_reduction(plan->statements[i], reduction))
+      continue;
+    bool elsewhere = reduction.variable == counter;
+    for (size_t j = 0; j < count && !elsewhere; j++)
+      elsewhere = j != i && (uses[j].reads.count(reduction.variable) ||
+                             uses[j].writes.count(reduction.variable));
+    if (elsewhere) {
+      delete reduction.record;
+      continue;
+    }
+    reduction.statement = i;
+    reduction_at[i] = plan->reductions.size();
+    reduced.insert(reduction.variable);
+    plan->reductions.push_back(reduction);
+  }
+
+  // Every other scalar the body writes must be assigned by each iteration
+  // before it is read, so no value passes from one iteration to the next.
+  // That holds after a plain assignment at the top of the body, and for the
+  // counter of an inner FOR loop whose bounds the body cannot change.
+  std::set<Scalar> assigned;
+  assigned.insert(counter);
+  std::string carried;
+  auto check = [&](const Uses &part, const Scalar *also) {
+    for (auto it = part.reads.begin(); it != part.reads.end(); ++it)
+      if (body.writes.count(*it) && !assigned.count(*it) &&
+          !(also && *it == *also))
+        carried = part.names.find(*it)->second;
+    for (auto it = part.writes.begin(); it != part.writes.end(); ++it)
+      if (!assigned.count(*it) && !(also && *it == *also))
+        carried = part.names.find(*it)->second;
+  };
+  for (size_t i = 0; i < count && carried.empty(); i++) {
+    StatementNode *statement = plan->statements[i];
+    Uses part;
+    if (reduction_at[i] >= 0) {
+      collect(plan->reductions[reduction_at[i]].record, part);
+      check(part, nullptr);
+    } else if (AssignmentStatementNode *assignment =
+                   dynamic_cast<AssignmentStatementNode *>(statement)) {
+      collect(assignment->assignment_expr, part);
+      check(part, nullptr);
+      assigned.insert(scalar(assignment->identifier, assignment->frame_slot));
+    } else if (ForStatementNode *inner =
+                   dynamic_cast<ForStatementNode *>(statement)) {
+      Scalar inner_counter = scalar(inner->identifier, inner->frame_slot);
+      Uses bounds;
+      collect(inner->start_expression, bounds);
+      collect(inner->end_expression, bounds);
+      if (!assigned.count(inner_counter))
+        for (auto it = bounds.reads.begin(); it != bounds.reads.end(); ++it)
+          if (body.writes.count(*it) || *it == counter)
+            carried = inner->identifier;
+      check(bounds, nullptr);
+      collect(inner->for_statement, part);
+      check(part, &inner_counter);
+      assigned.insert(inner_counter);
+    } else {
+      check(uses[i], nullptr);
+    }
+  }
+  if (!carried.empty()) {
+    why_serial = carried + " may carry a value between iterations";
+    return nullptr;
+  }
+
+  for (auto it = body.writes.begin(); it != body.writes.end(); ++it)
+    if (!reduced.count(*it))
+      plan->privates.push_back(*it);
+  plan->privates.push_back(counter);
+  return plan.release();
+}
+
+// Gives each worker its own copy of the body. Private globals move into
+// frame slots after the frame_extent slots of the frame, followed by one
+// slot per reduction that receives the iteration's record.
+static void build_worker_bodies(ParallelLoop *plan, size_t frame_extent,
+                                int workers) {
+  for (auto it = plan->worker_bodies.begin(); it != plan->worker_bodies.end();
+       ++it)
+    delete (*it);
+  plan->worker_bodies.clear();
+
+  int slot = frame_extent;
+  for (auto it = plan->privates.begin(); it != plan->privates.end(); ++it)
+    if (it->second < 0)
+      cloneGlobalSlots[it->first] = slot++;
+
+  int level = plan->loop->_level + 1;
+  for (int worker = 0; worker < workers; worker++) {
+    CompoundStatementNode *body = new CompoundStatementNode(level);
+    for (size_t i = 0; i < plan->statements.size(); i++) {
+      size_t r = 0;
+      while (r < plan->reductions.size() && plan->reductions[r].statement != i)
+        r++;
+      if (r == plan->reductions.size()) {
+        body->statement_vector.push_back(plan->statements[i]->clone(0));
+        continue;
+      }
+      AssignmentStatementNode *record = new AssignmentStatementNode(level + 1);
+      record->identifier = "reduction";
+      record->frame_slot = slot + r;
+      record->assignment_expr = plan->reductions[r].record->clone(0);
+      body->statement_vector.push_back(record);
+    }
+    plan->worker_bodies.push_back(body);
+  }
+  cloneGlobalSlots.clear();
+  plan->frame_extent = frame_extent;
+}
+
+// Applies one iteration's record to the variable, as the reduction
+// statement does, and returns that statement's result.
+static float fold(const Reduction &reduction, float *variable, float record) {
+  switch (reduction.op) {
+  case TOK_PLUS:
+    return *variable += record;
+  case TOK_MINUS:
+    return *variable -= record;
+  default:
+    break;
+  }
+  float taken = reduction.variable_first
+                    ? compare_values(reduction.op, *variable, record)
+                    : compare_values(reduction.op, record, *variable);
+  if (taken != 1.0)
+    return 0.0;
+  return *variable = record;
+}
+
+static float *scalar_storage(const Scalar &var) {
+  if (var.second >= 0)
+    return &callStack[framePointer + var.second];
+  auto global = symbolTable.find(var.first);
+  return global == symbolTable.end() ? nullptr : &global->second;
+}
+
+bool run_parallel_loop(ParallelLoop *plan, float *counter, float first,
+                       long trips, float &result) {
+  int workers = pool_size();
+  if (workers < 2 || trips < 2 || pool_running() ||
+      (!plan->has_inner_loop && trips < minParallelTrips))
+    return false;
+
+  // Workers compute the counter for an iteration directly instead of by
+  // repeated steps, which gives the same floats only for whole numbers.
+  ForStatementNode *loop = plan->loop;
+  float step = loop->is_downto ? -1.0 : 1.0;
+  double last = (double)first + (double)step * (trips - 1);
+  if (first != std::floor(first) || std::fabs(first) > exactIntegers ||
+      std::fabs(last) > exactIntegers)
+    return false;
+
+  size_t frame = framePointer;
+  size_t frame_extent = stackTop - frame;
+  size_t slot = frame_extent;
+  std::vector<float *> private_storage;
+  std::vector<size_t> private_slots;
+  for (auto it = plan->privates.begin(); it != plan->privates.end(); ++it) {
+    float *storage = scalar_storage(*it);
+    if (!storage)
+      return false;
+    private_storage.push_back(storage);
+    private_slots.push_back(it->second >= 0 ? it->second : slot++);
+  }
+  size_t counter_slot = private_slots.back();
+  std::vector<float *> reduction_storage;
+  for (auto it = plan->reductions.begin(); it != plan->reductions.end(); ++it) {
+    reduction_storage.push_back(scalar_storage(it->variable));
+    if (!reduction_storage.back())
+      return false;
+  }
+  size_t record_slot = slot;
+  size_t region_size = record_slot + plan->reductions.size();
+  size_t regions = stackTop;
+  if (regions + workers * region_size > stackLimit)
+    return false;
+  if ((int)plan->worker_bodies.size() != workers ||
+      plan->frame_extent != frame_extent)
+    build_worker_bodies(plan, frame_extent, workers);
+
+  size_t reductions = plan->reductions.size();
+  bool last_is_reduction =
+      reductions && plan->reductions.back().statement ==
+                        plan->statements.size() - 1;
+  std::vector<std::vector<float>> records(reductions);
+  std::vector<float> block_last(plan->privates.size());
+  std::vector<std::vector<float>> saved(plan->written_arrays.size());
+  std::vector<long> saved_from(plan->written_arrays.size());
+  float block_result = 0.0;
+  std::atomic<bool> failed(false);
+
+  for (long done = 0; done < trips; done += parallelBlock) {
+    long count = std::min(parallelBlock, trips - done);
+    float block_first = first + step * done;
+    long count_last = count - 1;
+
+    // Every worker starts from the state the block's first iteration sees.
+    for (int worker = 0; worker < workers; worker++) {
+      float *region = &callStack[regions + worker * region_size];
+      std::copy(callStack.begin() + frame,
+                callStack.begin() + frame + frame_extent, region);
+      for (size_t i = 0; i < private_slots.size(); i++)
+        region[private_slots[i]] = *private_storage[i];
+    }
+    // Keep the elements the block writes in case it has to run again.
+    float block_end = block_first + step * count_last;
+    long low_index = std::lrint(std::min(block_first, block_end));
+    long high_index = std::lrint(std::max(block_first, block_end));
+    for (size_t a = 0; a < saved.size(); a++) {
+      ArrayVariable *array = plan->written_arrays[a];
+      long from = std::max(low_index - array->low, 0L);
+      long to = std::min(high_index - array->low, array->size - 1);
+      saved_from[a] = from;
+      saved[a].clear();
+      if (from <= to)
+        saved[a].assign(array->elements + from, array->elements + to + 1);
+    }
+    for (size_t r = 0; r < reductions; r++)
+      records[r].resize(count);
+
+    std::vector<unsigned long> worker_statements(workers, 0);
+    pool_run(count, std::max(count / (workers * 16), 1L),
+             [&](int worker, long begin, long end) {
+      unsigned long statements_before = statementsExecuted;
+      size_t base = regions + worker * region_size;
+      float *region = &callStack[base];
+      StatementNode *body = plan->worker_bodies[worker];
+      framePointer = base;
+      long ran = 0;
+      for (long k = begin; k < end && !failed; k++) {
+        region[counter_slot] = block_first + step * k;
+        float value = 0.0;
+        ran++;
+        try {
+          value = body->interpret();
+        } catch (...) {
+          failed = true;
+          break;
+        }
+        for (size_t r = 0; r < reductions; r++)
+          records[r][k] = region[record_slot + r];
+        if (k == count_last) {
+          block_result = value;
+          for (size_t i = 0; i < private_slots.size(); i++)
+            block_last[i] = region[private_slots[i]];
+        }
+      }
+      // Each iteration begun ran the worker body's compound instead of the
+      // compound statements flattened into it.
+      statementsExecuted += ran * plan->flattened_compounds;
+      statementsExecuted -= ran;
+      if (worker != 0)
+        worker_statements[worker] += statementsExecuted - statements_before;
+    });
+    framePointer = frame;
+    for (int w = 1; w < workers; w++)
+      statementsExecuted += worker_statements[w];
+
+    // An error: undo the block and run the rest serially, which stops at
+    // the same iteration with the same state.
+    if (failed) {
+      for (size_t a = 0; a < saved.size(); a++)
+        std::copy(saved[a].begin(), saved[a].end(),
+                  plan->written_arrays[a]->elements + saved_from[a]);
+      result = loop->run_loop(counter, block_first, trips - done);
+      return true;
+    }
+
+    float folded = 0.0;
+    for (long k = 0; k < count; k++)
+      for (size_t r = 0; r < reductions; r++)
+        folded = fold(plan->reductions[r], reduction_storage[r], records[r][k]);
+    for (size_t i = 0; i < private_storage.size(); i++)
+      *private_storage[i] = block_last[i];
+    result = last_is_reduction ? folded : block_result;
+  }
+  return true;
+}
@@ -0,0 +1,70 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "parse_tree_nodes.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+// A scalar variable: a global by name with slot -1, or a slot of the current
+// frame with an empty name.
+typedef std::pair<std::string, int> Scalar;
+
+// S := S + E, S := E + S or S := S - E, and IF E op M THEN M := E (or with
+// the operands of op swapped). Each iteration only records E; the records
+// are folded into the variable afterwards in iteration order, so the result
+// is the same as running the loop serially.
+struct Reduction {
+  Scalar variable;
+  size_t statement = 0; // index in ParallelLoop::statements
+  int op = TOK_PLUS;    // TOK_PLUS, TOK_MINUS or a relational operator
+  bool variable_first = true;
+  ExpressionNode *record = nullptr; // E
+};
+
+// A FOR loop whose iterations are independent apart from its reductions.
+struct ParallelLoop {
+  ForStatementNode *loop = nullptr;
+  // The body with nested compound statements flattened.
+  std::vector<StatementNode *> statements;
+  size_t flattened_compounds = 0;
+  std::vector<Reduction> reductions;
+  // Scalars written by each iteration, which get a copy per worker. The
+  // counter is one of them.
+  std::vector<Scalar> privates;
+  std::vector<ArrayVariable *> written_arrays;
+  bool has_inner_loop = false;
+
+  // Worker copies of the body, made for a frame of frame_extent slots.
+  size_t frame_extent = 0;
+  std::vector<StatementNode *> worker_bodies;
+
+  ~ParallelLoop();
+};
+
+// One line per FOR loop parsed, saying whether it can run in parallel or why
+// not; printed by --report-parallel.
+extern std::vector<std::string> parallelReport;
+
+// Decides at parse time whether the iterations of loop are independent.
+// Returns nullptr, with the reason in why_serial, when they may not be.
+ParallelLoop *plan_parallel_loop(ForStatementNode *loop,
+                                 std::string &why_serial);
+
+// True when one of statements writes a variable or array that another uses,
+// counting the globals of procedures they call, or two of them READ.
+bool statements_share_variables(const std::vector<StatementNode *> &statements);
+
+// True when two of statements call the same procedure and it has a FOR loop
+// whose bounds check is hoisted: the loop keeps the outcome of the check in
+// its node, so the two calls may not run it at the same time.
+bool statements_share_loop_checks(
+    const std::vector<StatementNode *> &statements);
+
+// Runs trips iterations of a planned loop on the work pool, leaving the same
+// state and result as ForStatementNode::run_loop. Returns false, having done
+// nothing, when the loop has to run serially this time.
+bool run_parallel_loop(ParallelLoop *plan, float *counter, float first,
+                       long trips, float &result);
+
+#endif /* PARALLEL_H */
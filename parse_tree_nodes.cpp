@@ -1,12 +1,58 @@
 #define EPSILON 0.001
 
 #include "parse_tree_nodes.h"
+#include "checkpoint.h"
+#include "closed_form.h"
+#include "input.h"
 #include "lexer.h"
+#include "number_format.h"
+#include "output.h"
+#include "parallel.h"
 #include "parser.h"
+#include "quicken.h"
+#include "work_pool.h"
+#include <cmath>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <memory>
 #include <ostream>
+#include <sstream>
+#include <stdint.h>
+#include <sys/resource.h>
 
 extern std::map<std::string, float> symbolTable;
 
+// TOK_BREAK or TOK_CONTINUE while a loop exit is unwinding to its loop.
+static thread_local int pendingLoopExit = 0;
+
+thread_local std::ostream *programOutput = &std::cout;
+thread_local unsigned long statementsExecuted = 0;
+bool countStatements = false;
+unsigned long nodesCreated = 0;
+
+// Target of skip_check for array accesses that always check their bounds.
+static const bool neverSkipCheck = false;
+
+std::map<std::string, int> cloneGlobalSlots;
+
+// While a FOR loop is cloned, maps its bounds_verified to the copy's so the
+// copied accesses keep their hoisted checks.
+static std::map<const bool *, const bool *> clonedChecks;
+
+static int moved_slot(const std::string &name, int frame_slot,
+                      int slot_offset) {
+  if (frame_slot >= 0)
+    return frame_slot + slot_offset;
+  auto slot = cloneGlobalSlots.find(name);
+  return slot == cloneGlobalSlots.end() ? -1 : slot->second;
+}
+
+static const bool *cloned_check(const bool *skip_check) {
+  auto check = clonedChecks.find(skip_check);
+  return check == clonedChecks.end() ? skip_check : check->second;
+}
+
 static void indent(int level) {
   for (int i = 0; i < level; i++)
     std::cout << ("|  ");
@@ -23,16 +69,27 @@ std::ostream &operator<<(std::ostream &os, ProgramNode &pn) {
   os << "program) ";
   return os;
 }
-float ProgramNode::interpret() { return program_block->interpret(); }
+float ProgramNode::interpret() {
+  framePointer = 0;
+  stackTop = frame_size;
+  return program_block->interpret();
+}
 
 BlockNode::BlockNode(int level) { _level = level; }
-BlockNode::~BlockNode() {}
+BlockNode::~BlockNode() {
+  for (auto it = procedures.begin(); it != procedures.end(); ++it)
+    delete (*it);
+}
 
 std::ostream &operator<<(std::ostream &os, BlockNode &bn) {
   os << std::endl;
   indent(bn._level);
   os << "(block ";
   os << std::endl;
+  for (auto it = bn.procedures.begin(); it != bn.procedures.end(); ++it) {
+    (*it)->printTo(os);
+    os << std::endl;
+  }
   bn.compound_stmt->printTo(os);
   os << std::endl;
   indent(bn._level);
@@ -61,38 +118,206 @@ void CompoundStatementNode::printTo(std::ostream &os) {
 }
 
 float CompoundStatementNode::interpret() {
+  if (countStatements)
+    statementsExecuted++;
+  if (checkpointActive)
+    return interpret_checkpointed();
+
   float result = 0.0;
+  if (has_loop_exit) {
+    for (auto it = statement_vector.begin(); it != statement_vector.end();
+         ++it) {
+      result = (*it)->interpret();
+      if (pendingLoopExit)
+        break;
+    }
+    return result;
+  }
+
   for (auto it = statement_vector.begin(); it != statement_vector.end(); ++it)
     result = (*it)->interpret();
 
   return result;
 }
 
-StatementNode::StatementNode() {}
+float CompoundStatementNode::interpret_checkpointed() {
+  float result = 0.0;
+  long start = 0;
+  bool resumed = checkpoint_resume_next(start);
+
+  checkpointPosition.push_back(start);
+  for (size_t i = start; i < statement_vector.size(); i++) {
+    checkpointPosition.back() = i;
+    if (!resumed)
+      checkpoint_poll();
+    resumed = false;
+    result = statement_vector[i]->interpret();
+    if (pendingLoopExit)
+      break;
+  }
+  checkpointPosition.pop_back();
+
+  return result;
+}
+
+StatementNode *CompoundStatementNode::clone(int slot_offset) {
+  CompoundStatementNode *copy = new CompoundStatementNode(_level);
+  copy->line = line;
+  copy->has_loop_exit = has_loop_exit;
+  for (auto it = statement_vector.begin(); it != statement_vector.end(); ++it)
+    copy->statement_vector.push_back((*it)->clone(slot_offset));
+  return copy;
+}
+
+CobeginStatementNode::CobeginStatementNode(int level)
+    : CompoundStatementNode(level) {}
+
+void CobeginStatementNode::printTo(std::ostream &os) {
+  indent(_level);
+  os << "(cobegin_stmt ";
+  os << std::endl;
+  for (auto it = statement_vector.begin(); it != statement_vector.end(); ++it) {
+    (*it)->printTo(os);
+    os << std::endl;
+  }
+  indent(_level);
+  os << "cobegin_stmt) ";
+}
+
+// Each statement gets an equal part of the call stack left above the frame
+// for its own calls. A statement that fails stops the output after its own;
+// the first failure in statement order is the one reported.
+float CobeginStatementNode::interpret() {
+  size_t count = statement_vector.size();
+  if (in_order || checkpointActive || count < 2 || pool_size() < 2 ||
+      pool_running())
+    return CompoundStatementNode::interpret();
+  if (countStatements)
+    statementsExecuted++;
+
+  std::unique_ptr<std::ostringstream[]> output(new std::ostringstream[count]);
+  std::vector<unsigned long> worker_statements(pool_size(), 0);
+  std::vector<const char *> errors(count, nullptr);
+  std::vector<float> results(count, 0.0);
+  size_t frame = framePointer;
+  size_t top = stackTop;
+  size_t limit = stackLimit;
+  size_t share = (limit - top) / count;
+  std::ostream *out = programOutput;
+  // The first statement to fail. Run in order, the program would stop
+  // there, so the statements after it that have not started are skipped.
+  std::atomic<size_t> first_failed(count);
+  auto failed = [&](size_t k, const char *errmsg) {
+    errors[k] = errmsg;
+    size_t seen = first_failed.load();
+    while (k < seen && !first_failed.compare_exchange_weak(seen, k)) {
+    }
+  };
+
+  pool_run(count, 1, [&](int worker, long begin, long end) {
+    unsigned long statements_before = statementsExecuted;
+    for (long k = begin; k < end; k++) {
+      if ((size_t)k > first_failed.load())
+        continue;
+      framePointer = frame;
+      stackTop = top + k * share;
+      stackLimit = stackTop + share;
+      programOutput = &output[k];
+      try {
+        results[k] = statement_vector[k]->interpret();
+      } catch (char const *errmsg) {
+        failed(k, errmsg);
+      } catch (...) {
+        failed(k, "COBEGIN statement failed");
+      }
+    }
+    if (worker != 0)
+      worker_statements[worker] += statementsExecuted - statements_before;
+  });
+  for (size_t w = 1; w < worker_statements.size(); w++)
+    statementsExecuted += worker_statements[w];
+  framePointer = frame;
+  stackTop = top;
+  stackLimit = limit;
+  programOutput = out;
+
+  for (size_t k = 0; k < count; k++) {
+    *out << output[k].str();
+    if (errors[k])
+      throw(errors[k]);
+  }
+  return results[count - 1];
+}
+
+StatementNode *CobeginStatementNode::clone(int slot_offset) {
+  CobeginStatementNode *copy = new CobeginStatementNode(_level);
+  copy->line = line;
+  copy->in_order = in_order;
+  for (auto it = statement_vector.begin(); it != statement_vector.end(); ++it)
+    copy->statement_vector.push_back((*it)->clone(slot_offset));
+  return copy;
+}
+
+StatementNode::StatementNode() { nodesCreated++; }
 StatementNode::~StatementNode() {}
 
 WriteStatementNode::WriteStatementNode(int level) { _level = level; }
-WriteStatementNode::~WriteStatementNode() {}
+WriteStatementNode::~WriteStatementNode() { delete element; }
 
 void WriteStatementNode::printTo(std::ostream &os) {
   indent(_level);
-  os << "(write_stmt ( " << write_text << " ) \n";
+  if (element) {
+    os << "(write_stmt ( \n";
+    element->printTo(os);
+    os << " ) \n";
+  } else {
+    os << "(write_stmt ( " << write_text << " ) \n";
+  }
   indent(_level);
   os << "write_stmt) ";
 }
 
+// Writes value and a newline as programOutput << value << "\n" would.
+static void write_number(float value) {
+  char text[numberTextSize];
+  size_t length = format_number(value, text);
+  text[length++] = '\n';
+  programOutput->write(text, length);
+}
+
 float WriteStatementNode::interpret() {
+  if (countStatements)
+    statementsExecuted++;
+  if (element) {
+    write_number(element->interpret());
+    return 0.0;
+  }
+  if (frame_slot >= 0) {
+    write_number(callStack[framePointer + frame_slot]);
+    return 0.0;
+  }
   if (is_identifier) {
     auto var = symbolTable.find(write_text);
     if (var == symbolTable.end())
       throw("Write failed: variable not found");
-    cout << var->second << "\n";
+    write_number(var->second);
     return 0.0;
   }
-  std::cout << write_text << "\n";
+  *programOutput << write_text << "\n";
   return 0.0;
 }
 
+StatementNode *WriteStatementNode::clone(int slot_offset) {
+  WriteStatementNode *copy = new WriteStatementNode(_level);
+  copy->line = line;
+  copy->is_identifier = is_identifier;
+  copy->write_text = write_text;
+  copy->frame_slot = moved_slot(write_text, frame_slot, slot_offset);
+  if (element)
+    copy->element = element->clone(slot_offset);
+  return copy;
+}
+
 ReadStatementNode::ReadStatementNode(int level) { _level = level; }
 ReadStatementNode::~ReadStatementNode() {}
 
@@ -104,15 +329,171 @@ void ReadStatementNode::printTo(std::ostream &os) {
 }
 
 float ReadStatementNode::interpret() {
-  std::string input;
-  cin >> input;
+  if (countStatements)
+    statementsExecuted++;
+  output_flush_for_input();
+  float value = input_read_value();
+  inputValuesConsumed++;
+  if (frame_slot >= 0)
+    return callStack[framePointer + frame_slot] = value;
   auto var = symbolTable.find(read_text);
   if (var == symbolTable.end())
     throw("Read failed: identifier not found");
-  var->second = std::stof(input);
+  var->second = value;
   return var->second;
 }
 
+StatementNode *ReadStatementNode::clone(int slot_offset) {
+  ReadStatementNode *copy = new ReadStatementNode(_level);
+  copy->line = line;
+  copy->read_text = read_text;
+  copy->frame_slot = moved_slot(read_text, frame_slot, slot_offset);
+  return copy;
+}
+
+ProcedureNode::ProcedureNode(int level, std::string proc_name) {
+  _level = level;
+  name = proc_name;
+}
+ProcedureNode::~ProcedureNode() { delete body; }
+
+void ProcedureNode::printTo(std::ostream &os) {
+  indent(_level);
+  os << "(procedure ( " << name;
+  if (param_count > 0) {
+    os << " (";
+    for (int i = 0; i < param_count; i++)
+      os << " " << local_names[i];
+    os << " )";
+  }
+  os << " ) \n";
+  body->printTo(os);
+  os << std::endl;
+  indent(_level);
+  os << "procedure) ";
+}
+
+// Procedure calls also recurse on the native stack, so deep recursion is
+// stopped once half of it is used rather than left to overflow.
+bool native_stack_exhausted() {
+  static thread_local uintptr_t base = 0;
+  static thread_local uintptr_t limit = 0;
+  char here;
+  uintptr_t address = (uintptr_t)&here;
+  if (limit == 0) {
+    struct rlimit stack_limit;
+    size_t size = 8 << 20;
+    if (getrlimit(RLIMIT_STACK, &stack_limit) == 0 &&
+        stack_limit.rlim_cur != RLIM_INFINITY)
+      size = stack_limit.rlim_cur;
+    limit = size / 2;
+  }
+  // The shallowest call seen so far marks the base of the stack.
+  if (address > base)
+    base = address;
+  return base - address > limit;
+}
+
+CallStatementNode::CallStatementNode(int level, ProcedureNode *proc) {
+  _level = level;
+  procedure = proc;
+}
+CallStatementNode::~CallStatementNode() {
+  for (auto it = arguments.begin(); it != arguments.end(); ++it)
+    delete (*it);
+}
+
+void CallStatementNode::printTo(std::ostream &os) {
+  indent(_level);
+  os << "(call_stmt ( " << procedure->name << " ) \n";
+  for (auto it = arguments.begin(); it != arguments.end(); ++it) {
+    (*it)->printTo(os);
+    os << std::endl;
+  }
+  indent(_level);
+  os << "call_stmt) ";
+}
+
+// The callee frame starts at stackTop: arguments, then zeroed locals. When
+// checkpointing, the frame start is the call's position entry.
+float CallStatementNode::interpret() {
+  if (countStatements)
+    statementsExecuted++;
+  long entry = 0;
+  bool resumed = checkpoint_resume_next(entry);
+  size_t frame = resumed ? entry : stackTop;
+  size_t frame_end = frame + procedure->frame_size;
+  if (!resumed) {
+    if (frame_end > stackLimit || native_stack_exhausted())
+      throw("Procedure call failed: call stack overflow");
+    for (size_t i = 0; i < arguments.size(); i++)
+      callStack[frame + i] = arguments[i]->interpret();
+    std::fill(callStack.begin() + frame + arguments.size(),
+              callStack.begin() + frame_end, 0.0f);
+  }
+
+  size_t caller = framePointer;
+  framePointer = frame;
+  stackTop = frame_end;
+  if (checkpointActive)
+    checkpointPosition.push_back(frame);
+  float result = procedure->body->interpret();
+  if (checkpointActive)
+    checkpointPosition.pop_back();
+  framePointer = caller;
+  stackTop = frame;
+  return result;
+}
+
+StatementNode *CallStatementNode::clone(int slot_offset) {
+  CallStatementNode *copy = new CallStatementNode(_level, procedure);
+  copy->line = line;
+  for (auto it = arguments.begin(); it != arguments.end(); ++it)
+    copy->arguments.push_back((*it)->clone(slot_offset));
+  return copy;
+}
+
+ArrayAssignmentStatementNode::ArrayAssignmentStatementNode(
+    int level, ArrayVariable *var) {
+  _level = level;
+  array = var;
+  skip_check = &neverSkipCheck;
+}
+ArrayAssignmentStatementNode::~ArrayAssignmentStatementNode() {
+  delete index_expression;
+  delete assignment_expr;
+}
+
+void ArrayAssignmentStatementNode::printTo(std::ostream &os) {
+  indent(_level);
+  os << "(array_assignment_stmt ( " << array->name << " [ ) \n";
+  index_expression->printTo(os);
+  os << std::endl;
+  indent(_level);
+  os << "] := \n";
+  assignment_expr->printTo(os);
+  os << std::endl;
+  indent(_level);
+  os << "array_assignment_stmt) ";
+}
+
+float ArrayAssignmentStatementNode::interpret() {
+  if (countStatements)
+    statementsExecuted++;
+  float *element = array->element(index_expression->interpret(), !*skip_check);
+  return *element = assignment_expr->interpret();
+}
+
+StatementNode *ArrayAssignmentStatementNode::clone(int slot_offset) {
+  ArrayAssignmentStatementNode *copy =
+      new ArrayAssignmentStatementNode(_level, array);
+  copy->line = line;
+  copy->index_expression = index_expression->clone(slot_offset);
+  copy->assignment_expr = assignment_expr->clone(slot_offset);
+  copy->skip_check = cloned_check(skip_check);
+  return copy;
+}
+
 AssignmentStatementNode::AssignmentStatementNode(int level) { _level = level; }
 AssignmentStatementNode::~AssignmentStatementNode() { delete assignment_expr; }
 
@@ -126,6 +507,17 @@ void AssignmentStatementNode::printTo(std::ostream &os) {
 }
 
 float AssignmentStatementNode::interpret() {
+  float (*run)(AssignmentStatementNode *) = quick.load(std::memory_order_acquire);
+  if (!run)
+    run = quicken(this);
+  return run(this);
+}
+
+float AssignmentStatementNode::evaluate() {
+  if (countStatements)
+    statementsExecuted++;
+  if (frame_slot >= 0)
+    return callStack[framePointer + frame_slot] = assignment_expr->interpret();
   auto var = symbolTable.find(identifier);
   if (var == symbolTable.end())
     throw("Variable assignment failed: Variable not found");
@@ -133,6 +525,15 @@ float AssignmentStatementNode::interpret() {
   return var->second;
 }
 
+StatementNode *AssignmentStatementNode::clone(int slot_offset) {
+  AssignmentStatementNode *copy = new AssignmentStatementNode(_level);
+  copy->line = line;
+  copy->identifier = identifier;
+  copy->frame_slot = moved_slot(identifier, frame_slot, slot_offset);
+  copy->assignment_expr = assignment_expr->clone(slot_offset);
+  return copy;
+}
+
 IfStatementNode::IfStatementNode(int level) { _level = level; }
 IfStatementNode::~IfStatementNode() {
   delete if_expression;
@@ -166,15 +567,88 @@ void IfStatementNode::printTo(std::ostream &os) {
 }
 
 float IfStatementNode::interpret() {
-  if (if_expression->interpret() > EPSILON)
+  if (countStatements)
+    statementsExecuted++;
+  if (checkpointActive)
+    return interpret_checkpointed();
+
+  float condition = if_expression->interpret();
+  if (integer_condition ? condition > 0.0f : condition > EPSILON)
     return then_statement->interpret();
   else if (has_else)
     return else_statement->interpret();
   return 0.0;
 }
 
+float IfStatementNode::interpret_checkpointed() {
+  long entry = 0;
+  if (!checkpoint_resume_next(entry)) {
+    float condition = if_expression->interpret();
+    bool holds = integer_condition ? condition > 0.0f : condition > EPSILON;
+    entry = holds ? 1 : 2;
+  }
+
+  float result = 0.0;
+  checkpointPosition.push_back(entry);
+  if (entry == 1)
+    result = then_statement->interpret();
+  else if (has_else)
+    result = else_statement->interpret();
+  checkpointPosition.pop_back();
+  return result;
+}
+
+StatementNode *IfStatementNode::clone(int slot_offset) {
+  IfStatementNode *copy = new IfStatementNode(_level);
+  copy->line = line;
+  copy->has_loop_exit = has_loop_exit;
+  copy->if_expression = if_expression->clone(slot_offset);
+  copy->then_statement = then_statement->clone(slot_offset);
+  copy->has_else = has_else;
+  if (has_else)
+    copy->else_statement = else_statement->clone(slot_offset);
+  copy->integer_condition = integer_condition;
+  return copy;
+}
+
+// Clears the pending exit once it reaches the loop it belongs to.
+static int take_loop_exit() {
+  int exit_token = pendingLoopExit;
+  pendingLoopExit = 0;
+  return exit_token;
+}
+
+LoopExitStatementNode::LoopExitStatementNode(int level, int token) {
+  _level = level;
+  exit_token = token;
+  has_loop_exit = true;
+}
+LoopExitStatementNode::~LoopExitStatementNode() {}
+
+void LoopExitStatementNode::printTo(std::ostream &os) {
+  indent(_level);
+  if (exit_token == TOK_BREAK)
+    os << "(break_stmt) ";
+  else
+    os << "(continue_stmt) ";
+}
+
+float LoopExitStatementNode::interpret() {
+  if (countStatements)
+    statementsExecuted++;
+  pendingLoopExit = exit_token;
+  return 0.0;
+}
+
+StatementNode *LoopExitStatementNode::clone(int slot_offset) {
+  LoopExitStatementNode *copy = new LoopExitStatementNode(_level, exit_token);
+  copy->line = line;
+  return copy;
+}
+
 WhileStatementNode::WhileStatementNode(int level) { _level = level; }
 WhileStatementNode::~WhileStatementNode() {
+  delete closed_form;
   delete while_statement;
   delete while_expression;
 }
@@ -192,13 +666,247 @@ void WhileStatementNode::printTo(std::ostream &os) {
 }
 
 float WhileStatementNode::interpret() {
+  if (countStatements)
+    statementsExecuted++;
+  if (checkpointActive)
+    return interpret_checkpointed();
+
   float result = 0.0;
+  if (closed_form && run_closed_form(closed_form, result))
+    return result;
+  if (while_statement->has_loop_exit) {
+    while (while_expression->interpret() == 1.0) {
+      result = while_statement->interpret();
+      if (pendingLoopExit && take_loop_exit() == TOK_BREAK)
+        break;
+    }
+    return result;
+  }
+
   while (while_expression->interpret() == 1.0)
     result = while_statement->interpret();
   return result;
 }
 
-ExpressionNode::ExpressionNode(int level) { _level = level; }
+float WhileStatementNode::interpret_checkpointed() {
+  float result = 0.0;
+  long entry = 0;
+  bool resumed = checkpoint_resume_next(entry);
+
+  checkpointPosition.push_back(entry);
+  if (resumed && entry == 1) {
+    result = while_statement->interpret();
+    if (pendingLoopExit && take_loop_exit() == TOK_BREAK) {
+      checkpointPosition.pop_back();
+      return result;
+    }
+  }
+  for (;;) {
+    checkpointPosition.back() = 0;
+    if (!resumed || entry == 1)
+      checkpoint_poll();
+    resumed = false;
+    if (while_expression->interpret() != 1.0)
+      break;
+    checkpointPosition.back() = 1;
+    result = while_statement->interpret();
+    if (pendingLoopExit && take_loop_exit() == TOK_BREAK)
+      break;
+  }
+  checkpointPosition.pop_back();
+  return result;
+}
+
+StatementNode *WhileStatementNode::clone(int slot_offset) {
+  WhileStatementNode *copy = new WhileStatementNode(_level);
+  copy->line = line;
+  copy->while_expression = while_expression->clone(slot_offset);
+  copy->while_statement = while_statement->clone(slot_offset);
+  return copy;
+}
+
+ForStatementNode::ForStatementNode(int level) { _level = level; }
+ForStatementNode::~ForStatementNode() {
+  delete parallel;
+  delete start_expression;
+  delete end_expression;
+  delete for_statement;
+}
+
+void ForStatementNode::printTo(std::ostream &os) {
+  indent(_level);
+  os << "(for_stmt ( " << identifier << " := ) \n";
+  start_expression->printTo(os);
+  os << std::endl;
+  indent(_level);
+  os << (is_downto ? "DOWNTO " : "TO ");
+  os << std::endl;
+  end_expression->printTo(os);
+  os << std::endl;
+  for_statement->printTo(os);
+  os << std::endl;
+  indent(_level);
+  os << "for_stmt) ";
+}
+
+// Number of times the body runs; the bounds are evaluated once, so this is
+// fixed before the first iteration. Spans too large for a long, infinite
+// ones included, give LONG_MAX: the loop runs until it is left.
+long for_trip_count(float first, float last, bool is_downto) {
+  double span = is_downto ? (double)first - last : (double)last - first;
+  if (!(span >= 0.0))
+    return 0;
+  if (span >= 9.2e18)
+    return LONG_MAX;
+  return (long)std::floor(span) + 1;
+}
+
+float *ForStatementNode::counter_storage() {
+  if (frame_slot >= 0)
+    return &callStack[framePointer + frame_slot];
+  auto var = symbolTable.find(identifier);
+  if (var == symbolTable.end())
+    throw("For loop failed: Variable not found");
+  return &var->second;
+}
+
+// True when every value the counter takes is a valid index of every array
+// in hoisted_arrays.
+bool ForStatementNode::counter_in_bounds(float first, long trips) {
+  if (trips <= 0)
+    return false;
+  double last = (double)first + (is_downto ? 1 - trips : trips - 1);
+  long low = std::lrint(is_downto ? last : first);
+  long high = std::lrint(is_downto ? first : last);
+  for (auto it = hoisted_arrays.begin(); it != hoisted_arrays.end(); ++it)
+    if (low < (*it)->low || high >= (*it)->low + (*it)->size)
+      return false;
+  return true;
+}
+
+float ForStatementNode::interpret() {
+  if (countStatements)
+    statementsExecuted++;
+  if (checkpointActive)
+    return interpret_checkpointed();
+
+  float *counter = counter_storage();
+  float value = start_expression->interpret();
+  float last = end_expression->interpret();
+  long trips = for_trip_count(value, last, is_downto);
+
+  // A recursive procedure can reenter this loop, so keep the outer state.
+  bool outer_verified = bounds_verified;
+  if (!hoisted_arrays.empty())
+    bounds_verified = counter_in_bounds(value, trips);
+  float result = 0.0;
+  if (!parallel || !run_parallel_loop(parallel, counter, value, trips, result))
+    result = run_loop(counter, value, trips);
+  bounds_verified = outer_verified;
+  return result;
+}
+
+float ForStatementNode::run_loop(float *counter, float value, long trips) {
+  float step = is_downto ? -1.0 : 1.0;
+  float result = 0.0;
+  if (for_statement->has_loop_exit) {
+    for (; trips > 0; trips--) {
+      *counter = value;
+      result = for_statement->interpret();
+      if (pendingLoopExit && take_loop_exit() == TOK_BREAK)
+        break;
+      value += step;
+    }
+    return result;
+  }
+
+  for (; trips > 0; trips--) {
+    *counter = value;
+    result = for_statement->interpret();
+    value += step;
+  }
+  return result;
+}
+
+float ForStatementNode::interpret_checkpointed() {
+  float *counter = counter_storage();
+  float step = is_downto ? -1.0 : 1.0;
+
+  // Position entries: bits of the current value, iterations left, then
+  // 0 before the body or 1 inside it.
+  long bits = 0, trips = 0, entry = 0;
+  int32_t raw = 0;
+  float value = 0.0;
+  bool resumed = checkpoint_resume_next(bits);
+  if (resumed) {
+    checkpoint_resume_next(trips);
+    checkpoint_resume_next(entry);
+    raw = bits;
+    memcpy(&value, &raw, sizeof(value));
+  } else {
+    value = start_expression->interpret();
+    float last = end_expression->interpret();
+    trips = for_trip_count(value, last, is_downto);
+  }
+
+  float result = 0.0;
+  size_t top = checkpointPosition.size();
+  checkpointPosition.resize(top + 3);
+  if (resumed && entry == 1) {
+    checkpointPosition[top] = bits;
+    checkpointPosition[top + 1] = trips;
+    checkpointPosition[top + 2] = 1;
+    result = for_statement->interpret();
+    if (pendingLoopExit && take_loop_exit() == TOK_BREAK) {
+      checkpointPosition.resize(top);
+      return result;
+    }
+    value += step;
+    trips--;
+  }
+  for (; trips > 0; trips--) {
+    memcpy(&raw, &value, sizeof(raw));
+    checkpointPosition[top] = raw;
+    checkpointPosition[top + 1] = trips;
+    checkpointPosition[top + 2] = 0;
+    if (!resumed || entry == 1)
+      checkpoint_poll();
+    resumed = false;
+    *counter = value;
+    checkpointPosition[top + 2] = 1;
+    result = for_statement->interpret();
+    if (pendingLoopExit && take_loop_exit() == TOK_BREAK)
+      break;
+    value += step;
+  }
+  checkpointPosition.resize(top);
+  return result;
+}
+
+StatementNode *ForStatementNode::clone(int slot_offset) {
+  ForStatementNode *copy = new ForStatementNode(_level);
+  copy->line = line;
+  copy->has_loop_exit = has_loop_exit;
+  copy->identifier = identifier;
+  copy->frame_slot = moved_slot(identifier, frame_slot, slot_offset);
+  copy->is_downto = is_downto;
+  copy->start_expression = start_expression->clone(slot_offset);
+  copy->end_expression = end_expression->clone(slot_offset);
+  copy->hoisted_arrays = hoisted_arrays;
+  clonedChecks[&bounds_verified] = &copy->bounds_verified;
+  copy->for_statement = for_statement->clone(slot_offset);
+  clonedChecks.erase(&bounds_verified);
+  if (parallel) {
+    std::string why_serial;
+    copy->parallel = plan_parallel_loop(copy, why_serial);
+  }
+  return copy;
+}
+
+ExpressionNode::ExpressionNode(int level) {
+  _level = level;
+  nodesCreated++;
+}
 ExpressionNode::~ExpressionNode() {}
 
 void ExpressionNode::printTo(std::ostream &os) {
@@ -232,42 +940,84 @@ void ExpressionNode::printTo(std::ostream &os) {
   os << "expression) ";
 }
 
+float compare_values(int relational_operator, float first, float second) {
+  switch (relational_operator) {
+  case TOK_LESSTHAN:
+    if (first - second < 0.0)
+      return 1.0;
+    else
+      return 0.0;
+  case TOK_GREATERTHAN:
+    if (first - second >= EPSILON)
+      return 1.0;
+    else
+      return 0.0;
+  case TOK_EQUALTO:
+    if (std::abs(first - second) <= EPSILON)
+      return 1.0;
+    else
+      return 0.0;
+  case TOK_NOTEQUALTO:
+    if (std::abs(first - second) > EPSILON)
+      return 1.0;
+    else
+      return 0.0;
+  default:
+    break;
+  }
+  return first;
+}
+
+float compare_integers(int relational_operator, float first, float second) {
+  switch (relational_operator) {
+  case TOK_LESSTHAN:
+    return first < second ? 1.0 : 0.0;
+  case TOK_GREATERTHAN:
+    return first > second ? 1.0 : 0.0;
+  case TOK_EQUALTO:
+    return first == second ? 1.0 : 0.0;
+  case TOK_NOTEQUALTO:
+    return first != second ? 1.0 : 0.0;
+  default:
+    break;
+  }
+  return first;
+}
+
 float ExpressionNode::interpret() {
+  float (*run)(ExpressionNode *) = quick.load(std::memory_order_acquire);
+  if (!run)
+    run = quicken(this);
+  return run(this);
+}
+
+float ExpressionNode::evaluate() {
   float first_exp_result = first_simple_exp->interpret();
-  if (simple_exp_operator != TOK_UNKNOWN) {
-    float second_exp_result = second_simple_exp->interpret();
-    switch (simple_exp_operator) {
-    case TOK_LESSTHAN:
-      if (first_exp_result - second_exp_result < 0.0)
-        return 1.0;
-      else
-        return 0.0;
-    case TOK_GREATERTHAN:
-      if (first_exp_result - second_exp_result >= EPSILON)
-        return 1.0;
-      else
-        return 0.0;
-      break;
-    case TOK_EQUALTO:
-      if (std::abs(first_exp_result - second_exp_result) <= EPSILON)
-        return 1.0;
-      else
-        return 0.0;
-      break;
-    case TOK_NOTEQUALTO:
-      if (std::abs(first_exp_result - second_exp_result) > EPSILON)
-        return 1.0;
-      else
-        return 0.0;
-      break;
-    default:
-      break;
-    }
-  }
-  return first_exp_result;
+  if (simple_exp_operator == TOK_UNKNOWN)
+    return first_exp_result;
+  float second_exp_result = second_simple_exp->interpret();
+  if (exact_compare)
+    return compare_integers(simple_exp_operator, first_exp_result,
+                            second_exp_result);
+  return compare_values(simple_exp_operator, first_exp_result,
+                        second_exp_result);
 }
 
-SimpleExpressionNode::SimpleExpressionNode(int level) { _level = level; }
+ExpressionNode *ExpressionNode::clone(int slot_offset) {
+  ExpressionNode *copy = new ExpressionNode(_level);
+  copy->line = line;
+  copy->simple_exp_operator = simple_exp_operator;
+  copy->exact_compare = exact_compare;
+  copy->first_simple_exp = first_simple_exp->clone(slot_offset);
+  if (second_simple_exp)
+    copy->second_simple_exp = second_simple_exp->clone(slot_offset);
+  return copy;
+}
+
+SimpleExpressionNode::SimpleExpressionNode(int level) {
+  _level = level;
+  nodesCreated++;
+}
 SimpleExpressionNode::~SimpleExpressionNode() {
   delete first_term;
   for (auto it = following_terms.begin(); it != following_terms.end(); ++it)
@@ -303,14 +1053,27 @@ void SimpleExpressionNode::printTo(std::ostream &os) {
 }
 
 float SimpleExpressionNode::interpret() {
+  float (*run)(SimpleExpressionNode *) = quick.load(std::memory_order_acquire);
+  if (!run)
+    run = quicken(this);
+  return run(this);
+}
+
+// The right operand is fetched before the operation, as in the quickened
+// routines, so that of two NaN operands the left one gives the result on
+// every path; sharing a computation then cannot change a NaN's sign.
+float SimpleExpressionNode::evaluate() {
   float result = first_term->interpret();
   for (unsigned int i = 0; i < following_operators.size(); i++) {
+    float right;
     switch (following_operators[i]) {
     case TOK_PLUS:
-      result += following_terms[i]->interpret();
+      right = following_terms[i]->interpret();
+      result = result + right;
       break;
     case TOK_MINUS:
-      result -= following_terms[i]->interpret();
+      right = following_terms[i]->interpret();
+      result = result - right;
       break;
     case TOK_OR:
       result = (result >= EPSILON) ? result >= EPSILON
@@ -323,7 +1086,19 @@ float SimpleExpressionNode::interpret() {
   return result;
 }
 
-TermNode::TermNode(int level) { _level = level; }
+SimpleExpressionNode *SimpleExpressionNode::clone(int slot_offset) {
+  SimpleExpressionNode *copy = new SimpleExpressionNode(_level);
+  copy->first_term = first_term->clone(slot_offset);
+  copy->following_operators = following_operators;
+  for (auto it = following_terms.begin(); it != following_terms.end(); ++it)
+    copy->following_terms.push_back((*it)->clone(slot_offset));
+  return copy;
+}
+
+TermNode::TermNode(int level) {
+  _level = level;
+  nodesCreated++;
+}
 TermNode::~TermNode() {
   delete first_factor;
   for (auto it = following_factors.begin(); it != following_factors.end(); ++it)
@@ -359,14 +1134,25 @@ void TermNode::printTo(std::ostream &os) {
 }
 
 float TermNode::interpret() {
+  float (*run)(TermNode *) = quick.load(std::memory_order_acquire);
+  if (!run)
+    run = quicken(this);
+  return run(this);
+}
+
+// As SimpleExpressionNode::evaluate, the right operand first.
+float TermNode::evaluate() {
   float result = first_factor->interpret();
   for (unsigned int i = 0; i < following_operators.size(); i++) {
+    float right;
     switch (following_operators[i]) {
     case TOK_MULTIPLY:
-      result *= following_factors[i]->interpret();
+      right = following_factors[i]->interpret();
+      result = result * right;
       break;
     case TOK_DIVIDE:
-      result /= following_factors[i]->interpret();
+      right = following_factors[i]->interpret();
+      result = result / right;
       break;
     case TOK_AND:
       if (result >= EPSILON && following_factors[i]->interpret() >= EPSILON)
@@ -381,7 +1167,17 @@ float TermNode::interpret() {
   return result;
 }
 
-FactorNode::FactorNode() {}
+TermNode *TermNode::clone(int slot_offset) {
+  TermNode *copy = new TermNode(_level);
+  copy->first_factor = first_factor->clone(slot_offset);
+  copy->following_operators = following_operators;
+  for (auto it = following_factors.begin(); it != following_factors.end();
+       ++it)
+    copy->following_factors.push_back((*it)->clone(slot_offset));
+  return copy;
+}
+
+FactorNode::FactorNode() { nodesCreated++; }
 FactorNode::~FactorNode() {}
 
 FloatFactorNode::FloatFactorNode(int level, std::string float_str) {
@@ -399,6 +1195,10 @@ void FloatFactorNode::printTo(std::ostream &os) {
 
 float FloatFactorNode::interpret() { return float_literal; }
 
+FactorNode *FloatFactorNode::clone(int slot_offset) {
+  return new FloatFactorNode(*this);
+}
+
 IntFactorNode::IntFactorNode(int level, std::string lit) {
   _level = level;
   int_literal = lit;
@@ -414,6 +1214,10 @@ void IntFactorNode::printTo(std::ostream &os) {
 
 float IntFactorNode::interpret() { return std::stof(int_literal); }
 
+FactorNode *IntFactorNode::clone(int slot_offset) {
+  return new IntFactorNode(_level, int_literal);
+}
+
 IdFactorNode::IdFactorNode(int level, std::string ident) {
   _level = level;
   identifier = ident;
@@ -428,12 +1232,24 @@ void IdFactorNode::printTo(std::ostream &os) {
 }
 
 float IdFactorNode::interpret() {
+  if (frame_slot >= 0)
+    return callStack[framePointer + frame_slot];
+  float *storage = global_storage.load(std::memory_order_relaxed);
+  if (storage)
+    return *storage;
   auto var = symbolTable.find(identifier);
   if (var == symbolTable.end())
     throw("Id Factor Node failed: var undefined");
+  global_storage.store(&var->second, std::memory_order_relaxed);
   return var->second;
 }
 
+FactorNode *IdFactorNode::clone(int slot_offset) {
+  IdFactorNode *copy = new IdFactorNode(_level, identifier);
+  copy->frame_slot = moved_slot(identifier, frame_slot, slot_offset);
+  return copy;
+}
+
 MinusFactorNode::MinusFactorNode(int level, FactorNode *child) {
   _level = level;
   child_factor = child;
@@ -442,6 +1258,10 @@ MinusFactorNode::~MinusFactorNode() { delete child_factor; }
 
 float MinusFactorNode::interpret() { return -child_factor->interpret(); }
 
+FactorNode *MinusFactorNode::clone(int slot_offset) {
+  return new MinusFactorNode(_level, child_factor->clone(slot_offset));
+}
+
 void MinusFactorNode::printTo(std::ostream &os) {
   indent(_level);
   os << "(factor (- \n";
@@ -469,7 +1289,17 @@ void NotFactorNode::printTo(std::ostream &os) {
 }
 
 float NotFactorNode::interpret() {
-  return child_factor->interpret() >= EPSILON ? 0.0 : 1.0;
+  float value = child_factor->interpret();
+  if (integer_operand)
+    return value > 0.0f ? 0.0 : 1.0;
+  return value >= EPSILON ? 0.0 : 1.0;
+}
+
+FactorNode *NotFactorNode::clone(int slot_offset) {
+  NotFactorNode *copy =
+      new NotFactorNode(_level, child_factor->clone(slot_offset));
+  copy->integer_operand = integer_operand;
+  return copy;
 }
 
 ExpressionFactorNode::ExpressionFactorNode(int level, ExpressionNode *child) {
@@ -491,3 +1321,61 @@ void ExpressionFactorNode::printTo(std::ostream &os) {
 float ExpressionFactorNode::interpret() {
   return child_expression->interpret();
 }
+
+FactorNode *ExpressionFactorNode::clone(int slot_offset) {
+  return new ExpressionFactorNode(_level, child_expression->clone(slot_offset));
+}
+
+ConstantFactorNode::ConstantFactorNode(int level, std::string name,
+                                       float value) {
+  _level = level;
+  constant_name = name;
+  constant_value = value;
+}
+ConstantFactorNode::~ConstantFactorNode() {}
+
+void ConstantFactorNode::printTo(std::ostream &os) {
+  indent(_level);
+  os << "(factor ( CONST: ";
+  if (!constant_name.empty())
+    os << constant_name << " = ";
+  os << constant_value << " ) \n";
+  indent(_level);
+  os << "factor) ";
+}
+
+float ConstantFactorNode::interpret() { return constant_value; }
+
+FactorNode *ConstantFactorNode::clone(int slot_offset) {
+  return new ConstantFactorNode(_level, constant_name, constant_value);
+}
+
+ArrayFactorNode::ArrayFactorNode(int level, ArrayVariable *var,
+                                 ExpressionNode *index) {
+  _level = level;
+  array = var;
+  index_expression = index;
+  skip_check = &neverSkipCheck;
+}
+ArrayFactorNode::~ArrayFactorNode() { delete index_expression; }
+
+void ArrayFactorNode::printTo(std::ostream &os) {
+  indent(_level);
+  os << "(factor ( " << array->name << " [ \n";
+  index_expression->printTo(os);
+  os << "] ) ";
+  os << std::endl;
+  indent(_level);
+  os << "factor) ";
+}
+
+float ArrayFactorNode::interpret() {
+  return *array->element(index_expression->interpret(), !*skip_check);
+}
+
+FactorNode *ArrayFactorNode::clone(int slot_offset) {
+  ArrayFactorNode *copy =
+      new ArrayFactorNode(_level, array, index_expression->clone(slot_offset));
+  copy->skip_check = cloned_check(skip_check);
+  return copy;
+}
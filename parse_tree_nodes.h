@@ -2,21 +2,30 @@
 #define PARSE_TREE_NODES_H
 
 #include "lexer.h"
+#include <atomic>
+#include <cmath>
 #include <iostream>
+#include <map>
 #include <ostream>
 #include <string>
 #include <vector>
 
 class ProgramNode;
 class BlockNode;
+class ProcedureNode;
 
 class StatementNode;
 class CompoundStatementNode;
+class CobeginStatementNode;
 class WriteStatementNode;
 class ReadStatementNode;
 class AssignmentStatementNode;
 class IfStatementNode;
 class WhileStatementNode;
+class ForStatementNode;
+class LoopExitStatementNode;
+class CallStatementNode;
+class ArrayAssignmentStatementNode;
 
 class ExpressionNode;
 class SimpleExpressionNode;
@@ -30,10 +39,58 @@ class IntFactorNode;
 class MinusFactorNode;
 class NotFactorNode;
 class ExpressionFactorNode;
+class ConstantFactorNode;
+class ArrayFactorNode;
+
+struct ParallelLoop;
+struct ClosedFormLoop;
+
+// Where WRITE sends its output on this thread: std::cout, or the buffer of a
+// COBEGIN statement running on a worker.
+extern thread_local std::ostream *programOutput;
+
+// Statements interpreted by this thread, for -T; work run on the pool adds
+// the other threads' counts to the caller's afterwards. Statements count
+// themselves only when countStatements is set.
+extern thread_local unsigned long statementsExecuted;
+extern bool countStatements;
+// Parse tree nodes constructed so far.
+extern unsigned long nodesCreated;
+
+// Globals that clone() moves into the frame slots given, so that each worker
+// running a parallel loop has its own copy.
+extern std::map<std::string, int> cloneGlobalSlots;
+
+// Storage of an ARRAY[low..high] variable: one zeroed block of floats
+// aligned for vector loads. Indexes are rounded to the nearest integer.
+struct ArrayVariable {
+  std::string name;
+  std::string element_type;
+  long low = 0;
+  long size = 0;
+  float *elements = nullptr;
+
+  float *element(float index, bool check_bounds) {
+    long offset = std::lrint(index) - low;
+    if (check_bounds && (unsigned long)offset >= (unsigned long)size)
+      throw("Array access failed: index out of bounds");
+    return elements + offset;
+  }
+};
+
+// An operand that a quickened node (quicken.h) reads without calling its
+// factor: a slot of the running frame, or else the float at fixed, which is
+// a global's storage or constant.
+struct QuickOperand {
+  int slot = -1;
+  float *fixed = nullptr;
+  float constant = 0.0;
+};
 
 class ProgramNode {
 public:
   BlockNode *program_block = nullptr;
+  int frame_size = 0;
 
   ProgramNode();
   ~ProgramNode();
@@ -44,6 +101,7 @@ std::ostream &operator<<(std::ostream &, ProgramNode &);
 class BlockNode {
 public:
   CompoundStatementNode *compound_stmt = nullptr;
+  std::vector<ProcedureNode *> procedures;
   int _level = 0;
 
   BlockNode(int level);
@@ -55,10 +113,20 @@ std::ostream &operator<<(std::ostream &, BlockNode &);
 class StatementNode {
 public:
   int _level = 0;
+  int line = 0; // source line where the statement starts
+  // Set by the parser when running this statement may leave an enclosing
+  // loop through BREAK or CONTINUE.
+  bool has_loop_exit = false;
+  // Number of the statement in the parsed program (pgo.h), -1 for
+  // statements made later; clones keep -1.
+  int pgo_site = -1;
   StatementNode();
   virtual ~StatementNode();
   virtual void printTo(std::ostream &os) = 0;
   virtual float interpret() = 0;
+  // Deep copy whose frame slots are moved up by slot_offset, used to inline
+  // procedure bodies into the caller's frame.
+  virtual StatementNode *clone(int slot_offset) = 0;
 };
 
 class CompoundStatementNode : public StatementNode {
@@ -69,6 +137,21 @@ public:
   ~CompoundStatementNode();
   void printTo(std::ostream &os);
   float interpret();
+  float interpret_checkpointed();
+  StatementNode *clone(int slot_offset);
+};
+
+// COBEGIN ... COEND: the statements run at the same time on the work pool.
+// The parser accepts only statements that share no variables, and the WRITE
+// output of each is buffered and emitted in statement order.
+class CobeginStatementNode : public CompoundStatementNode {
+public:
+  // Set when the statements may not run at the same time after all.
+  bool in_order = false;
+  CobeginStatementNode(int level);
+  void printTo(std::ostream &os);
+  float interpret();
+  StatementNode *clone(int slot_offset);
 };
 
 class WriteStatementNode : public StatementNode {
@@ -76,20 +159,25 @@ public:
   int _level = 0;
   bool is_identifier = false;
   std::string write_text;
+  int frame_slot = -1;
+  FactorNode *element = nullptr; // array element to write, if any
   WriteStatementNode(int level);
   ~WriteStatementNode();
   void printTo(std::ostream &os);
   float interpret();
+  StatementNode *clone(int slot_offset);
 };
 
 class ReadStatementNode : public StatementNode {
 public:
   int _level = 0;
   std::string read_text;
+  int frame_slot = -1;
   ReadStatementNode(int level);
   ~ReadStatementNode();
   void printTo(std::ostream &os);
   float interpret();
+  StatementNode *clone(int slot_offset);
 };
 
 class IfStatementNode : public StatementNode {
@@ -99,10 +187,15 @@ public:
   StatementNode *then_statement = nullptr;
   bool has_else = false;
   StatementNode *else_statement = nullptr;
+  // Set by range analysis when the condition is always a whole number,
+  // which is greater than EPSILON exactly when it is greater than zero.
+  bool integer_condition = false;
   IfStatementNode(int level);
   ~IfStatementNode();
   void printTo(std::ostream &os);
   float interpret();
+  float interpret_checkpointed();
+  StatementNode *clone(int slot_offset);
 };
 
 class WhileStatementNode : public StatementNode {
@@ -110,47 +203,169 @@ public:
   int _level = 0;
   ExpressionNode *while_expression = nullptr;
   StatementNode *while_statement = nullptr;
+  // Set by the optimizer when the body only counts and sums, so that the
+  // final values can be computed without iterating.
+  ClosedFormLoop *closed_form = nullptr;
   WhileStatementNode(int level);
   ~WhileStatementNode();
   void printTo(std::ostream &os);
   float interpret();
+  float interpret_checkpointed();
+  StatementNode *clone(int slot_offset);
+};
+
+class ForStatementNode : public StatementNode {
+public:
+  int _level = 0;
+  std::string identifier;
+  int frame_slot = -1;
+  bool is_downto = false;
+  ExpressionNode *start_expression = nullptr;
+  ExpressionNode *end_expression = nullptr;
+  StatementNode *for_statement = nullptr;
+  // Arrays indexed by the counter in the body, whose bounds are checked once
+  // for the whole loop; bounds_verified tells those accesses to skip theirs.
+  std::vector<ArrayVariable *> hoisted_arrays;
+  bool bounds_verified = false;
+  // Set when the iterations are independent and may run on several threads.
+  ParallelLoop *parallel = nullptr;
+  ForStatementNode(int level);
+  ~ForStatementNode();
+  void printTo(std::ostream &os);
+  float interpret();
+  float interpret_checkpointed();
+  float *counter_storage();
+  bool counter_in_bounds(float first, long trips);
+  float run_loop(float *counter, float value, long trips);
+  StatementNode *clone(int slot_offset);
+};
+
+class LoopExitStatementNode : public StatementNode {
+public:
+  int _level = 0;
+  int exit_token = TOK_BREAK;
+  LoopExitStatementNode(int level, int token);
+  ~LoopExitStatementNode();
+  void printTo(std::ostream &os);
+  float interpret();
+  StatementNode *clone(int slot_offset);
+};
+
+// A PROCEDURE declaration. Parameters take the first frame slots, then
+// locals, then the slots of calls inlined into the body.
+class ProcedureNode {
+public:
+  int _level = 0;
+  std::string name;
+  std::vector<std::string> local_names;
+  int param_count = 0;
+  int frame_size = 0;
+  int statement_count = 0;
+  bool is_recursive = false;
+  CompoundStatementNode *body = nullptr;
+
+  ProcedureNode(int level, std::string proc_name);
+  ~ProcedureNode();
+  void printTo(std::ostream &os);
+};
+
+class CallStatementNode : public StatementNode {
+public:
+  int _level = 0;
+  ProcedureNode *procedure = nullptr;
+  std::vector<ExpressionNode *> arguments;
+  CallStatementNode(int level, ProcedureNode *proc);
+  ~CallStatementNode();
+  void printTo(std::ostream &os);
+  float interpret();
+  StatementNode *clone(int slot_offset);
+};
+
+class ArrayAssignmentStatementNode : public StatementNode {
+public:
+  int _level = 0;
+  ArrayVariable *array = nullptr;
+  ExpressionNode *index_expression = nullptr;
+  ExpressionNode *assignment_expr = nullptr;
+  const bool *skip_check = nullptr;
+  ArrayAssignmentStatementNode(int level, ArrayVariable *var);
+  ~ArrayAssignmentStatementNode();
+  void printTo(std::ostream &os);
+  float interpret();
+  StatementNode *clone(int slot_offset);
 };
 
 class AssignmentStatementNode : public StatementNode {
 public:
   int _level = 0;
   std::string identifier;
+  int frame_slot = -1;
   ExpressionNode *assignment_expr = nullptr;
+  // Set by the first interpret() to the routine for the assignment's shape
+  // (quicken.h): quick_left is the variable, quick_right a constant step.
+  std::atomic<float (*)(AssignmentStatementNode *)> quick{nullptr};
+  QuickOperand quick_left, quick_right;
   AssignmentStatementNode(int level);
   ~AssignmentStatementNode();
   void printTo(std::ostream &os);
   float interpret();
+  // The assignment as written, which every shape falls back on.
+  float evaluate();
+  StatementNode *clone(int slot_offset);
 };
 
 class ExpressionNode {
 public:
   int _level = 0;
+  int line = 0; // source line where the expression starts
   int simple_exp_operator = TOK_UNKNOWN;
   SimpleExpressionNode *first_simple_exp = nullptr;
   SimpleExpressionNode *second_simple_exp = nullptr;
+  // Set by range analysis when both operands are always whole numbers, so
+  // that they differ by at least 1 or not at all and compare exactly.
+  bool exact_compare = false;
+  // Set by the first interpret() to the routine for this node's shape
+  // (quicken.h), which reads its operands from quick_left and quick_right.
+  std::atomic<float (*)(ExpressionNode *)> quick{nullptr};
+  QuickOperand quick_left, quick_right;
 
   ExpressionNode(int level);
   ~ExpressionNode();
   void printTo(std::ostream &os);
   float interpret();
+  // The evaluation as written, which every shape falls back on.
+  float evaluate();
+  ExpressionNode *clone(int slot_offset);
 };
 
+// 1.0 when first and second satisfy the relational operator, else 0.0.
+float compare_values(int relational_operator, float first, float second);
+// The same for whole numbers, compared without EPSILON.
+float compare_integers(int relational_operator, float first, float second);
+// Times a FOR loop from first to last runs its body.
+long for_trip_count(float first, float last, bool is_downto);
+// True once procedure calls have used half of the native stack, when the
+// next call fails rather than risk overflowing it.
+bool native_stack_exhausted();
+
 class SimpleExpressionNode {
 public:
   int _level = 0;
   TermNode *first_term = nullptr;
   std::vector<int> following_operators;
   std::vector<TermNode *> following_terms;
+  // Set by the first interpret() to the routine for this node's shape
+  // (quicken.h), which reads its operands from quick_left and quick_right.
+  std::atomic<float (*)(SimpleExpressionNode *)> quick{nullptr};
+  QuickOperand quick_left, quick_right;
 
   SimpleExpressionNode(int level);
   ~SimpleExpressionNode();
   void printTo(std::ostream &os);
   float interpret();
+  // The evaluation as written, which every shape falls back on.
+  float evaluate();
+  SimpleExpressionNode *clone(int slot_offset);
 };
 
 class TermNode {
@@ -159,11 +374,18 @@ public:
   FactorNode *first_factor = nullptr;
   std::vector<int> following_operators;
   std::vector<FactorNode *> following_factors;
+  // Set by the first interpret() to the routine for this node's shape
+  // (quicken.h), which reads its operands from quick_left and quick_right.
+  std::atomic<float (*)(TermNode *)> quick{nullptr};
+  QuickOperand quick_left, quick_right;
 
   TermNode(int level);
   ~TermNode();
   void printTo(std::ostream &os);
   float interpret();
+  // The evaluation as written, which every shape falls back on.
+  float evaluate();
+  TermNode *clone(int slot_offset);
 };
 
 class FactorNode {
@@ -174,6 +396,7 @@ public:
   virtual ~FactorNode();
   virtual void printTo(std::ostream &os) = 0;
   virtual float interpret() = 0;
+  virtual FactorNode *clone(int slot_offset) = 0;
 };
 
 class FloatFactorNode : public FactorNode {
@@ -184,16 +407,22 @@ public:
   ~FloatFactorNode();
   void printTo(std::ostream &os);
   float interpret();
+  FactorNode *clone(int slot_offset);
 };
 
 class IdFactorNode : public FactorNode {
 public:
   int _level = 0;
   std::string identifier = "";
+  // Slot in the current procedure frame, or -1 for a global variable.
+  int frame_slot = -1;
+  // A global's storage, found by the first interpret().
+  std::atomic<float *> global_storage{nullptr};
   IdFactorNode(int level, std::string ident);
   ~IdFactorNode();
   void printTo(std::ostream &os);
   float interpret();
+  FactorNode *clone(int slot_offset);
 };
 
 class IntFactorNode : public FactorNode {
@@ -204,6 +433,7 @@ public:
   ~IntFactorNode();
   void printTo(std::ostream &os);
   float interpret();
+  FactorNode *clone(int slot_offset);
 };
 
 class MinusFactorNode : public FactorNode {
@@ -214,16 +444,20 @@ public:
   ~MinusFactorNode();
   void printTo(std::ostream &os);
   float interpret();
+  FactorNode *clone(int slot_offset);
 };
 
 class NotFactorNode : public FactorNode {
 public:
   int _level = 0;
   FactorNode *child_factor = nullptr;
+  // Set by range analysis when the operand is always a whole number.
+  bool integer_operand = false;
   NotFactorNode(int level, FactorNode *child);
   ~NotFactorNode();
   void printTo(std::ostream &os);
   float interpret();
+  FactorNode *clone(int slot_offset);
 };
 
 class ExpressionFactorNode : public FactorNode {
@@ -234,6 +468,36 @@ public:
   ~ExpressionFactorNode();
   void printTo(std::ostream &os);
   float interpret();
+  FactorNode *clone(int slot_offset);
+};
+
+// A LET constant or a subexpression folded at parse time; constant_name is
+// empty for folded values.
+class ConstantFactorNode : public FactorNode {
+public:
+  int _level = 0;
+  std::string constant_name;
+  float constant_value = 0.0;
+  ConstantFactorNode(int level, std::string name, float value);
+  ~ConstantFactorNode();
+  void printTo(std::ostream &os);
+  float interpret();
+  FactorNode *clone(int slot_offset);
+};
+
+class ArrayFactorNode : public FactorNode {
+public:
+  int _level = 0;
+  ArrayVariable *array = nullptr;
+  ExpressionNode *index_expression = nullptr;
+  // Points at the enclosing FOR loop's bounds_verified when the index is its
+  // counter, otherwise at a flag that is always false.
+  const bool *skip_check = nullptr;
+  ArrayFactorNode(int level, ArrayVariable *var, ExpressionNode *index);
+  ~ArrayFactorNode();
+  void printTo(std::ostream &os);
+  float interpret();
+  FactorNode *clone(int slot_offset);
 };
 
 #endif /* PARSE_TREE_NODES_H */
@@ -1,9 +1,17 @@
 #include "parser.h"
 #include "lexer.h"
 #include "parse_tree_nodes.h"
+#include "number_format.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <map>
 #include <stdlib.h>
+#include <string.h>
+
+// Procedures with at most this many statements are inlined into callers.
+#define INLINE_LIMIT 8
 
 using namespace std;
 
@@ -11,9 +19,50 @@ int nextToken = 0;
 
 static int level = 0;
 
+// Number of WHILE and FOR bodies being parsed; BREAK and CONTINUE are only
+// legal when this is nonzero.
+static int loopDepth = 0;
+
+struct LoopBodyScope {
+  LoopBodyScope() { ++loopDepth; }
+  ~LoopBodyScope() { --loopDepth; }
+};
+
+// First frame slot for calls inlined into the statement being parsed.
+static int inlineBase = 0;
+
 extern bool printParse;
 
 std::map<std::string, float> symbolTable;
+std::map<std::string, float> constantTable;
+std::map<std::string, ProcedureNode *> procedureTable;
+std::map<std::string, ArrayVariable *> arrayTable;
+
+std::vector<float> callStack(1 << 16);
+thread_local size_t framePointer = 0;
+thread_local size_t stackTop = 0;
+thread_local size_t stackLimit = 1 << 16;
+
+int frameSize = 0;
+
+// Procedure being parsed and the frame slots of its parameters and locals.
+static ProcedureNode *currentProcedure = nullptr;
+static std::map<std::string, int> localSlots;
+
+// Statements parsed so far, plus those inlined calls put in their place,
+// used to measure procedure bodies as they are after inlining.
+static int statementCount = 0;
+
+// FOR loops whose bodies are being parsed. Array accesses indexed by a
+// loop's counter are collected, and their bounds checks are hoisted to the
+// loop if nothing in the body can write the counter.
+struct OpenForLoop {
+  ForStatementNode *loop;
+  std::vector<ArrayVariable *> arrays;
+  std::vector<const bool **> checks;
+  bool counter_written;
+};
+static std::vector<OpenForLoop> openForLoops;
 
 string psp(void) {
   string str("");
@@ -31,6 +80,205 @@ void parse_log(string what) {
     std::cout << psp() << what << "\n";
 }
 
+static bool is_declared(const string &name) {
+  return symbolTable.find(name) != symbolTable.end() ||
+         constantTable.find(name) != constantTable.end() ||
+         procedureTable.find(name) != procedureTable.end() ||
+         arrayTable.find(name) != arrayTable.end();
+}
+
+// Frame slot of a parameter or local of the procedure being parsed, or -1.
+static int frame_slot(const string &name) {
+  auto local = localSlots.find(name);
+  return local == localSlots.end() ? -1 : local->second;
+}
+
+// Records a write to a scalar variable for the bounds check hoisting. A
+// slot of -2 stands for a procedure call, which may write any global.
+static void note_write(const string &name, int slot) {
+  for (auto it = openForLoops.begin(); it != openForLoops.end(); ++it) {
+    ForStatementNode *loop = it->loop;
+    if ((slot == -2 && loop->frame_slot < 0) ||
+        (loop->identifier == name && loop->frame_slot == slot))
+      it->counter_written = true;
+  }
+}
+
+static IdFactorNode *bare_identifier(ExpressionNode *expression) {
+  if (expression->simple_exp_operator != TOK_UNKNOWN)
+    return nullptr;
+  SimpleExpressionNode *simple_exp = expression->first_simple_exp;
+  if (!simple_exp->following_terms.empty())
+    return nullptr;
+  TermNode *term = simple_exp->first_term;
+  if (!term->following_factors.empty())
+    return nullptr;
+  return dynamic_cast<IdFactorNode *>(term->first_factor);
+}
+
+static void hoist_bounds_check(ArrayVariable *array, ExpressionNode *index,
+                               const bool **skip_check) {
+  IdFactorNode *counter = bare_identifier(index);
+  if (!counter)
+    return;
+  for (auto it = openForLoops.rbegin(); it != openForLoops.rend(); ++it) {
+    if (it->loop->identifier == counter->identifier &&
+        it->loop->frame_slot == counter->frame_slot) {
+      it->arrays.push_back(array);
+      it->checks.push_back(skip_check);
+      return;
+    }
+  }
+}
+
+static FactorNode *array_factor(int factor_level);
+
+// Constant folding. Literals and LET names are constants, and any prefix of
+// a term or simple expression made only of constants is replaced by its
+// value. Values come from running the nodes' own interpret(), and only
+// leading operands are folded, so results match unfolded evaluation exactly.
+static bool is_constant(FactorNode *factor) {
+  return dynamic_cast<ConstantFactorNode *>(factor) != nullptr ||
+         dynamic_cast<IntFactorNode *>(factor) != nullptr ||
+         dynamic_cast<FloatFactorNode *>(factor) != nullptr;
+}
+
+static bool is_constant(TermNode *term) {
+  return term->following_factors.empty() && is_constant(term->first_factor);
+}
+
+static bool is_constant(SimpleExpressionNode *simple_exp) {
+  return simple_exp->following_terms.empty() &&
+         is_constant(simple_exp->first_term);
+}
+
+static bool is_constant(ExpressionNode *expression) {
+  return expression->simple_exp_operator == TOK_UNKNOWN &&
+         is_constant(expression->first_simple_exp);
+}
+
+// Value of a constant node, or false when running it throws, as a literal
+// too large for a float does. Folding then leaves the node as it is, so the
+// error is raised only if the program reaches it; declarations report 50.
+template <typename Node> static bool constant_value(Node *node, float &value) {
+  try {
+    value = node->interpret();
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+
+static TermNode *constant_term(int term_level, float value) {
+  TermNode *new_term = new TermNode(term_level);
+  new_term->first_factor = new ConstantFactorNode(term_level + 1, "", value);
+  return new_term;
+}
+
+static SimpleExpressionNode *constant_simple_exp(int simple_level,
+                                                 float value) {
+  SimpleExpressionNode *new_simple_exp = new SimpleExpressionNode(simple_level);
+  new_simple_exp->first_term = constant_term(simple_level + 1, value);
+  return new_simple_exp;
+}
+
+static void fold_term(TermNode *term) {
+  size_t count = 0;
+  if (!is_constant(term->first_factor))
+    return;
+  while (count < term->following_factors.size() &&
+         is_constant(term->following_factors[count]))
+    count++;
+  if (count == 0)
+    return;
+
+  TermNode prefix(term->_level);
+  prefix.first_factor = term->first_factor;
+  prefix.following_operators.assign(term->following_operators.begin(),
+                                    term->following_operators.begin() + count);
+  prefix.following_factors.assign(term->following_factors.begin(),
+                                  term->following_factors.begin() + count);
+  float value;
+  if (!constant_value(&prefix, value)) {
+    prefix.first_factor = nullptr; // still owned by term
+    prefix.following_factors.clear();
+    return;
+  }
+  term->first_factor = new ConstantFactorNode(term->_level + 1, "", value);
+  term->following_operators.erase(term->following_operators.begin(),
+                                  term->following_operators.begin() + count);
+  term->following_factors.erase(term->following_factors.begin(),
+                                term->following_factors.begin() + count);
+}
+
+static void fold_simple_exp(SimpleExpressionNode *simple_exp) {
+  size_t count = 0;
+  if (!is_constant(simple_exp->first_term))
+    return;
+  while (count < simple_exp->following_terms.size() &&
+         is_constant(simple_exp->following_terms[count]))
+    count++;
+  if (count == 0)
+    return;
+
+  SimpleExpressionNode prefix(simple_exp->_level);
+  prefix.first_term = simple_exp->first_term;
+  prefix.following_operators.assign(
+      simple_exp->following_operators.begin(),
+      simple_exp->following_operators.begin() + count);
+  prefix.following_terms.assign(simple_exp->following_terms.begin(),
+                                simple_exp->following_terms.begin() + count);
+  float value;
+  if (!constant_value(&prefix, value)) {
+    prefix.first_term = nullptr; // still owned by simple_exp
+    prefix.following_terms.clear();
+    return;
+  }
+  simple_exp->first_term = constant_term(simple_exp->_level + 1, value);
+  simple_exp->following_operators.erase(
+      simple_exp->following_operators.begin(),
+      simple_exp->following_operators.begin() + count);
+  simple_exp->following_terms.erase(simple_exp->following_terms.begin(),
+                                    simple_exp->following_terms.begin() +
+                                        count);
+}
+
+static void fold_expression(ExpressionNode *expression) {
+  if (expression->simple_exp_operator == TOK_UNKNOWN ||
+      !is_constant(expression->first_simple_exp) ||
+      !is_constant(expression->second_simple_exp))
+    return;
+
+  float value;
+  if (!constant_value(expression, value))
+    return;
+  delete expression->first_simple_exp;
+  delete expression->second_simple_exp;
+  expression->second_simple_exp = nullptr;
+  expression->simple_exp_operator = TOK_UNKNOWN;
+  expression->first_simple_exp =
+      constant_simple_exp(expression->_level + 1, value);
+}
+
+static FactorNode *fold_factor(FactorNode *factor, int factor_level) {
+  bool foldable = false;
+  if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor))
+    foldable = is_constant(minus->child_factor);
+  else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor))
+    foldable = is_constant(negation->child_factor);
+  else if (ExpressionFactorNode *parens =
+               dynamic_cast<ExpressionFactorNode *>(factor))
+    foldable = is_constant(parens->child_expression);
+  if (!foldable)
+    return factor;
+
+  float value;
+  if (!constant_value(factor, value))
+    return factor;
+  delete factor;
+  return new ConstantFactorNode(factor_level, "", value);
+}
+
 ProgramNode *program() {
   if (nextToken != TOK_PROGRAM) // Check for PROGRAM
     throw "3: 'PROGRAM' expected";
@@ -54,11 +302,13 @@ ProgramNode *program() {
 
   nextToken = yylex();
 
-  if (nextToken != TOK_BEGIN && nextToken != TOK_VAR)
-    throw("<block> does not start with VAR or BEGIN");
+  if (nextToken != TOK_BEGIN && nextToken != TOK_VAR &&
+      nextToken != TOK_LET && nextToken != TOK_PROCEDURE)
+    throw("<block> does not start with VAR, LET, PROCEDURE or BEGIN");
 
   output("BLOCK");
   new_program->program_block = block();
+  new_program->frame_size = frameSize;
   --level;
   parse_log("exit <program>");
 
@@ -84,6 +334,12 @@ BlockNode *block() {
     case TOK_IDENT:
       declare_ident();
       break;
+    case TOK_LET:
+      declare_constant();
+      break;
+    case TOK_PROCEDURE:
+      new_block->procedures.push_back(declare_procedure());
+      break;
     default:
       nextToken = TOK_END;
       break;
@@ -106,7 +362,10 @@ CompoundStatementNode *compound_statement() {
     throw("17: 'BEGIN' expected");
   for (;;) {
     nextToken = yylex();
-    new_compound->statement_vector.push_back(statement());
+    StatementNode *new_statement = statement();
+    new_compound->statement_vector.push_back(new_statement);
+    if (new_statement->has_loop_exit)
+      new_compound->has_loop_exit = true;
     if (nextToken == TOK_END) {
       break;
     }
@@ -122,13 +381,65 @@ CompoundStatementNode *compound_statement() {
   return new_compound;
 }
 
+// A statement of COBEGIN runs on its own thread, so BREAK and CONTINUE may
+// not leave it, and calls inlined into it get frame slots no other
+// statement of the block uses.
+struct CobeginScope {
+  int outer_loop_depth = loopDepth;
+  int outer_inline_base = inlineBase;
+  CobeginScope() {
+    loopDepth = 0;
+    int locals = currentProcedure ? currentProcedure->local_names.size() : 0;
+    inlineBase = max(frameSize, locals);
+  }
+  ~CobeginScope() {
+    loopDepth = outer_loop_depth;
+    inlineBase = outer_inline_base;
+  }
+};
+
+CobeginStatementNode *cobegin_statement() {
+  CobeginStatementNode *new_cobegin = new CobeginStatementNode(level);
+  output("COBEGIN");
+  parse_log("enter <cobegin_stmt>");
+  ++level;
+  for (;;) {
+    nextToken = yylex();
+    {
+      CobeginScope scope;
+      new_cobegin->statement_vector.push_back(statement());
+    }
+    if (nextToken == TOK_COEND)
+      break;
+    if (nextToken != TOK_SEMICOLON)
+      throw("14: ';' expected");
+    output("SEMICOLON");
+  }
+  if (statements_share_variables(new_cobegin->statement_vector))
+    throw("907: statements in COBEGIN share a variable");
+  new_cobegin->in_order =
+      statements_share_loop_checks(new_cobegin->statement_vector);
+
+  --level;
+  output("COEND");
+  nextToken = yylex();
+  parse_log("exit <cobegin_stmt>");
+  return new_cobegin;
+}
+
 StatementNode *statement() {
   StatementNode *new_statement = nullptr;
+  int line = yylineno;
+  ++statementCount;
   switch (nextToken) {
   case TOK_BEGIN:
     output("STATEMENT");
     new_statement = (StatementNode *)compound_statement();
     break;
+  case TOK_COBEGIN:
+    output("STATEMENT");
+    new_statement = (StatementNode *)cobegin_statement();
+    break;
   case TOK_IF:
     output("STATEMENT");
     new_statement = (StatementNode *)if_statement();
@@ -137,6 +448,19 @@ StatementNode *statement() {
     output("STATEMENT");
     new_statement = (StatementNode *)while_statement();
     break;
+  case TOK_FOR:
+    output("STATEMENT");
+    new_statement = (StatementNode *)for_statement();
+    break;
+  case TOK_BREAK:
+  case TOK_CONTINUE:
+    output("STATEMENT");
+    if (loopDepth == 0)
+      throw("904: BREAK or CONTINUE outside of a loop");
+    new_statement =
+        (StatementNode *)new LoopExitStatementNode(level, nextToken);
+    nextToken = yylex();
+    break;
   case TOK_READ:
     output("STATEMENT");
     new_statement = (StatementNode *)read();
@@ -149,12 +473,20 @@ StatementNode *statement() {
     break;
   case TOK_IDENT:
     output("STATEMENT");
-    new_statement = (StatementNode *)assignment();
+    if (frame_slot(yytext) < 0 &&
+        procedureTable.find(yytext) != procedureTable.end())
+      new_statement = call_statement();
+    else if (frame_slot(yytext) < 0 &&
+             arrayTable.find(yytext) != arrayTable.end())
+      new_statement = (StatementNode *)array_assignment();
+    else
+      new_statement = (StatementNode *)assignment();
     break;
   default:
     throw("900: illegal type of statement");
     break;
   }
+  new_statement->line = line;
   return new_statement;
 }
 
@@ -171,11 +503,29 @@ WriteStatementNode *write() {
   switch (nextToken) {
   case TOK_IDENT:
     output("WRITE");
-    if (symbolTable.find(yytext) != symbolTable.end()) {
+    if (frame_slot(yytext) >= 0) {
+      if (printParse)
+        cout << psp() << yytext << "\n";
+      new_write->write_text = yytext;
+      new_write->is_identifier = true;
+      new_write->frame_slot = frame_slot(yytext);
+    } else if (constantTable.find(yytext) != constantTable.end()) {
+      // Format now exactly as write_number would at run time.
+      char text[numberTextSize];
+      size_t length = format_number(constantTable[yytext], text);
+      if (printParse)
+        cout << psp() << yytext << "\n";
+      new_write->write_text.assign(text, length);
+    } else if (symbolTable.find(yytext) != symbolTable.end()) {
       if (printParse)
         cout << psp() << yytext << "\n";
       new_write->write_text = yytext;
       new_write->is_identifier = true;
+    } else if (arrayTable.find(yytext) != arrayTable.end()) {
+      if (printParse)
+        cout << psp() << yytext << "\n";
+      new_write->write_text = yytext;
+      new_write->element = array_factor(level);
     } else {
       throw("104: identifier not declared");
     }
@@ -214,13 +564,19 @@ ReadStatementNode *read() {
     throw("2: identifier expected");
   output("IDENTIFIER");
 
-  if (symbolTable.find(yytext) != symbolTable.end()) {
+  new_read->frame_slot = frame_slot(yytext);
+  if (new_read->frame_slot < 0 &&
+      constantTable.find(yytext) != constantTable.end())
+    throw("103: identifier is not a variable");
+  if (new_read->frame_slot >= 0 ||
+      symbolTable.find(yytext) != symbolTable.end()) {
     if (printParse)
       cout << psp() << yytext << "\n";
     new_read->read_text = yytext;
   } else {
     throw("104: identifier not declared");
   }
+  note_write(new_read->read_text, new_read->frame_slot);
 
   nextToken = yylex();
   if (nextToken != TOK_CLOSEPAREN)
@@ -231,21 +587,64 @@ ReadStatementNode *read() {
   return new_read;
 }
 
-void declare_ident() {
-  if (nextToken != TOK_IDENT)
-    throw("2: identifier expected");
-  output("IDENTIFIER");
-
-  string iden_name(yytext);
+// Parses a constant integer array bound. Bounds are kept within 2^40, the
+// limit on an array's bytes, so that the cast and high - low + 1 are exact.
+static long array_bound() {
+  output("EXPRESSION");
+  ExpressionNode *bound_expression = expression();
+  float bound = 0.0;
+  bool constant = is_constant(bound_expression) &&
+                  constant_value(bound_expression, bound);
+  delete bound_expression;
+  if (!constant)
+    throw("50: error in constant");
+  if (bound != std::floor(bound))
+    throw("15: integer expected");
+  if (std::fabs(bound) > (float)(1L << 40))
+    throw("906: array too large");
+  return (long)bound;
+}
 
+// Parses ": type" after a variable name. For ARRAY[low..high] OF type the
+// bounds are returned in array, otherwise array is set to nullptr.
+static string variable_type(ArrayVariable *&array) {
+  array = nullptr;
   nextToken = yylex();
   if (nextToken != TOK_COLON)
     throw("5: ':' expected");
   output("COLON");
 
   string iden_type = "NONE";
+  bool is_array = false;
+  long low = 0, high = 0;
 
   nextToken = yylex();
+  if (nextToken == TOK_ARRAY) {
+    is_array = true;
+    output("ARRAY");
+    nextToken = yylex();
+    if (nextToken != TOK_OPENBRACKET)
+      throw("11: '[' expected");
+    output("OPENBRACKET");
+    nextToken = yylex();
+    low = array_bound();
+    if (nextToken != TOK_DOTDOT)
+      throw("6: '..' expected");
+    output("DOTDOT");
+    nextToken = yylex();
+    high = array_bound();
+    if (nextToken != TOK_CLOSEBRACKET)
+      throw("12: ']' expected");
+    output("CLOSEBRACKET");
+    if (low > high)
+      throw("102: low bound exceeds high bound");
+    nextToken = yylex();
+    if (nextToken != TOK_OF)
+      throw("8: 'OF' expected");
+    output("OF");
+    nextToken = yylex();
+  }
+
   switch (nextToken) {
   case TOK_REAL:
     iden_type = "REAL";
@@ -259,18 +658,258 @@ void declare_ident() {
   }
   output("TYPE");
 
+  if (is_array) {
+    array = new ArrayVariable();
+    array->element_type = iden_type;
+    array->low = low;
+    array->size = high - low + 1;
+    iden_type = "ARRAY[" + to_string(low) + ".." + to_string(high) + "] OF " +
+                iden_type;
+  }
+  return iden_type;
+}
+
+// Declares a global, or a parameter or local of the procedure being parsed.
+static void add_variable(const string &iden_name, const string &iden_type,
+                         ArrayVariable *array) {
+  if (printParse)
+    cout << psp() << "-- idName: |" << iden_name << "| idType: |" << iden_type
+         << "| --\n";
+
+  if (currentProcedure) {
+    if (array)
+      throw("905: ARRAY must be a global variable");
+    if (localSlots.find(iden_name) != localSlots.end())
+      throw("101: identifier declared twice");
+    localSlots.emplace(iden_name, currentProcedure->local_names.size());
+    currentProcedure->local_names.push_back(iden_name);
+    return;
+  }
+
+  if (is_declared(iden_name))
+    throw("101: identifier declared twice");
+  if (!array) {
+    symbolTable.emplace(iden_name, 0.0);
+    return;
+  }
+
+  // Cache-line alignment also suits the widest vector loads.
+  void *elements = nullptr;
+  if (array->size > (1L << 40) / (long)sizeof(float) ||
+      posix_memalign(&elements, 64, array->size * sizeof(float)) != 0)
+    throw("906: array too large");
+  memset(elements, 0, array->size * sizeof(float));
+  array->name = iden_name;
+  array->elements = (float *)elements;
+  arrayTable.emplace(iden_name, array);
+}
+
+void declare_ident() {
+  if (nextToken != TOK_IDENT)
+    throw("2: identifier expected");
+  output("IDENTIFIER");
+
+  string iden_name(yytext);
+  ArrayVariable *array = nullptr;
+  string iden_type = variable_type(array);
+
   nextToken = yylex();
   if (nextToken != TOK_SEMICOLON)
     throw("14: ';' expected");
   output("SEMICOLON");
 
+  add_variable(iden_name, iden_type, array);
+}
+
+void declare_constant() {
+  output("LET");
+  nextToken = yylex();
+  if (nextToken != TOK_IDENT)
+    throw("2: identifier expected");
+  output("IDENTIFIER");
+
+  string const_name(yytext);
+  if (is_declared(const_name))
+    throw("101: identifier declared twice");
+
+  nextToken = yylex();
+  if (nextToken != TOK_EQUALTO)
+    throw("16: '=' expected");
+  output("EQUALTO");
+
+  nextToken = yylex();
+  output("EXPRESSION");
+  ExpressionNode *value_expression = expression();
+  float const_value = 0.0;
+  bool constant = is_constant(value_expression) &&
+                  constant_value(value_expression, const_value);
+  delete value_expression;
+  if (!constant)
+    throw("50: error in constant");
+
+  if (nextToken != TOK_SEMICOLON)
+    throw("14: ';' expected");
+  output("SEMICOLON");
+
   if (printParse)
-    cout << psp() << "-- idName: |" << iden_name << "| idType: |" << iden_type
-         << "| --\n";
+    cout << psp() << "-- constName: |" << const_name << "| value: |"
+         << const_value << "| --\n";
 
-  if (symbolTable.find(iden_name) != symbolTable.end())
+  constantTable.emplace(const_name, const_value);
+}
+
+ProcedureNode *declare_procedure() {
+  output("PROCEDURE");
+  parse_log("enter <procedure>");
+  ++level;
+  nextToken = yylex();
+  if (nextToken != TOK_IDENT)
+    throw("2: identifier expected");
+  output("IDENTIFIER");
+
+  string proc_name(yytext);
+  if (is_declared(proc_name))
     throw("101: identifier declared twice");
-  symbolTable.emplace(iden_name, 0.0);
+  ProcedureNode *new_procedure = new ProcedureNode(level, proc_name);
+  procedureTable.emplace(proc_name, new_procedure);
+
+  currentProcedure = new_procedure;
+  localSlots.clear();
+  int outer_frame_size = frameSize;
+  frameSize = 0;
+
+  nextToken = yylex();
+  if (nextToken == TOK_OPENPAREN) {
+    output("OPENPAREN");
+    for (;;) {
+      nextToken = yylex();
+      if (nextToken != TOK_IDENT)
+        throw("2: identifier expected");
+      output("IDENTIFIER");
+      string param_name(yytext);
+      ArrayVariable *array = nullptr;
+      string param_type = variable_type(array);
+      add_variable(param_name, param_type, array);
+      new_procedure->param_count++;
+
+      nextToken = yylex();
+      if (nextToken == TOK_CLOSEPAREN)
+        break;
+      if (nextToken != TOK_SEMICOLON)
+        throw("4: ')' expected");
+      output("SEMICOLON");
+    }
+    output("CLOSEPAREN");
+    nextToken = yylex();
+  }
+  if (nextToken != TOK_SEMICOLON)
+    throw("14: ';' expected");
+  output("SEMICOLON");
+
+  for (;;) {
+    nextToken = yylex();
+    if (nextToken == TOK_IDENT)
+      declare_ident();
+    else if (nextToken != TOK_VAR)
+      break;
+  }
+
+  int first_statement = statementCount;
+  new_procedure->body = compound_statement();
+  new_procedure->statement_count = statementCount - first_statement;
+  new_procedure->frame_size =
+      max(frameSize, (int)new_procedure->local_names.size());
+  if (nextToken != TOK_SEMICOLON)
+    throw("14: ';' expected");
+  output("SEMICOLON");
+
+  currentProcedure = nullptr;
+  localSlots.clear();
+  frameSize = outer_frame_size;
+
+  --level;
+  parse_log("exit <procedure>");
+  return new_procedure;
+}
+
+// Replaces a call by a copy of the callee's body that uses frame slots just
+// above the caller's own locals, so the call needs no frame of its own.
+// Parameters are assigned the argument values and locals are zeroed first.
+static StatementNode *inline_call(CallStatementNode *call) {
+  ProcedureNode *callee = call->procedure;
+  int base = currentProcedure ? currentProcedure->local_names.size() : 0;
+  base = max(base, inlineBase);
+  frameSize = max(frameSize, base + callee->frame_size);
+
+  CompoundStatementNode *inlined = new CompoundStatementNode(call->_level);
+  for (size_t slot = 0; slot < callee->local_names.size(); slot++) {
+    AssignmentStatementNode *init =
+        new AssignmentStatementNode(call->_level + 1);
+    init->identifier = callee->local_names[slot];
+    init->line = call->line;
+    init->frame_slot = base + slot;
+    if ((int)slot < callee->param_count) {
+      init->assignment_expr = call->arguments[slot];
+    } else {
+      init->assignment_expr = new ExpressionNode(call->_level + 2);
+      init->assignment_expr->first_simple_exp =
+          constant_simple_exp(call->_level + 3, 0.0);
+    }
+    inlined->statement_vector.push_back(init);
+  }
+  call->arguments.clear();
+  delete call;
+  // The caller grows by the copy, so a procedure made of inlined calls is
+  // measured at its real size when it is inlined in turn.
+  statementCount += callee->local_names.size() + callee->statement_count;
+
+  auto &body = callee->body->statement_vector;
+  for (auto it = body.begin(); it != body.end(); ++it)
+    inlined->statement_vector.push_back((*it)->clone(base));
+  return inlined;
+}
+
+StatementNode *call_statement() {
+  ProcedureNode *callee = procedureTable[yytext];
+  CallStatementNode *new_call = new CallStatementNode(level, callee);
+  new_call->line = yylineno;
+  parse_log("enter <call>");
+  ++level;
+  output("IDENTIFIER");
+
+  nextToken = yylex();
+  if (nextToken == TOK_OPENPAREN) {
+    output("OPENPAREN");
+    nextToken = yylex();
+    if (nextToken != TOK_CLOSEPAREN) {
+      for (;;) {
+        output("EXPRESSION");
+        new_call->arguments.push_back(expression());
+        if (nextToken != TOK_COMMA)
+          break;
+        output("COMMA");
+        nextToken = yylex();
+      }
+      if (nextToken != TOK_CLOSEPAREN)
+        throw("4: ')' expected");
+    }
+    output("CLOSEPAREN");
+    nextToken = yylex();
+  }
+  if ((int)new_call->arguments.size() != callee->param_count)
+    throw("126: number of parameters does not agree with declaration");
+  note_write("", -2);
+
+  --level;
+  parse_log("exit <call>");
+
+  if (callee == currentProcedure) {
+    callee->is_recursive = true;
+    return new_call;
+  }
+  if (callee->is_recursive || callee->statement_count > INLINE_LIMIT)
+    return new_call;
+  return inline_call(new_call);
 }
 
 AssignmentStatementNode *assignment() {
@@ -280,9 +919,14 @@ AssignmentStatementNode *assignment() {
   if (nextToken != TOK_IDENT)
     throw("2: identifier expected");
   output("IDENTIFIER");
+  new_assignment->frame_slot = frame_slot(yytext);
+  if (new_assignment->frame_slot < 0 &&
+      constantTable.find(yytext) != constantTable.end())
+    throw("103: identifier is not a variable");
   if (printParse)
     cout << psp() << yytext << "\n";
   new_assignment->identifier = yytext;
+  note_write(new_assignment->identifier, new_assignment->frame_slot);
 
   nextToken = yylex();
   if (nextToken != TOK_ASSIGN)
@@ -299,8 +943,46 @@ AssignmentStatementNode *assignment() {
   return new_assignment;
 }
 
+ArrayAssignmentStatementNode *array_assignment() {
+  ArrayVariable *array = arrayTable[yytext];
+  ArrayAssignmentStatementNode *new_assignment =
+      new ArrayAssignmentStatementNode(level, array);
+  parse_log("enter <array_assignment>");
+  ++level;
+  output("IDENTIFIER");
+  if (printParse)
+    cout << psp() << yytext << "\n";
+
+  nextToken = yylex();
+  if (nextToken != TOK_OPENBRACKET)
+    throw("11: '[' expected");
+  output("OPENBRACKET");
+  nextToken = yylex();
+  output("EXPRESSION");
+  new_assignment->index_expression = expression();
+  if (nextToken != TOK_CLOSEBRACKET)
+    throw("12: ']' expected");
+  output("CLOSEBRACKET");
+  hoist_bounds_check(array, new_assignment->index_expression,
+                     &new_assignment->skip_check);
+
+  nextToken = yylex();
+  if (nextToken != TOK_ASSIGN)
+    throw("51: ':=' expected");
+  output("ASSIGN");
+
+  nextToken = yylex();
+  output("EXPRESSION");
+  new_assignment->assignment_expr = expression();
+
+  --level;
+  parse_log("exit <array_assignment>");
+  return new_assignment;
+}
+
 ExpressionNode *expression() {
   ExpressionNode *new_expression = new ExpressionNode(level);
+  new_expression->line = yylineno;
   parse_log("enter <expression>");
   ++level;
   output("SIMPLE_EXP");
@@ -337,6 +1019,7 @@ ExpressionNode *expression() {
     nextToken = yylex();
     output("SIMPLE_EXP");
     new_expression->second_simple_exp = simple_exp();
+    fold_expression(new_expression);
   }
 
   --level;
@@ -380,6 +1063,7 @@ SimpleExpressionNode *simple_exp() {
     output("TERM");
     new_simple_exp->following_terms.push_back(term());
   }
+  fold_simple_exp(new_simple_exp);
 
   --level;
   parse_log("exit <simple_exp>");
@@ -423,12 +1107,31 @@ TermNode *term() {
     output("FACTOR");
     new_term->following_factors.push_back(factor());
   }
+  fold_term(new_term);
 
   --level;
   parse_log("exit <term>");
   return new_term;
 }
 
+// Parses "[ index ]" after the name of an array in an expression.
+static FactorNode *array_factor(int factor_level) {
+  ArrayVariable *array = arrayTable[yytext];
+  nextToken = yylex();
+  if (nextToken != TOK_OPENBRACKET)
+    throw("11: '[' expected");
+  output("OPENBRACKET");
+  nextToken = yylex();
+  output("EXPRESSION");
+  ArrayFactorNode *element =
+      new ArrayFactorNode(factor_level, array, expression());
+  if (nextToken != TOK_CLOSEBRACKET)
+    throw("12: ']' expected");
+  output("CLOSEBRACKET");
+  hoist_bounds_check(array, element->index_expression, &element->skip_check);
+  return (FactorNode *)element;
+}
+
 FactorNode *factor() {
   FactorNode *new_factor = nullptr;
   int factor_level = level;
@@ -452,6 +1155,21 @@ FactorNode *factor() {
     output("IDENTIFIER");
     if (printParse)
       cout << psp() << yytext << "\n";
+    if (frame_slot(yytext) >= 0) {
+      IdFactorNode *local = new IdFactorNode(factor_level, yytext);
+      local->frame_slot = frame_slot(yytext);
+      new_factor = (FactorNode *)local;
+      break;
+    }
+    if (constantTable.find(yytext) != constantTable.end()) {
+      new_factor = (FactorNode *)new ConstantFactorNode(
+          factor_level, yytext, constantTable[yytext]);
+      break;
+    }
+    if (arrayTable.find(yytext) != arrayTable.end()) {
+      new_factor = array_factor(factor_level);
+      break;
+    }
     if (symbolTable.find(yytext) == symbolTable.end())
       throw("104: identifier not declared");
     new_factor = (FactorNode *)new IdFactorNode(factor_level, yytext);
@@ -488,6 +1206,7 @@ FactorNode *factor() {
     throw("903: illegal type of factor");
     break;
   }
+  new_factor = fold_factor(new_factor, factor_level);
 
   --level;
   parse_log("exit <factor>");
@@ -527,6 +1246,9 @@ IfStatementNode *if_statement() {
     --level;
     parse_log("exit <else>");
   }
+  new_if->has_loop_exit =
+      new_if->then_statement->has_loop_exit ||
+      (new_if->has_else && new_if->else_statement->has_loop_exit);
   parse_log("exit <if>");
   return new_if;
 }
@@ -540,9 +1262,95 @@ WhileStatementNode *while_statement() {
   output("EXPRESSION");
   new_while->while_expression = expression();
 
-  new_while->while_statement = statement();
+  {
+    LoopBodyScope body;
+    new_while->while_statement = statement();
+  }
 
   --level;
   parse_log("exit <while>");
   return new_while;
 }
+
+ForStatementNode *for_statement() {
+  ForStatementNode *new_for = new ForStatementNode(level);
+  // Report loops in source order, before any nested in this one.
+  size_t report_line = parallelReport.size();
+  parallelReport.push_back("line " + to_string(yylineno) + ": FOR ");
+  parse_log("enter <for>");
+  ++level;
+  nextToken = yylex();
+  if (nextToken != TOK_IDENT)
+    throw("2: identifier expected");
+  output("IDENTIFIER");
+  new_for->frame_slot = frame_slot(yytext);
+  if (new_for->frame_slot < 0) {
+    if (constantTable.find(yytext) != constantTable.end())
+      throw("103: identifier is not a variable");
+    if (symbolTable.find(yytext) == symbolTable.end())
+      throw("104: identifier not declared");
+  }
+  if (printParse)
+    cout << psp() << yytext << "\n";
+  new_for->identifier = yytext;
+  note_write(new_for->identifier, new_for->frame_slot);
+
+  nextToken = yylex();
+  if (nextToken != TOK_ASSIGN)
+    throw("51: ':=' expected");
+  output("ASSIGN");
+
+  nextToken = yylex();
+  output("EXPRESSION");
+  new_for->start_expression = expression();
+
+  switch (nextToken) {
+  case TOK_TO:
+    output("TO");
+    break;
+  case TOK_DOWNTO:
+    output("DOWNTO");
+    new_for->is_downto = true;
+    break;
+  default:
+    throw("55: 'TO' or 'DOWNTO' expected");
+    break;
+  }
+
+  nextToken = yylex();
+  output("EXPRESSION");
+  new_for->end_expression = expression();
+
+  if (nextToken != TOK_DO)
+    throw("54: 'DO' expected");
+  output("DO");
+
+  nextToken = yylex();
+  openForLoops.push_back(OpenForLoop{new_for, {}, {}, false});
+  {
+    LoopBodyScope body;
+    new_for->for_statement = statement();
+  }
+  OpenForLoop open_loop = openForLoops.back();
+  openForLoops.pop_back();
+  if (!open_loop.counter_written) {
+    for (auto it = open_loop.arrays.begin(); it != open_loop.arrays.end();
+         ++it)
+      if (find(new_for->hoisted_arrays.begin(), new_for->hoisted_arrays.end(),
+               *it) == new_for->hoisted_arrays.end())
+        new_for->hoisted_arrays.push_back(*it);
+    for (auto it = open_loop.checks.begin(); it != open_loop.checks.end();
+         ++it)
+      **it = &new_for->bounds_verified;
+  }
+
+  string why_serial;
+  new_for->parallel = plan_parallel_loop(new_for, why_serial);
+  parallelReport[report_line] +=
+      new_for->identifier +
+      (new_for->parallel ? " runs in parallel" : " runs serially, " + why_serial);
+
+  --level;
+  parse_log("exit <for>");
+  return new_for;
+}
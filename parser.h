@@ -6,27 +6,59 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 using namespace std;
 
 extern std::map<std::string, float> symbolTable;
+extern std::map<std::string, float> constantTable;
+extern std::map<std::string, ProcedureNode *> procedureTable;
+extern std::map<std::string, ArrayVariable *> arrayTable;
+
+// Procedure frames: parameters and locals of the running procedure live in
+// callStack[framePointer ...], and the next frame starts at stackTop. Workers
+// running a parallel loop have their own frames above stackTop.
+extern std::vector<float> callStack;
+extern thread_local size_t framePointer;
+extern thread_local size_t stackTop;
+// End of the part of callStack this thread's calls may use.
+extern thread_local size_t stackLimit;
+
+// Slots needed by the frame being parsed: the main program's outside a
+// procedure, which holds calls inlined into it.
+extern int frameSize;
 
 extern int nextToken;
 
 extern "C" {
 extern int yylex();
 extern char *yytext;
+extern int yylineno;
+// Tokens scanned, and the wall and CPU time spent scanning while lexTiming
+// is set; defined in rules.l.
+extern unsigned long lexTokens;
+extern int lexTiming;
+extern double lexSeconds;
+extern double lexCpuSeconds;
+// When set before the first token, the whole input is scanned then, and
+// this is called with 0 before and 1 after that scan.
+extern void (*lexPhaseHook)(int leaving);
 }
 
 ProgramNode *program();
 BlockNode *block();
 CompoundStatementNode *compound_statement();
+CobeginStatementNode *cobegin_statement();
 StatementNode *statement();
 WriteStatementNode *write();
 ReadStatementNode *read();
 
 void declare_ident();
+void declare_constant();
+ProcedureNode *declare_procedure();
+StatementNode *call_statement();
 AssignmentStatementNode *assignment();
+ArrayAssignmentStatementNode *array_assignment();
 
 ExpressionNode *expression();
 SimpleExpressionNode *simple_exp();
@@ -36,5 +68,6 @@ FactorNode *factor();
 
 IfStatementNode *if_statement();
 WhileStatementNode *while_statement();
+ForStatementNode *for_statement();
 
 #endif /* PARSER_H */
@@ -0,0 +1,171 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct PerfCounter {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+  int fd = -1;
+  std::string error;
+  // Count and the times it was enabled and running at the last reading;
+  // the kernel multiplexes counters when there are more than registers.
+  uint64_t last[3] = {0, 0, 0};
+  uint64_t phase[perfPhases][3] = {};
+};
+
+static std::vector<PerfCounter> perfCounters;
+static std::vector<PerfPhase> activePhases;
+static std::string perfError;
+
+#ifdef __linux__
+static uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result) {
+  return cache | (op << 8) | (result << 16);
+}
+
+static void add_counter(const char *name, uint32_t type, uint64_t config) {
+  PerfCounter counter;
+  counter.name = name;
+  counter.type = type;
+  counter.config = config;
+  perfCounters.push_back(counter);
+}
+
+bool perf_open() {
+  add_counter("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  add_counter("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  add_counter("branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+  add_counter("L1d read misses", PERF_TYPE_HW_CACHE,
+              cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS));
+  add_counter("LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  add_counter("task clock ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+  add_counter("page faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+
+  bool any = false;
+  for (auto it = perfCounters.begin(); it != perfCounters.end(); ++it) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = it->type;
+    attr.config = it->config;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    it->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (it->fd < 0) {
+      it->error = strerror(errno);
+      continue;
+    }
+    any = true;
+    if (read(it->fd, it->last, sizeof it->last) != sizeof it->last)
+      memset(it->last, 0, sizeof it->last);
+  }
+  if (!any)
+    perfError = perfCounters[0].error;
+  return any;
+}
+
+// Gives what the counters counted since the last reading to the innermost
+// active phase.
+static void perf_sample() {
+  for (auto it = perfCounters.begin(); it != perfCounters.end(); ++it) {
+    if (it->fd < 0)
+      continue;
+    uint64_t now[3];
+    if (read(it->fd, now, sizeof now) != sizeof now)
+      continue;
+    if (!activePhases.empty())
+      for (int i = 0; i < 3; i++)
+        it->phase[activePhases.back()][i] += now[i] - it->last[i];
+    memcpy(it->last, now, sizeof now);
+  }
+}
+#else
+bool perf_open() {
+  perfError = "perf_event_open needs Linux";
+  return false;
+}
+
+static void perf_sample() {}
+#endif
+
+void perf_phase_begin(PerfPhase phase) {
+  perf_sample();
+  activePhases.push_back(phase);
+}
+
+void perf_phase_end(PerfPhase phase) {
+  perf_sample();
+  if (!activePhases.empty() && activePhases.back() == phase)
+    activePhases.pop_back();
+}
+
+static double scaled(const uint64_t count[3]) {
+  if (count[2] == 0)
+    return 0.0;
+  return (double)count[0] * count[1] / count[2];
+}
+
+void perf_report(std::ostream &os) {
+  os << std::endl << "*** Performance Counters ***" << std::endl;
+  if (perfCounters.empty() || !perfError.empty()) {
+    os << "unavailable: " << (perfError.empty() ? "not opened" : perfError)
+       << std::endl;
+    return;
+  }
+
+  char line[160];
+  snprintf(line, sizeof line, "%-16s %16s %16s %16s", "counter", "lex",
+           "parse", "execute");
+  os << line << std::endl;
+  for (auto it = perfCounters.begin(); it != perfCounters.end(); ++it) {
+    if (it->fd < 0) {
+      snprintf(line, sizeof line, "%-16s unavailable: %s", it->name,
+               it->error.c_str());
+    } else {
+      snprintf(line, sizeof line, "%-16s %16.0f %16.0f %16.0f", it->name,
+               scaled(it->phase[perfLex]), scaled(it->phase[perfParse]),
+               scaled(it->phase[perfExecute]));
+    }
+    os << line << std::endl;
+  }
+
+  // Instructions per cycle and branch misses per thousand instructions.
+  const PerfCounter &cycles = perfCounters[0];
+  const PerfCounter &instructions = perfCounters[1];
+  const PerfCounter &branch_misses = perfCounters[2];
+  if (cycles.fd >= 0 && instructions.fd >= 0) {
+    double ipc[perfPhases];
+    for (int p = 0; p < perfPhases; p++) {
+      double spent = scaled(cycles.phase[p]);
+      ipc[p] = spent > 0.0 ? scaled(instructions.phase[p]) / spent : 0.0;
+    }
+    snprintf(line, sizeof line, "%-16s %16.2f %16.2f %16.2f", "IPC", ipc[0],
+             ipc[1], ipc[2]);
+    os << line << std::endl;
+  }
+  if (instructions.fd >= 0 && branch_misses.fd >= 0) {
+    double rate[perfPhases];
+    for (int p = 0; p < perfPhases; p++) {
+      double done = scaled(instructions.phase[p]);
+      rate[p] = done > 0.0 ? 1000.0 * scaled(branch_misses.phase[p]) / done
+                           : 0.0;
+    }
+    snprintf(line, sizeof line, "%-16s %16.2f %16.2f %16.2f",
+             "br miss / 1k ins", rate[0], rate[1], rate[2]);
+    os << line << std::endl;
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <ostream>
+
+// Linux perf_event_open counters for --perf-counters: cycles, instructions,
+// branch misses, L1 data and last level cache misses, plus task clock and
+// page faults from the kernel. Only the main thread is counted. Counters the
+// machine or its permissions do not provide are reported as unavailable.
+enum PerfPhase { perfLex, perfParse, perfExecute, perfPhases };
+
+// Opens the counters and starts counting; false when none could be opened.
+bool perf_open();
+// Marks the start and end of a phase. Phases may nest (lexing happens inside
+// parsing); the outer phase does not count what the inner one did.
+void perf_phase_begin(PerfPhase phase);
+void perf_phase_end(PerfPhase phase);
+
+void perf_report(std::ostream &os);
+
+#endif /* PERF_COUNTERS_H */
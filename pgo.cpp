@@ -0,0 +1,195 @@
+#include "pgo.h"
+#include "closed_form.h"
+#include "parser.h"
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+// Profile layout (native byte order):
+//   "TIPSPGO1", u64 source hash, u32 statement count,
+//   u32 entry count, { u32 statement, u64 runs } ... for statements that ran
+static const char profileMagic[8] = {'T', 'I', 'P', 'S', 'P', 'G', 'O', '1'};
+
+static uint32_t statementCount = 0;
+
+static bool profileLoaded = false;
+static std::string loadedPath;
+static std::vector<unsigned long long> loadedCounts;
+
+// Counts of this run, indexed by statement number.
+static std::vector<unsigned long long> runCounts;
+
+class CountedStatementNode : public StatementNode {
+public:
+  StatementNode *statement;
+  unsigned long long *runs;
+  CountedStatementNode(StatementNode *inner, unsigned long long *counter);
+  ~CountedStatementNode() { delete statement; }
+  void printTo(std::ostream &os) { statement->printTo(os); }
+  float interpret() {
+    ++*runs;
+    return statement->interpret();
+  }
+  StatementNode *clone(int slot_offset) {
+    return statement->clone(slot_offset);
+  }
+};
+
+CountedStatementNode::CountedStatementNode(StatementNode *inner,
+                                           unsigned long long *counter) {
+  statement = inner;
+  runs = counter;
+  _level = inner->_level;
+  line = inner->line;
+  has_loop_exit = inner->has_loop_exit;
+}
+
+// Calls visit on each statement directly inside statement.
+template <typename Visit>
+static void for_children(StatementNode *statement, Visit visit) {
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      visit(*it);
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    visit(if_stmt->then_statement);
+    if (if_stmt->has_else)
+      visit(if_stmt->else_statement);
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    visit(loop->while_statement);
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    visit(loop->for_statement);
+  }
+}
+
+static void number(StatementNode *statement) {
+  statement->pgo_site = statementCount++;
+  for_children(statement, [](StatementNode *&child) { number(child); });
+}
+
+void pgo_number(ProgramNode *root) {
+  number(root->program_block->compound_stmt);
+  for (auto it = procedureTable.begin(); it != procedureTable.end(); ++it)
+    if (it->second->body)
+      number(it->second->body);
+}
+
+template <typename T> static bool read_value(FILE *file, T &value) {
+  return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+bool pgo_load(const char *path, unsigned long long source_hash,
+              std::string &why) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    why = std::string("no profile in ") + path;
+    return false;
+  }
+
+  char magic[sizeof(profileMagic)];
+  uint64_t hash = 0;
+  uint32_t statements = 0, entries = 0;
+  bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+            memcmp(magic, profileMagic, sizeof(magic)) == 0 &&
+            read_value(file, hash) && read_value(file, statements) &&
+            read_value(file, entries);
+  if (ok && (hash != source_hash || statements != statementCount)) {
+    fclose(file);
+    why = "the profile was recorded for a different program";
+    return false;
+  }
+
+  std::vector<unsigned long long> counts(statementCount, 0);
+  for (uint32_t i = 0; ok && i < entries; i++) {
+    uint32_t statement = 0;
+    uint64_t runs = 0;
+    ok = read_value(file, statement) && read_value(file, runs) &&
+         statement < statementCount;
+    if (ok)
+      counts[statement] = runs;
+  }
+  fclose(file);
+  if (!ok) {
+    why = "the profile is corrupt";
+    return false;
+  }
+
+  loadedCounts.swap(counts);
+  loadedPath = path;
+  profileLoaded = true;
+  return true;
+}
+
+long long pgo_count(StatementNode *statement) {
+  if (!profileLoaded || statement->pgo_site < 0)
+    return -1;
+  return loadedCounts[statement->pgo_site];
+}
+
+double pgo_trips(WhileStatementNode *loop) {
+  long long runs = pgo_count(loop);
+  long long iterations = pgo_count(loop->while_statement);
+  if (runs <= 0 || iterations < 0)
+    return -1.0;
+  return (double)iterations / runs;
+}
+
+// Loops computed in closed form are made to iterate, so that their bodies
+// are counted.
+static void wrap(StatementNode *&statement) {
+  for_children(statement, [](StatementNode *&child) { wrap(child); });
+  if (WhileStatementNode *loop = dynamic_cast<WhileStatementNode *>(statement)) {
+    delete loop->closed_form;
+    loop->closed_form = nullptr;
+  }
+  if (statement->pgo_site >= 0)
+    statement = new CountedStatementNode(statement,
+                                         &runCounts[statement->pgo_site]);
+}
+
+void pgo_record(ProgramNode *root) {
+  runCounts.assign(statementCount, 0);
+  for_children(root->program_block->compound_stmt,
+               [](StatementNode *&child) { wrap(child); });
+  for (auto it = procedureTable.begin(); it != procedureTable.end(); ++it)
+    if (it->second->body)
+      for_children(it->second->body,
+                   [](StatementNode *&child) { wrap(child); });
+}
+
+bool pgo_save(const char *path, unsigned long long source_hash) {
+  std::vector<unsigned long long> counts = runCounts;
+  if (profileLoaded && loadedPath == path)
+    for (size_t i = 0; i < counts.size(); i++)
+      counts[i] += loadedCounts[i];
+
+  std::string buffer(profileMagic, sizeof(profileMagic));
+  uint64_t hash = source_hash;
+  buffer.append((const char *)&hash, sizeof(hash));
+  buffer.append((const char *)&statementCount, sizeof(statementCount));
+  uint32_t entries = 0;
+  for (size_t i = 0; i < counts.size(); i++)
+    entries += counts[i] != 0;
+  buffer.append((const char *)&entries, sizeof(entries));
+  for (uint32_t i = 0; i < counts.size(); i++) {
+    if (counts[i] == 0)
+      continue;
+    uint64_t runs = counts[i];
+    buffer.append((const char *)&i, sizeof(i));
+    buffer.append((const char *)&runs, sizeof(runs));
+  }
+
+  // Written beside the old profile and renamed over it, as checkpoints are.
+  std::string temp = std::string(path) + ".tmp";
+  FILE *file = fopen(temp.c_str(), "wb");
+  if (!file)
+    return false;
+  bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  ok = fclose(file) == 0 && ok;
+  return ok && rename(temp.c_str(), path) == 0;
+}
@@ -0,0 +1,37 @@
+#ifndef PGO_H
+#define PGO_H
+
+#include "parse_tree_nodes.h"
+#include <string>
+
+// Profile-guided optimization across runs. --pgo-record counts how often
+// each statement runs and saves the counts, keyed to the source hash;
+// --pgo-use loads them on a later run. IF outcomes and WHILE trip counts are
+// the counts of the branches and bodies against those of the statements.
+
+// Numbers the statements of the program as parsed, before the optimizer
+// changes anything; profiles name statements by these numbers.
+void pgo_number(ProgramNode *root);
+
+// Reads a profile saved for the same source. Returns false, with the reason
+// in why, when it is missing or was recorded for another program; the run
+// then goes on without it.
+bool pgo_load(const char *path, unsigned long long source_hash,
+              std::string &why);
+
+// Runs of statement in the loaded profile, or -1 when there is no profile
+// or the optimizer made the statement.
+long long pgo_count(StatementNode *statement);
+
+// Iterations per run of a WHILE loop in the loaded profile, or -1 when
+// unknown or never run.
+double pgo_trips(WhileStatementNode *loop);
+
+// Wraps the statements of the program in counters for this run. The
+// counters are not shared between threads.
+void pgo_record(ProgramNode *root);
+
+// Writes the counts of this run, added to those loaded from the same file.
+bool pgo_save(const char *path, unsigned long long source_hash);
+
+#endif /* PGO_H */
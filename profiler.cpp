@@ -0,0 +1,254 @@
+#include "profiler.h"
+#include "closed_form.h"
+#include "lexer.h"
+#include "parser.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A statement of the source, with its totals over all the paths it ran on.
+struct ProfileSite {
+  int line = 0;
+  std::string label;
+  bool is_loop = false;
+  ProfileSite *loop_body = nullptr;
+  unsigned long long count = 0;
+  double total = 0.0; // seconds, counting recursive activations once
+  double self = 0.0;  // seconds not spent in profiled statements inside
+  int active = 0;
+};
+
+// A chain of statements, each running inside the one before.
+struct ProfilePath {
+  ProfileSite *site = nullptr;
+  std::map<ProfileSite *, ProfilePath *> inner;
+  double self = 0.0;
+};
+
+static std::vector<std::unique_ptr<ProfileSite>> profileSites;
+static std::vector<std::unique_ptr<ProfilePath>> profilePaths;
+static ProfilePath rootPath;
+static ProfilePath *currentPath = &rootPath;
+// Time spent in profiled statements inside each active one.
+static std::vector<double> innerTime(1, 0.0);
+
+static double seconds_now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+class ProfiledStatementNode : public StatementNode {
+public:
+  StatementNode *statement;
+  ProfileSite *site;
+  ProfiledStatementNode(StatementNode *inner, ProfileSite *where);
+  ~ProfiledStatementNode();
+  void printTo(std::ostream &os) { statement->printTo(os); }
+  float interpret();
+  StatementNode *clone(int slot_offset) {
+    return statement->clone(slot_offset);
+  }
+};
+
+ProfiledStatementNode::ProfiledStatementNode(StatementNode *inner,
+                                             ProfileSite *where) {
+  statement = inner;
+  site = where;
+  _level = inner->_level;
+  line = inner->line;
+  has_loop_exit = inner->has_loop_exit;
+}
+
+ProfiledStatementNode::~ProfiledStatementNode() { delete statement; }
+
+// Ends the activation when the statement returns or throws.
+struct ProfileActivation {
+  ProfileSite *site;
+  ProfilePath *outer_path;
+  double start;
+
+  ProfileActivation(ProfileSite *where) {
+    site = where;
+    outer_path = currentPath;
+    ProfilePath *&path = currentPath->inner[site];
+    if (!path) {
+      profilePaths.push_back(std::unique_ptr<ProfilePath>(new ProfilePath()));
+      path = profilePaths.back().get();
+      path->site = site;
+    }
+    currentPath = path;
+    site->count++;
+    site->active++;
+    innerTime.push_back(0.0);
+    start = seconds_now();
+  }
+
+  ~ProfileActivation() {
+    double elapsed = seconds_now() - start;
+    double self = elapsed - innerTime.back();
+    innerTime.pop_back();
+    innerTime.back() += elapsed;
+    currentPath->self += self;
+    site->self += self;
+    if (--site->active == 0)
+      site->total += elapsed;
+    currentPath = outer_path;
+  }
+};
+
+float ProfiledStatementNode::interpret() {
+  ProfileActivation activation(site);
+  return statement->interpret();
+}
+
+static std::string statement_label(StatementNode *statement) {
+  if (dynamic_cast<CobeginStatementNode *>(statement))
+    return "COBEGIN";
+  if (dynamic_cast<CompoundStatementNode *>(statement))
+    return "BEGIN";
+  if (AssignmentStatementNode *assignment =
+          dynamic_cast<AssignmentStatementNode *>(statement))
+    return assignment->identifier + " :=";
+  if (ArrayAssignmentStatementNode *element =
+          dynamic_cast<ArrayAssignmentStatementNode *>(statement))
+    return element->array->name + "[] :=";
+  if (ReadStatementNode *read = dynamic_cast<ReadStatementNode *>(statement))
+    return "READ " + read->read_text;
+  if (dynamic_cast<WriteStatementNode *>(statement))
+    return "WRITE";
+  if (dynamic_cast<IfStatementNode *>(statement))
+    return "IF";
+  if (dynamic_cast<WhileStatementNode *>(statement))
+    return "WHILE";
+  if (ForStatementNode *for_stmt = dynamic_cast<ForStatementNode *>(statement))
+    return "FOR " + for_stmt->identifier;
+  if (CallStatementNode *call = dynamic_cast<CallStatementNode *>(statement))
+    return "CALL " + call->procedure->name;
+  if (LoopExitStatementNode *exit =
+          dynamic_cast<LoopExitStatementNode *>(statement))
+    return exit->exit_token == TOK_BREAK ? "BREAK" : "CONTINUE";
+  return "statement";
+}
+
+static ProfileSite *wrap(StatementNode *&statement);
+
+static void wrap_children(StatementNode *statement, ProfileSite *site) {
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      wrap(*it);
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    wrap(if_stmt->then_statement);
+    if (if_stmt->has_else)
+      wrap(if_stmt->else_statement);
+  } else if (WhileStatementNode *while_stmt =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    // Loops computed in closed form are made to iterate, so that their
+    // bodies are profiled.
+    delete while_stmt->closed_form;
+    while_stmt->closed_form = nullptr;
+    site->is_loop = true;
+    site->loop_body = wrap(while_stmt->while_statement);
+  } else if (ForStatementNode *for_stmt =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    site->is_loop = true;
+    site->loop_body = wrap(for_stmt->for_statement);
+  }
+}
+
+static ProfileSite *wrap(StatementNode *&statement) {
+  profileSites.push_back(std::unique_ptr<ProfileSite>(new ProfileSite()));
+  ProfileSite *site = profileSites.back().get();
+  site->line = statement->line;
+  site->label = statement_label(statement);
+  wrap_children(statement, site);
+  statement = new ProfiledStatementNode(statement, site);
+  return site;
+}
+
+void profile_program(ProgramNode *root) {
+  wrap_children(root->program_block->compound_stmt, nullptr);
+  for (auto it = procedureTable.begin(); it != procedureTable.end(); ++it)
+    if (it->second->body)
+      wrap_children(it->second->body, nullptr);
+}
+
+static std::string site_name(ProfileSite *site) {
+  return "line " + std::to_string(site->line) + " " + site->label;
+}
+
+static std::string milliseconds(double seconds) {
+  char text[32];
+  snprintf(text, sizeof text, "%.3f", seconds * 1000.0);
+  return text;
+}
+
+void profile_report(std::ostream &os) {
+  std::vector<ProfileSite *> ran;
+  double all_self = 0.0;
+  for (auto it = profileSites.begin(); it != profileSites.end(); ++it) {
+    if ((*it)->count == 0)
+      continue;
+    ran.push_back(it->get());
+    all_self += (*it)->self;
+  }
+  std::stable_sort(ran.begin(), ran.end(), [](ProfileSite *a, ProfileSite *b) {
+    return a->self != b->self ? a->self > b->self : a->total > b->total;
+  });
+
+  char row[160];
+  os << std::endl << "*** Profile ***" << std::endl;
+  snprintf(row, sizeof row, "%6s  %-20s %12s %12s %12s %7s", "line",
+           "statement", "count", "self ms", "total ms", "self %");
+  os << row << std::endl;
+  for (auto it = ran.begin(); it != ran.end(); ++it) {
+    ProfileSite *site = *it;
+    double share = all_self > 0.0 ? 100.0 * site->self / all_self : 0.0;
+    snprintf(row, sizeof row, "%6d  %-20s %12llu %12s %12s %6.1f%%",
+             site->line, site->label.substr(0, 20).c_str(), site->count,
+             milliseconds(site->self).c_str(),
+             milliseconds(site->total).c_str(), share);
+    os << row << std::endl;
+  }
+
+  bool header = false;
+  for (auto it = ran.begin(); it != ran.end(); ++it) {
+    ProfileSite *site = *it;
+    if (!site->is_loop)
+      continue;
+    if (!header) {
+      os << std::endl << "*** Loops ***" << std::endl;
+      snprintf(row, sizeof row, "%6s  %-20s %12s %12s %12s", "line", "loop",
+               "runs", "iterations", "total ms");
+      os << row << std::endl;
+      header = true;
+    }
+    unsigned long long iterations =
+        site->loop_body ? site->loop_body->count : 0;
+    snprintf(row, sizeof row, "%6d  %-20s %12llu %12llu %12s", site->line,
+             site->label.substr(0, 20).c_str(), site->count, iterations,
+             milliseconds(site->total).c_str());
+    os << row << std::endl;
+  }
+}
+
+static void write_paths(std::ostream &os, ProfilePath *path,
+                        const std::string &stack) {
+  long long micros = llround(path->self * 1e6);
+  if (path->site && micros > 0)
+    os << stack << " " << micros << "\n";
+  for (auto it = path->inner.begin(); it != path->inner.end(); ++it)
+    write_paths(os, it->second, stack + ";" + site_name(it->first));
+}
+
+void profile_write_folded(std::ostream &os) {
+  write_paths(os, &rootPath, "PROGRAM");
+}
@@ -0,0 +1,18 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "parse_tree_nodes.h"
+#include <ostream>
+
+// Statement profiler for -P. profile_program wraps every statement of the
+// program and of its procedures in a node that counts executions and times
+// them, so nothing is measured, or slower, unless it was called.
+void profile_program(ProgramNode *root);
+
+// Hot spots by time spent in each statement itself, then by total time.
+void profile_report(std::ostream &os);
+// One line per call path, "frame;frame;... microseconds", the input of
+// flame-graph tools.
+void profile_write_folded(std::ostream &os);
+
+#endif /* PROFILER_H */
@@ -0,0 +1,344 @@
+#include "quicken.h"
+#include "parser.h"
+#include <map>
+#include <mutex>
+
+template <typename Node> using Quick = float (*)(Node *);
+
+// Nodes are quickened once, under this lock, in case the threads running
+// COBEGIN statements call the same procedure. Readers load quick with
+// acquire ordering, so they see the operands stored before it.
+static std::mutex quickenMutex;
+
+// Nodes quickened by shape.
+static std::map<std::string, unsigned long> shapes;
+
+template <bool slot> static inline float &storage(const QuickOperand &operand) {
+  return slot ? callStack[framePointer + operand.slot] : *operand.fixed;
+}
+
+// Fills operand when factor is a variable or a constant.
+static bool operand_of(FactorNode *factor, QuickOperand &operand) {
+  if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor)) {
+    if (id->frame_slot >= 0) {
+      operand.slot = id->frame_slot;
+      return true;
+    }
+    // Left to the factor, which fails when the global is undefined.
+    auto var = symbolTable.find(id->identifier);
+    if (var == symbolTable.end())
+      return false;
+    operand.fixed = &var->second;
+    return true;
+  }
+  if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(factor)) {
+    // Literals out of float range fail when evaluated, as written.
+    try {
+      operand.constant = std::stof(literal->int_literal);
+    } catch (...) {
+      return false;
+    }
+  } else if (FloatFactorNode *literal =
+                 dynamic_cast<FloatFactorNode *>(factor)) {
+    operand.constant = literal->float_literal;
+  } else if (ConstantFactorNode *constant =
+                 dynamic_cast<ConstantFactorNode *>(factor)) {
+    operand.constant = constant->constant_value;
+  } else {
+    return false;
+  }
+  operand.fixed = &operand.constant;
+  return true;
+}
+
+static bool operand_of(TermNode *term, QuickOperand &operand) {
+  return term->following_operators.empty() &&
+         operand_of(term->first_factor, operand);
+}
+
+static bool operand_of(SimpleExpressionNode *simple_exp,
+                       QuickOperand &operand) {
+  return simple_exp->following_operators.empty() &&
+         operand_of(simple_exp->first_term, operand);
+}
+
+static bool is_constant(const QuickOperand &operand) {
+  return operand.fixed == &operand.constant;
+}
+
+static const char *kind(const QuickOperand &operand) {
+  if (operand.slot >= 0)
+    return "slot";
+  return is_constant(operand) ? "constant" : "global";
+}
+
+static const char *operator_text(int op) {
+  switch (op) {
+  case TOK_PLUS:
+    return "+";
+  case TOK_MINUS:
+    return "-";
+  case TOK_MULTIPLY:
+    return "*";
+  case TOK_DIVIDE:
+    return "/";
+  case TOK_LESSTHAN:
+    return "<";
+  case TOK_GREATERTHAN:
+    return ">";
+  case TOK_EQUALTO:
+    return "=";
+  case TOK_NOTEQUALTO:
+    return "<>";
+  default:
+    return "?";
+  }
+}
+
+template <typename Node>
+static Quick<Node> publish(Node *node, Quick<Node> run,
+                           const std::string &shape) {
+  shapes[shape]++;
+  node->quick.store(run, std::memory_order_release);
+  return run;
+}
+
+// Routines for one operand, or two with the operator given by the Shape.
+
+template <bool slot, typename Node> static float read_one(Node *node) {
+  return storage<slot>(node->quick_left);
+}
+
+template <typename Node> static Quick<Node> pick(const QuickOperand &left) {
+  return left.slot >= 0 ? read_one<true, Node> : read_one<false, Node>;
+}
+
+template <typename Shape, typename Node>
+static Quick<Node> pick(const QuickOperand &left, const QuickOperand &right) {
+  if (left.slot >= 0)
+    return right.slot >= 0 ? Shape::template run<true, true>
+                           : Shape::template run<true, false>;
+  return right.slot >= 0 ? Shape::template run<false, true>
+                         : Shape::template run<false, false>;
+}
+
+template <int op> struct TermShape {
+  template <bool left_slot, bool right_slot> static float run(TermNode *term) {
+    float result = storage<left_slot>(term->quick_left);
+    float right = storage<right_slot>(term->quick_right);
+    return op == TOK_MULTIPLY ? result * right : result / right;
+  }
+};
+
+template <int op> struct SimpleShape {
+  template <bool left_slot, bool right_slot>
+  static float run(SimpleExpressionNode *simple_exp) {
+    float result = storage<left_slot>(simple_exp->quick_left);
+    float right = storage<right_slot>(simple_exp->quick_right);
+    return op == TOK_PLUS ? result + right : result - right;
+  }
+};
+
+template <int op, bool exact> struct CompareShape {
+  template <bool left_slot, bool right_slot>
+  static float run(ExpressionNode *expression) {
+    return compare_fixed<op, exact>(
+        storage<left_slot>(expression->quick_left),
+        storage<right_slot>(expression->quick_right));
+  }
+};
+
+template <bool exact>
+static Quick<ExpressionNode> pick_compare(ExpressionNode *expression) {
+  const QuickOperand &left = expression->quick_left;
+  const QuickOperand &right = expression->quick_right;
+  switch (expression->simple_exp_operator) {
+  case TOK_LESSTHAN:
+    return pick<CompareShape<TOK_LESSTHAN, exact>, ExpressionNode>(left,
+                                                                   right);
+  case TOK_GREATERTHAN:
+    return pick<CompareShape<TOK_GREATERTHAN, exact>, ExpressionNode>(left,
+                                                                      right);
+  case TOK_EQUALTO:
+    return pick<CompareShape<TOK_EQUALTO, exact>, ExpressionNode>(left,
+                                                                  right);
+  case TOK_NOTEQUALTO:
+    return pick<CompareShape<TOK_NOTEQUALTO, exact>, ExpressionNode>(left,
+                                                                     right);
+  default:
+    return nullptr;
+  }
+}
+
+// Nodes whose only operand is not a variable or constant call it directly.
+
+static float first_only(ExpressionNode *expression) {
+  return expression->first_simple_exp->interpret();
+}
+
+static float first_only(SimpleExpressionNode *simple_exp) {
+  return simple_exp->first_term->interpret();
+}
+
+static float first_only(TermNode *term) {
+  return term->first_factor->interpret();
+}
+
+template <typename Node> static float as_written(Node *node) {
+  return node->evaluate();
+}
+
+Quick<ExpressionNode> quicken(ExpressionNode *expression) {
+  std::lock_guard<std::mutex> lock(quickenMutex);
+  if (Quick<ExpressionNode> run = expression->quick.load())
+    return run;
+  QuickOperand &left = expression->quick_left;
+  QuickOperand &right = expression->quick_right;
+  bool simple = operand_of(expression->first_simple_exp, left);
+  if (expression->simple_exp_operator == TOK_UNKNOWN) {
+    if (simple)
+      return publish(expression, pick<ExpressionNode>(left),
+                     std::string("expression: ") + kind(left));
+    return publish(expression, first_only, "expression: one operand");
+  }
+  Quick<ExpressionNode> run = nullptr;
+  if (simple && operand_of(expression->second_simple_exp, right))
+    run = expression->exact_compare ? pick_compare<true>(expression)
+                                    : pick_compare<false>(expression);
+  if (!run)
+    return publish(expression, as_written<ExpressionNode>,
+                   "expression: as written");
+  return publish(expression, run,
+                 std::string("expression: ") + kind(left) + " " +
+                     operator_text(expression->simple_exp_operator) + " " +
+                     kind(right) +
+                     (expression->exact_compare ? ", exact" : ""));
+}
+
+Quick<SimpleExpressionNode> quicken(SimpleExpressionNode *simple_exp) {
+  std::lock_guard<std::mutex> lock(quickenMutex);
+  if (Quick<SimpleExpressionNode> run = simple_exp->quick.load())
+    return run;
+  QuickOperand &left = simple_exp->quick_left;
+  QuickOperand &right = simple_exp->quick_right;
+  bool simple = operand_of(simple_exp->first_term, left);
+  std::vector<int> &operators = simple_exp->following_operators;
+  if (operators.empty()) {
+    if (simple)
+      return publish(simple_exp, pick<SimpleExpressionNode>(left),
+                     std::string("simple_exp: ") + kind(left));
+    return publish(simple_exp, first_only, "simple_exp: one term");
+  }
+  Quick<SimpleExpressionNode> run = nullptr;
+  if (simple && operators.size() == 1 &&
+      operand_of(simple_exp->following_terms[0], right)) {
+    if (operators[0] == TOK_PLUS)
+      run = pick<SimpleShape<TOK_PLUS>, SimpleExpressionNode>(left, right);
+    else if (operators[0] == TOK_MINUS)
+      run = pick<SimpleShape<TOK_MINUS>, SimpleExpressionNode>(left, right);
+  }
+  if (!run)
+    return publish(simple_exp, as_written<SimpleExpressionNode>,
+                   "simple_exp: as written");
+  return publish(simple_exp, run,
+                 std::string("simple_exp: ") + kind(left) + " " +
+                     operator_text(operators[0]) + " " + kind(right));
+}
+
+Quick<TermNode> quicken(TermNode *term) {
+  std::lock_guard<std::mutex> lock(quickenMutex);
+  if (Quick<TermNode> run = term->quick.load())
+    return run;
+  QuickOperand &left = term->quick_left;
+  QuickOperand &right = term->quick_right;
+  bool simple = operand_of(term->first_factor, left);
+  std::vector<int> &operators = term->following_operators;
+  if (operators.empty()) {
+    if (simple)
+      return publish(term, pick<TermNode>(left),
+                     std::string("term: ") + kind(left));
+    return publish(term, first_only, "term: one factor");
+  }
+  Quick<TermNode> run = nullptr;
+  if (simple && operators.size() == 1 &&
+      operand_of(term->following_factors[0], right)) {
+    if (operators[0] == TOK_MULTIPLY)
+      run = pick<TermShape<TOK_MULTIPLY>, TermNode>(left, right);
+    else if (operators[0] == TOK_DIVIDE)
+      run = pick<TermShape<TOK_DIVIDE>, TermNode>(left, right);
+  }
+  if (!run)
+    return publish(term, as_written<TermNode>, "term: as written");
+  return publish(term, run,
+                 std::string("term: ") + kind(left) + " " +
+                     operator_text(operators[0]) + " " + kind(right));
+}
+
+// V := V + C and V := V - C for a constant C.
+template <bool slot, int op>
+static float step(AssignmentStatementNode *assignment) {
+  if (countStatements)
+    statementsExecuted++;
+  float &variable = storage<slot>(assignment->quick_left);
+  float constant = assignment->quick_right.constant;
+  return variable = op == TOK_PLUS ? variable + constant : variable - constant;
+}
+
+template <bool slot> static float store(AssignmentStatementNode *assignment) {
+  if (countStatements)
+    statementsExecuted++;
+  float value = assignment->assignment_expr->interpret();
+  return storage<slot>(assignment->quick_left) = value;
+}
+
+Quick<AssignmentStatementNode> quicken(AssignmentStatementNode *assignment) {
+  std::lock_guard<std::mutex> lock(quickenMutex);
+  if (Quick<AssignmentStatementNode> run = assignment->quick.load())
+    return run;
+  QuickOperand &target = assignment->quick_left;
+  if (assignment->frame_slot >= 0) {
+    target.slot = assignment->frame_slot;
+  } else {
+    auto var = symbolTable.find(assignment->identifier);
+    if (var == symbolTable.end())
+      return publish(assignment, as_written<AssignmentStatementNode>,
+                     "assignment: as written");
+    target.fixed = &var->second;
+  }
+  bool slot = target.slot >= 0;
+
+  ExpressionNode *value = assignment->assignment_expr;
+  SimpleExpressionNode *simple_exp = value->first_simple_exp;
+  QuickOperand read;
+  QuickOperand &constant = assignment->quick_right;
+  if (value->simple_exp_operator == TOK_UNKNOWN &&
+      simple_exp->following_operators.size() == 1 &&
+      operand_of(simple_exp->first_term, read) &&
+      read.slot == target.slot && (slot || read.fixed == target.fixed) &&
+      operand_of(simple_exp->following_terms[0], constant) &&
+      is_constant(constant)) {
+    int op = simple_exp->following_operators[0];
+    Quick<AssignmentStatementNode> run = nullptr;
+    if (op == TOK_PLUS)
+      run = slot ? step<true, TOK_PLUS> : step<false, TOK_PLUS>;
+    else if (op == TOK_MINUS)
+      run = slot ? step<true, TOK_MINUS> : step<false, TOK_MINUS>;
+    if (run)
+      return publish(assignment, run,
+                     std::string("assignment: ") + kind(target) + " " +
+                         operator_text(op) + "= constant");
+  }
+  return publish(assignment, slot ? store<true> : store<false>,
+                 std::string("assignment: to ") + kind(target));
+}
+
+void print_quickening(std::ostream &os) {
+  std::lock_guard<std::mutex> lock(quickenMutex);
+  os << std::endl << "*** Quickened Nodes ***" << std::endl;
+  unsigned long total = 0;
+  for (auto it = shapes.begin(); it != shapes.end(); ++it) {
+    os << it->second << " " << it->first << std::endl;
+    total += it->second;
+  }
+  os << total << " nodes quickened" << std::endl;
+}
@@ -0,0 +1,42 @@
+#ifndef QUICKEN_H
+#define QUICKEN_H
+
+#include "parse_tree_nodes.h"
+#include <cmath>
+#include <ostream>
+
+// Quickening: on its first interpret(), an expression, simple expression,
+// term or assignment picks a routine made for its shape and runs that from
+// then on. Operands that are variables or constants are read straight from
+// their storage, and the operator is fixed in the routine, so common shapes
+// such as A + B, I < 10 or I := I - 1 run without calling their factors or
+// switching on the operator. Other shapes run as written.
+//
+// Each returns the routine now stored in the node's quick member.
+float (*quicken(ExpressionNode *expression))(ExpressionNode *);
+float (*quicken(SimpleExpressionNode *simple_exp))(SimpleExpressionNode *);
+float (*quicken(TermNode *term))(TermNode *);
+float (*quicken(AssignmentStatementNode *assignment))(
+    AssignmentStatementNode *);
+
+// compare_values(), or compare_integers() when exact, for an operator fixed
+// at compile time.
+template <int op, bool exact>
+inline float compare_fixed(float first, float second) {
+  const double epsilon = 0.001; // EPSILON
+  bool holds;
+  if (op == TOK_LESSTHAN)
+    holds = exact ? first < second : first - second < 0.0;
+  else if (op == TOK_GREATERTHAN)
+    holds = exact ? first > second : first - second >= epsilon;
+  else if (op == TOK_EQUALTO)
+    holds = exact ? first == second : std::abs(first - second) <= epsilon;
+  else
+    holds = exact ? first != second : std::abs(first - second) > epsilon;
+  return holds ? 1.0 : 0.0;
+}
+
+// How many nodes took each shape so far (--report-quickening).
+void print_quickening(std::ostream &os);
+
+#endif /* QUICKEN_H */
@@ -0,0 +1,557 @@
+#include "range_analysis.h"
+#include "parser.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <set>
+#include <sstream>
+#include <utility>
+
+// Floats represent every integer up to here exactly, so counting by one
+// reaches each of them.
+static const float exactIntegers = 16777216.0;
+static const float infinity = INFINITY;
+// Passes over the program before bounds that keep growing are widened.
+static const int exactPasses = 4;
+
+// The values an expression or variable may take: all lie in [low, high],
+// apart from NaN when maybe_nan is set. integral says they are all whole
+// numbers, so finite and never NaN. The default is the 0.0 every variable
+// starts with.
+struct ValueRange {
+  float low = 0.0;
+  float high = 0.0;
+  bool integral = true;
+  bool maybe_nan = false;
+};
+
+// A global by name with slot -1, or a frame slot of a procedure; the
+// procedure is nullptr for the main program's frame.
+struct RangeVariable {
+  ProcedureNode *procedure = nullptr;
+  int slot = -1;
+  std::string name;
+
+  bool operator<(const RangeVariable &other) const {
+    if (procedure != other.procedure)
+      return procedure < other.procedure;
+    if (slot != other.slot)
+      return slot < other.slot;
+    return name < other.name;
+  }
+};
+
+// Something that writes a variable or array element: an assignment, READ
+// (no value), a FOR loop (value and last are its bounds) or a procedure
+// argument. Its expressions read the frame of procedure context.
+struct RangeDefinition {
+  RangeVariable variable;
+  ArrayVariable *array = nullptr;
+  ProcedureNode *context = nullptr;
+  ExpressionNode *value = nullptr;
+  ExpressionNode *last = nullptr;
+  bool is_downto = false;
+};
+
+static std::map<RangeVariable, ValueRange> variableRanges;
+static std::map<RangeVariable, std::set<std::string>> variableNames;
+static std::map<ArrayVariable *, ValueRange> elementRanges;
+static std::vector<RangeDefinition> definitions;
+static BlockNode *analyzedBlock = nullptr;
+
+// Nodes the ranges are used for, with the frame they run in.
+static std::vector<std::pair<ExpressionNode *, ProcedureNode *>> comparisons;
+static std::vector<std::pair<IfStatementNode *, ProcedureNode *>> conditions;
+static std::vector<std::pair<NotFactorNode *, ProcedureNode *>> negations;
+static int exactComparisons = 0;
+static int integerConditions = 0;
+
+static ValueRange any_value() {
+  ValueRange range;
+  range.low = -infinity;
+  range.high = infinity;
+  range.integral = false;
+  range.maybe_nan = true;
+  return range;
+}
+
+static ValueRange exactly(float value) {
+  if (std::isnan(value))
+    return any_value();
+  ValueRange range;
+  range.low = range.high = value;
+  range.integral = std::isfinite(value) && value == std::floor(value);
+  return range;
+}
+
+static ValueRange truth_value() {
+  ValueRange range;
+  range.high = 1.0;
+  return range;
+}
+
+static ValueRange join(const ValueRange &a, const ValueRange &b) {
+  ValueRange range;
+  range.low = std::min(a.low, b.low);
+  range.high = std::max(a.high, b.high);
+  range.integral = a.integral && b.integral;
+  range.maybe_nan = a.maybe_nan || b.maybe_nan;
+  return range;
+}
+
+static bool infinite(const ValueRange &range) {
+  return range.low == -infinity || range.high == infinity;
+}
+
+static bool has_zero(const ValueRange &range) {
+  return range.low <= 0.0 && range.high >= 0.0;
+}
+
+// Sums, differences and products of whole numbers are whole unless they
+// overflow.
+static void settle(ValueRange &range, bool whole_operands) {
+  range.integral = whole_operands && std::isfinite(range.low) &&
+                   std::isfinite(range.high) && !range.maybe_nan;
+}
+
+// Float arithmetic rounds monotonically, so applying an operation to the
+// bounds, in float as the interpreter does, bounds every result.
+static ValueRange add(const ValueRange &a, const ValueRange &b) {
+  ValueRange range;
+  range.low = a.low + b.low;
+  range.high = a.high + b.high;
+  range.maybe_nan = a.maybe_nan || b.maybe_nan ||
+                    (a.high == infinity && b.low == -infinity) ||
+                    (a.low == -infinity && b.high == infinity);
+  if (std::isnan(range.low))
+    range.low = -infinity;
+  if (std::isnan(range.high))
+    range.high = infinity;
+  settle(range, a.integral && b.integral);
+  return range;
+}
+
+static ValueRange opposite(const ValueRange &a) {
+  ValueRange range = a;
+  range.low = -a.high;
+  range.high = -a.low;
+  return range;
+}
+
+// A bound of a product; 0 * inf is NaN, which the caller notes.
+static float product(float a, float b) {
+  return a == 0.0 || b == 0.0 ? 0.0 : a * b;
+}
+
+static ValueRange multiply(const ValueRange &a, const ValueRange &b) {
+  float corners[4] = {product(a.low, b.low), product(a.low, b.high),
+                      product(a.high, b.low), product(a.high, b.high)};
+  ValueRange range;
+  range.low = *std::min_element(corners, corners + 4);
+  range.high = *std::max_element(corners, corners + 4);
+  range.maybe_nan = a.maybe_nan || b.maybe_nan ||
+                    (has_zero(a) && infinite(b)) ||
+                    (has_zero(b) && infinite(a));
+  settle(range, a.integral && b.integral);
+  return range;
+}
+
+static ValueRange divide(const ValueRange &a, const ValueRange &b) {
+  if (has_zero(b) || (infinite(a) && infinite(b)))
+    return any_value();
+  float corners[4] = {a.low / b.low, a.low / b.high, a.high / b.low,
+                      a.high / b.high};
+  ValueRange range;
+  range.low = *std::min_element(corners, corners + 4);
+  range.high = *std::max_element(corners, corners + 4);
+  range.maybe_nan = a.maybe_nan || b.maybe_nan;
+  range.integral = false;
+  return range;
+}
+
+static RangeVariable range_variable(ProcedureNode *context,
+                                    const std::string &name, int frame_slot) {
+  RangeVariable variable;
+  if (frame_slot >= 0) {
+    variable.procedure = context;
+    variable.slot = frame_slot;
+  } else {
+    variable.name = name;
+  }
+  return variable;
+}
+
+static ValueRange variable_range(const RangeVariable &variable) {
+  auto range = variableRanges.find(variable);
+  return range == variableRanges.end() ? ValueRange() : range->second;
+}
+
+static ValueRange element_range(ArrayVariable *array) {
+  auto range = elementRanges.find(array);
+  return range == elementRanges.end() ? ValueRange() : range->second;
+}
+
+static ValueRange range_of(ExpressionNode *expression, ProcedureNode *context);
+
+static ValueRange range_of(FactorNode *factor, ProcedureNode *context) {
+  if (FloatFactorNode *literal = dynamic_cast<FloatFactorNode *>(factor))
+    return exactly(literal->float_literal);
+  if (IntFactorNode *literal = dynamic_cast<IntFactorNode *>(factor)) {
+    try {
+      return exactly(std::stof(literal->int_literal));
+    } catch (...) {
+      return any_value();
+    }
+  }
+  if (ConstantFactorNode *constant = dynamic_cast<ConstantFactorNode *>(factor))
+    return exactly(constant->constant_value);
+  if (IdFactorNode *id = dynamic_cast<IdFactorNode *>(factor))
+    return variable_range(
+        range_variable(context, id->identifier, id->frame_slot));
+  if (ArrayFactorNode *element = dynamic_cast<ArrayFactorNode *>(factor))
+    return element_range(element->array);
+  if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor))
+    return opposite(range_of(minus->child_factor, context));
+  if (dynamic_cast<NotFactorNode *>(factor))
+    return truth_value();
+  if (ExpressionFactorNode *nested =
+          dynamic_cast<ExpressionFactorNode *>(factor))
+    return range_of(nested->child_expression, context);
+  return any_value();
+}
+
+static ValueRange range_of(TermNode *term, ProcedureNode *context) {
+  ValueRange range = range_of(term->first_factor, context);
+  for (size_t i = 0; i < term->following_operators.size(); i++) {
+    ValueRange factor = range_of(term->following_factors[i], context);
+    switch (term->following_operators[i]) {
+    case TOK_MULTIPLY:
+      range = multiply(range, factor);
+      break;
+    case TOK_DIVIDE:
+      range = divide(range, factor);
+      break;
+    case TOK_AND:
+      range = truth_value();
+      break;
+    default:
+      range = any_value();
+      break;
+    }
+  }
+  return range;
+}
+
+static ValueRange range_of(SimpleExpressionNode *simple_exp,
+                           ProcedureNode *context) {
+  ValueRange range = range_of(simple_exp->first_term, context);
+  for (size_t i = 0; i < simple_exp->following_operators.size(); i++) {
+    ValueRange term = range_of(simple_exp->following_terms[i], context);
+    switch (simple_exp->following_operators[i]) {
+    case TOK_PLUS:
+      range = add(range, term);
+      break;
+    case TOK_MINUS:
+      range = add(range, opposite(term));
+      break;
+    case TOK_OR:
+      range = truth_value();
+      break;
+    default:
+      range = any_value();
+      break;
+    }
+  }
+  return range;
+}
+
+static ValueRange range_of(ExpressionNode *expression, ProcedureNode *context) {
+  if (expression->simple_exp_operator != TOK_UNKNOWN)
+    return truth_value();
+  return range_of(expression->first_simple_exp, context);
+}
+
+// The values a FOR loop gives its counter. Counting by one from a whole
+// number is exact up to exactIntegers and stays within the bounds; past it
+// rounding may step beyond the last value, but never overflows. Returns
+// false when the loop never runs.
+static bool counter_range(const RangeDefinition &loop, ValueRange &range) {
+  ValueRange first = range_of(loop.value, loop.context);
+  ValueRange last = range_of(loop.last, loop.context);
+  range = ValueRange();
+  range.integral = first.integral;
+  if (!loop.is_downto) {
+    range.low = first.low;
+    if (!first.integral)
+      range.high = infinity;
+    else if (first.low >= -exactIntegers && last.high <= exactIntegers)
+      range.high = std::floor(last.high);
+    else
+      range.high = FLT_MAX;
+  } else {
+    range.high = first.high;
+    if (!first.integral)
+      range.low = -infinity;
+    else if (first.high <= exactIntegers && last.low >= -exactIntegers)
+      range.low = std::ceil(last.low);
+    else
+      range.low = -FLT_MAX;
+  }
+  return !(range.low > range.high);
+}
+
+static void collect(ExpressionNode *expression, ProcedureNode *context);
+
+static void collect(FactorNode *factor, ProcedureNode *context) {
+  if (ArrayFactorNode *element = dynamic_cast<ArrayFactorNode *>(factor)) {
+    collect(element->index_expression, context);
+  } else if (MinusFactorNode *minus = dynamic_cast<MinusFactorNode *>(factor)) {
+    collect(minus->child_factor, context);
+  } else if (NotFactorNode *negation = dynamic_cast<NotFactorNode *>(factor)) {
+    negations.push_back(std::make_pair(negation, context));
+    collect(negation->child_factor, context);
+  } else if (ExpressionFactorNode *nested =
+                 dynamic_cast<ExpressionFactorNode *>(factor)) {
+    collect(nested->child_expression, context);
+  }
+}
+
+static void collect(SimpleExpressionNode *simple_exp, ProcedureNode *context) {
+  std::vector<TermNode *> terms(1, simple_exp->first_term);
+  terms.insert(terms.end(), simple_exp->following_terms.begin(),
+               simple_exp->following_terms.end());
+  for (auto term = terms.begin(); term != terms.end(); ++term) {
+    collect((*term)->first_factor, context);
+    for (auto it = (*term)->following_factors.begin();
+         it != (*term)->following_factors.end(); ++it)
+      collect(*it, context);
+  }
+}
+
+static void collect(ExpressionNode *expression, ProcedureNode *context) {
+  if (expression->simple_exp_operator != TOK_UNKNOWN) {
+    comparisons.push_back(std::make_pair(expression, context));
+    collect(expression->second_simple_exp, context);
+  }
+  collect(expression->first_simple_exp, context);
+}
+
+static void define(ProcedureNode *context, const std::string &name,
+                   int frame_slot, ExpressionNode *value) {
+  RangeDefinition definition;
+  definition.variable = range_variable(context, name, frame_slot);
+  definition.context = context;
+  definition.value = value;
+  definitions.push_back(definition);
+  variableNames[definition.variable].insert(name);
+}
+
+static void collect(StatementNode *statement, ProcedureNode *context) {
+  if (CompoundStatementNode *compound =
+          dynamic_cast<CompoundStatementNode *>(statement)) {
+    for (auto it = compound->statement_vector.begin();
+         it != compound->statement_vector.end(); ++it)
+      collect(*it, context);
+  } else if (AssignmentStatementNode *assignment =
+                 dynamic_cast<AssignmentStatementNode *>(statement)) {
+    define(context, assignment->identifier, assignment->frame_slot,
+           assignment->assignment_expr);
+    collect(assignment->assignment_expr, context);
+  } else if (ArrayAssignmentStatementNode *assignment =
+                 dynamic_cast<ArrayAssignmentStatementNode *>(statement)) {
+    RangeDefinition definition;
+    definition.array = assignment->array;
+    definition.context = context;
+    definition.value = assignment->assignment_expr;
+    definitions.push_back(definition);
+    collect(assignment->index_expression, context);
+    collect(assignment->assignment_expr, context);
+  } else if (ReadStatementNode *read =
+                 dynamic_cast<ReadStatementNode *>(statement)) {
+    define(context, read->read_text, read->frame_slot, nullptr);
+  } else if (WriteStatementNode *write =
+                 dynamic_cast<WriteStatementNode *>(statement)) {
+    if (write->element)
+      collect(write->element, context);
+  } else if (IfStatementNode *if_stmt =
+                 dynamic_cast<IfStatementNode *>(statement)) {
+    conditions.push_back(std::make_pair(if_stmt, context));
+    collect(if_stmt->if_expression, context);
+    collect(if_stmt->then_statement, context);
+    if (if_stmt->has_else)
+      collect(if_stmt->else_statement, context);
+  } else if (WhileStatementNode *loop =
+                 dynamic_cast<WhileStatementNode *>(statement)) {
+    collect(loop->while_expression, context);
+    collect(loop->while_statement, context);
+  } else if (ForStatementNode *loop =
+                 dynamic_cast<ForStatementNode *>(statement)) {
+    define(context, loop->identifier, loop->frame_slot, loop->start_expression);
+    definitions.back().last = loop->end_expression;
+    definitions.back().is_downto = loop->is_downto;
+    collect(loop->start_expression, context);
+    collect(loop->end_expression, context);
+    collect(loop->for_statement, context);
+  } else if (CallStatementNode *call =
+                 dynamic_cast<CallStatementNode *>(statement)) {
+    // Parameters take the arguments; locals start at zero.
+    ProcedureNode *callee = call->procedure;
+    for (size_t i = 0; i < call->arguments.size(); i++) {
+      RangeDefinition definition;
+      definition.variable = range_variable(callee, "", i);
+      definition.context = context;
+      definition.value = call->arguments[i];
+      definitions.push_back(definition);
+      collect(call->arguments[i], context);
+    }
+  }
+}
+
+// Joins value into range; from the exactPasses-th pass on, a bound that
+// still moves goes straight to the largest float, then to infinity.
+static bool widen(ValueRange &range, const ValueRange &value, int pass) {
+  ValueRange joined = join(range, value);
+  if (pass >= exactPasses) {
+    if (joined.low < range.low)
+      joined.low = joined.low >= -FLT_MAX ? -FLT_MAX : -infinity;
+    if (joined.high > range.high)
+      joined.high = joined.high <= FLT_MAX ? FLT_MAX : infinity;
+  }
+  if (joined.low == range.low && joined.high == range.high &&
+      joined.integral == range.integral &&
+      joined.maybe_nan == range.maybe_nan)
+    return false;
+  range = joined;
+  return true;
+}
+
+// Runs every definition over the ranges until none of them grows.
+static void solve() {
+  bool changed = true;
+  for (int pass = 0; changed; pass++) {
+    changed = false;
+    for (auto it = definitions.begin(); it != definitions.end(); ++it) {
+      ValueRange value;
+      if (!it->value)
+        value = any_value();
+      else if (it->last && !counter_range(*it, value))
+        continue;
+      else if (!it->last)
+        value = range_of(it->value, it->context);
+
+      if (it->array) {
+        auto range = elementRanges.insert(
+            std::make_pair(it->array, ValueRange())).first;
+        changed |= widen(range->second, value, pass);
+      } else {
+        auto range = variableRanges.insert(
+            std::make_pair(it->variable, ValueRange())).first;
+        changed |= widen(range->second, value, pass);
+      }
+    }
+  }
+}
+
+void analyze_ranges(ProgramNode *root) {
+  BlockNode *block = root->program_block;
+  analyzedBlock = block;
+  collect(block->compound_stmt, nullptr);
+  for (auto it = block->procedures.begin(); it != block->procedures.end();
+       ++it) {
+    ProcedureNode *procedure = *it;
+    for (size_t slot = 0; slot < procedure->local_names.size(); slot++)
+      variableNames[range_variable(procedure, "", slot)].insert(
+          procedure->local_names[slot]);
+    collect(procedure->body, procedure);
+  }
+  for (auto it = symbolTable.begin(); it != symbolTable.end(); ++it)
+    variableNames[range_variable(nullptr, it->first, -1)].insert(it->first);
+  solve();
+
+  for (auto it = comparisons.begin(); it != comparisons.end(); ++it) {
+    ExpressionNode *expression = it->first;
+    expression->exact_compare =
+        range_of(expression->first_simple_exp, it->second).integral &&
+        range_of(expression->second_simple_exp, it->second).integral;
+    exactComparisons += expression->exact_compare;
+  }
+  for (auto it = conditions.begin(); it != conditions.end(); ++it) {
+    IfStatementNode *if_stmt = it->first;
+    if_stmt->integer_condition =
+        range_of(if_stmt->if_expression, it->second).integral;
+    integerConditions += if_stmt->integer_condition;
+  }
+  for (auto it = negations.begin(); it != negations.end(); ++it) {
+    NotFactorNode *negation = it->first;
+    negation->integer_operand =
+        range_of(negation->child_factor, it->second).integral;
+    integerConditions += negation->integer_operand;
+  }
+}
+
+// The smallest integer type holding every value of a whole-number range.
+static const char *storage_type(const ValueRange &range) {
+  if (range.low >= -128.0 && range.high <= 127.0)
+    return "int8";
+  if (range.low >= -32768.0 && range.high <= 32767.0)
+    return "int16";
+  if (range.low >= -2147483648.0 && range.high <= 2147483647.0)
+    return "int32";
+  return "float";
+}
+
+static void print_range(std::ostream &os, const std::string &name,
+                        const ValueRange &range) {
+  os << name << ": ";
+  if (range.low == -infinity && range.high == infinity) {
+    os << (range.maybe_nan ? "any value" : "any number") << std::endl;
+    return;
+  }
+  if (range.integral)
+    os << "integer " << range.low << " .. " << range.high << ", "
+       << storage_type(range) << " storage";
+  else
+    os << "real " << range.low << " .. " << range.high;
+  if (range.maybe_nan)
+    os << ", may be NaN";
+  os << std::endl;
+}
+
+static void print_variables(std::ostream &os, ProcedureNode *procedure) {
+  for (auto it = variableNames.begin(); it != variableNames.end(); ++it) {
+    const RangeVariable &variable = it->first;
+    if (variable.procedure != procedure)
+      continue;
+    std::ostringstream name;
+    if (variable.slot < 0) {
+      name << variable.name;
+    } else {
+      if (procedure)
+        name << procedure->name << ".";
+      const char *separator = "";
+      for (auto alias = it->second.begin(); alias != it->second.end();
+           ++alias) {
+        name << separator << *alias;
+        separator = "/";
+      }
+      name << " (slot " << variable.slot << ")";
+    }
+    print_range(os, name.str(), variable_range(variable));
+  }
+}
+
+void print_ranges(std::ostream &os) {
+  os << std::endl << "*** Value Ranges ***" << std::endl;
+  print_variables(os, nullptr);
+  for (auto it = arrayTable.begin(); it != arrayTable.end(); ++it)
+    print_range(os, it->first + "[]", element_range(it->second));
+  if (analyzedBlock)
+    for (auto it = analyzedBlock->procedures.begin();
+         it != analyzedBlock->procedures.end(); ++it)
+      print_variables(os, *it);
+  os << "Exact comparisons: " << exactComparisons << " of "
+     << comparisons.size() << ", whole-number truth tests: "
+     << integerConditions << " of " << conditions.size() + negations.size()
+     << std::endl;
+}
@@ -0,0 +1,18 @@
+#ifndef RANGE_ANALYSIS_H
+#define RANGE_ANALYSIS_H
+
+#include "parse_tree_nodes.h"
+#include <ostream>
+
+// Works out, before the program runs, the values each variable and array
+// may hold: bounds, and whether they are always whole numbers. Comparisons
+// of whole numbers are then made exactly, without EPSILON, and IF and NOT
+// test whole numbers against zero; either way gives the same results.
+// Not used by -i, whose variables change between statements.
+void analyze_ranges(ProgramNode *root);
+
+// One line per variable, array and frame slot with the values found, and
+// how many comparisons and truth tests were made exact (--report-ranges).
+void print_ranges(std::ostream &os);
+
+#endif /* RANGE_ANALYSIS_H */
@@ -0,0 +1,86 @@
+#include "repl.h"
+#include "input.h"
+#include "lexer.h"
+#include "output.h"
+#include "parser.h"
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <unistd.h>
+
+extern "C" {
+extern FILE *yyin;
+extern int yylineno;
+}
+
+// Skip the rest of a bad entry so the next one starts on a fresh token.
+static void resync() {
+  while (nextToken != TOK_SEMICOLON && nextToken != TOK_EOF)
+    nextToken = yylex();
+}
+
+static void prompt(bool interactive) {
+  if (interactive) {
+    cout << "tips> ";
+    output_flush();
+  }
+}
+
+// Each entry is a single "VAR name: type;" or "LET name = value;"
+// declaration, a PROCEDURE declaration, or a statement ended by ';'. Entries
+// are parsed with the batch parser, run once against the shared symbol table
+// and then discarded, so nothing is parsed or run twice.
+void repl() {
+  bool interactive = isatty(fileno(yyin));
+  if (yyin == stdin)
+    input_share_stdin();
+
+  for (;;) {
+    prompt(interactive);
+    nextToken = yylex();
+    if (nextToken == TOK_EOF || nextToken == TOK_END)
+      break;
+    if (nextToken == TOK_SEMICOLON)
+      continue;
+
+    StatementNode *entry = nullptr;
+    try {
+      if (nextToken == TOK_VAR) {
+        nextToken = yylex();
+        declare_ident();
+        continue;
+      }
+      if (nextToken == TOK_LET) {
+        declare_constant();
+        continue;
+      }
+      if (nextToken == TOK_PROCEDURE) {
+        declare_procedure();
+        continue;
+      }
+      entry = statement();
+      if (nextToken != TOK_SEMICOLON && nextToken != TOK_EOF)
+        throw("14: ';' expected");
+    } catch (char const *errmsg) {
+      cout << "***ERROR: line " << yylineno << ", near |" << yytext
+           << "|, error type " << errmsg << endl;
+      resync();
+      continue;
+    }
+
+    try {
+      // A runtime error inside a procedure leaves its frame current.
+      framePointer = 0;
+      stackTop = frameSize;
+      entry->interpret();
+    } catch (char const *errmsg) {
+      cout << "***ERROR: " << errmsg << endl;
+    } catch (std::exception &e) {
+      cout << "***ERROR: " << e.what() << endl;
+    }
+    delete entry;
+
+    if (nextToken == TOK_EOF)
+      break;
+  }
+}
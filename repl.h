@@ -0,0 +1,6 @@
+#ifndef REPL_H
+#define REPL_H
+
+void repl();
+
+#endif /* REPL_H */
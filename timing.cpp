@@ -0,0 +1,91 @@
+#include "timing.h"
+#include <cstdio>
+#include <sys/resource.h>
+#include <time.h>
+
+static double clock_seconds(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+PhaseClock::PhaseClock() {
+  start.wall = clock_seconds(CLOCK_MONOTONIC);
+  start.cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+PhaseTime PhaseClock::stop() const {
+  PhaseTime elapsed;
+  elapsed.wall = clock_seconds(CLOCK_MONOTONIC) - start.wall;
+  elapsed.cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - start.cpu;
+  return elapsed;
+}
+
+static double per_second(double count, double seconds) {
+  return seconds > 0.0 ? count / seconds : 0.0;
+}
+
+static long peak_resident_kb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return usage.ru_maxrss;
+}
+
+void print_timing(std::ostream &os, const TimingReport &report, bool json) {
+  const char *names[] = {"lex", "parse", "execute", "output", "total"};
+  const PhaseTime *phases[] = {&report.lex, &report.parse, &report.execute,
+                               &report.output, &report.total};
+  double tokens_rate = per_second(report.tokens, report.lex.wall);
+  double nodes_rate = per_second(report.nodes, report.parse.wall);
+  double statements_rate = per_second(report.statements, report.execute.wall);
+  long peak_kb = peak_resident_kb();
+  char line[160];
+
+  if (json) {
+    os << "{\"phases\": {";
+    for (int i = 0; i < 5; i++) {
+      snprintf(line, sizeof line,
+               "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}",
+               i ? ", " : "", names[i], phases[i]->wall * 1000.0,
+               phases[i]->cpu * 1000.0);
+      os << line;
+    }
+    snprintf(line, sizeof line,
+             "}, \"tokens\": %lu, \"tokens_per_second\": %.0f, "
+             "\"nodes\": %lu, \"nodes_per_second\": %.0f, ",
+             report.tokens, tokens_rate, report.nodes, nodes_rate);
+    os << line;
+    snprintf(line, sizeof line,
+             "\"statements\": %lu, \"statements_per_second\": %.0f, "
+             "\"output_bytes\": %llu, \"write_ms\": %.3f, "
+             "\"peak_rss_kb\": %ld}",
+             report.statements, statements_rate, report.output_bytes,
+             report.write_seconds * 1000.0, peak_kb);
+    os << line << std::endl;
+    return;
+  }
+
+  os << std::endl << "*** Timing ***" << std::endl;
+  snprintf(line, sizeof line, "%-10s %12s %12s", "phase", "wall ms", "cpu ms");
+  os << line << std::endl;
+  for (int i = 0; i < 5; i++) {
+    snprintf(line, sizeof line, "%-10s %12.3f %12.3f", names[i],
+             phases[i]->wall * 1000.0, phases[i]->cpu * 1000.0);
+    os << line << std::endl;
+  }
+  snprintf(line, sizeof line, "tokens               %12lu  %14.0f/s",
+           report.tokens, tokens_rate);
+  os << line << std::endl;
+  snprintf(line, sizeof line, "nodes                %12lu  %14.0f/s",
+           report.nodes, nodes_rate);
+  os << line << std::endl;
+  snprintf(line, sizeof line, "statements executed  %12lu  %14.0f/s",
+           report.statements, statements_rate);
+  os << line << std::endl;
+  snprintf(line, sizeof line, "output bytes         %12llu  %11.3f ms writing",
+           report.output_bytes, report.write_seconds * 1000.0);
+  os << line << std::endl;
+  snprintf(line, sizeof line, "peak resident        %12ld KB", peak_kb);
+  os << line << std::endl;
+}
@@ -0,0 +1,40 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <ostream>
+
+// Wall and CPU seconds, the CPU time counting every thread of the process.
+struct PhaseTime {
+  double wall = 0.0;
+  double cpu = 0.0;
+};
+
+// Starts timing a phase; stop() returns the time since.
+class PhaseClock {
+public:
+  PhaseClock();
+  PhaseTime stop() const;
+
+private:
+  PhaseTime start;
+};
+
+// What -T reports after a run.
+struct TimingReport {
+  PhaseTime lex;
+  PhaseTime parse; // without the time spent in the lexer
+  PhaseTime execute;
+  PhaseTime output; // the final flush of buffered output
+  PhaseTime total;
+  unsigned long tokens = 0;
+  unsigned long nodes = 0;
+  unsigned long statements = 0;
+  unsigned long long output_bytes = 0;
+  double write_seconds = 0.0; // in write calls, overlapping execution
+};
+
+// Prints the report with throughputs and peak resident memory, as text or
+// as one JSON object.
+void print_timing(std::ostream &os, const TimingReport &report, bool json);
+
+#endif /* TIMING_H */
@@ -0,0 +1,169 @@
+#include "work_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Iterations [next, end) of the current run not yet taken by a worker.
+struct Share {
+  std::mutex lock;
+  long next = 0;
+  long end = 0;
+};
+
+class WorkPool {
+public:
+  WorkPool(int workers);
+  ~WorkPool();
+  int size() { return workers; }
+  void run(long count, long grain,
+           const std::function<void(int, long, long)> &body);
+
+private:
+  void thread_main(int worker);
+  void work(int worker);
+  bool take(int worker, long &begin, long &end);
+  bool steal(int worker);
+
+  int workers;
+  std::unique_ptr<Share[]> shares;
+  std::vector<std::thread> threads;
+
+  std::mutex job_lock;
+  std::condition_variable job_ready;
+  std::condition_variable job_done;
+  unsigned long job_number = 0;
+  int busy_threads = 0;
+  bool stopping = false;
+  const std::function<void(int, long, long)> *job = nullptr;
+  long job_grain = 1;
+};
+
+static int poolWorkers = 0;
+static std::unique_ptr<WorkPool> pool;
+static std::atomic<bool> poolBusy(false);
+
+WorkPool::WorkPool(int worker_count) {
+  workers = worker_count;
+  shares.reset(new Share[workers]);
+  for (int worker = 1; worker < workers; worker++)
+    threads.push_back(std::thread(&WorkPool::thread_main, this, worker));
+}
+
+WorkPool::~WorkPool() {
+  {
+    std::lock_guard<std::mutex> guard(job_lock);
+    stopping = true;
+  }
+  job_ready.notify_all();
+  for (auto it = threads.begin(); it != threads.end(); ++it)
+    it->join();
+}
+
+void WorkPool::run(long count, long grain,
+                   const std::function<void(int, long, long)> &body) {
+  long start = 0;
+  for (int worker = 0; worker < workers; worker++) {
+    long share = count / workers + (worker < count % workers ? 1 : 0);
+    shares[worker].next = start;
+    shares[worker].end = start + share;
+    start += share;
+  }
+  {
+    std::lock_guard<std::mutex> guard(job_lock);
+    job = &body;
+    job_grain = std::max(grain, 1L);
+    busy_threads = workers - 1;
+    job_number++;
+  }
+  job_ready.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> guard(job_lock);
+  job_done.wait(guard, [this] { return busy_threads == 0; });
+  job = nullptr;
+}
+
+void WorkPool::thread_main(int worker) {
+  unsigned long last_job = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(job_lock);
+      job_ready.wait(guard, [&] { return stopping || job_number != last_job; });
+      if (stopping)
+        return;
+      last_job = job_number;
+    }
+    work(worker);
+    std::lock_guard<std::mutex> guard(job_lock);
+    if (--busy_threads == 0)
+      job_done.notify_one();
+  }
+}
+
+void WorkPool::work(int worker) {
+  long begin = 0, end = 0;
+  while (take(worker, begin, end) ||
+         (steal(worker) && take(worker, begin, end)))
+    (*job)(worker, begin, end);
+}
+
+bool WorkPool::take(int worker, long &begin, long &end) {
+  Share &own = shares[worker];
+  std::lock_guard<std::mutex> guard(own.lock);
+  if (own.next >= own.end)
+    return false;
+  begin = own.next;
+  end = std::min(own.next + job_grain, own.end);
+  own.next = end;
+  return true;
+}
+
+// Moves the back half of the first nonempty share found into our own.
+bool WorkPool::steal(int worker) {
+  for (int i = 1; i < workers; i++) {
+    Share &victim = shares[(worker + i) % workers];
+    long begin = 0, end = 0;
+    {
+      std::lock_guard<std::mutex> guard(victim.lock);
+      long left = victim.end - victim.next;
+      if (left <= 0)
+        continue;
+      begin = victim.next + left / 2;
+      end = victim.end;
+      victim.end = begin;
+    }
+    Share &own = shares[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    own.next = begin;
+    own.end = end;
+    return true;
+  }
+  return false;
+}
+
+void pool_set_size(int workers) {
+  poolWorkers = std::max(workers, 1);
+  pool.reset();
+}
+
+int pool_size() {
+  if (poolWorkers == 0)
+    poolWorkers = std::max((int)std::thread::hardware_concurrency(), 1);
+  return poolWorkers;
+}
+
+bool pool_running() { return poolBusy; }
+
+void pool_run(long count, long grain,
+              const std::function<void(int, long, long)> &body) {
+  if (!pool || pool->size() != pool_size())
+    pool.reset(new WorkPool(pool_size()));
+  poolBusy = true;
+  pool->run(count, grain, body);
+  poolBusy = false;
+}
@@ -0,0 +1,20 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <functional>
+
+// Threads shared by the parallel parts of the interpreter. Worker 0 is the
+// thread that calls pool_run; the others wait for work between runs.
+void pool_set_size(int workers);
+int pool_size();
+// True while pool_run is executing, so nested parallel work stays serial.
+bool pool_running();
+
+// Calls body(worker, begin, end) on disjoint ranges covering [0, count).
+// Each worker starts on an equal share and takes up to grain iterations at a
+// time; a worker whose share runs out steals the back half of another's.
+// body must not throw.
+void pool_run(long count, long grain,
+              const std::function<void(int, long, long)> &body);
+
+#endif /* WORK_POOL_H */